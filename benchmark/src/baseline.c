@@ -0,0 +1,279 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "baseline.h"
+
+#define MAX_DEPTH 16
+
+typedef struct {
+   const char* c;
+   bool failed;
+} Parser;
+
+static void skipSpaces(Parser* parser)
+{
+   while (isspace((unsigned char) *parser->c)) {
+      parser->c++;
+   }
+}
+
+static bool expect(Parser* parser, char expected)
+{
+   skipSpaces(parser);
+   if (*parser->c != expected) {
+      parser->failed = true;
+      return false;
+   }
+   parser->c++;
+   return true;
+}
+
+// Escapes are kept as is, names in the baseline don't need them
+static void parseString(Parser* parser, char* string, size_t size)
+{
+   if (!expect(parser, '"')) {
+      return;
+   }
+   size_t length = 0;
+   while (*parser->c != '"') {
+      if (*parser->c == '\0') {
+         parser->failed = true;
+         return;
+      }
+      if (*parser->c == '\\' && parser->c[1] != '\0') {
+         parser->c++;
+      }
+      if (length + 1 < size) {
+         string[length++] = *parser->c;
+      }
+      parser->c++;
+   }
+   parser->c++;
+   if (size > 0) {
+      string[length] = '\0';
+   }
+}
+
+static double parseNumber(Parser* parser)
+{
+   skipSpaces(parser);
+   char* end;
+   double number = strtod(parser->c, &end);
+   if (end == parser->c) {
+      parser->failed = true;
+   }
+   parser->c = end;
+   return number;
+}
+
+static bool parseBool(Parser* parser)
+{
+   skipSpaces(parser);
+   if (strncmp(parser->c, "true", 4) == 0) {
+      parser->c += 4;
+      return true;
+   }
+   if (strncmp(parser->c, "false", 5) == 0) {
+      parser->c += 5;
+      return false;
+   }
+   parser->failed = true;
+   return false;
+}
+
+static void skipValue(Parser* parser, int depth)
+{
+   skipSpaces(parser);
+   char first = *parser->c;
+   if (depth > MAX_DEPTH) {
+      parser->failed = true;
+   }
+   else if (first == '"') {
+      parseString(parser, NULL, 0);
+   }
+   else if (first == '{' || first == '[') {
+      char last = first == '{' ? '}' : ']';
+      parser->c++;
+      skipSpaces(parser);
+      if (*parser->c == last) {
+         parser->c++;
+         return;
+      }
+      do {
+         if (first == '{') {
+            parseString(parser, NULL, 0);
+            expect(parser, ':');
+         }
+         skipValue(parser, depth + 1);
+         skipSpaces(parser);
+      } while (!parser->failed && *parser->c++ == ',');
+      if (parser->c[-1] != last) {
+         parser->failed = true;
+      }
+   }
+   else if (strncmp(parser->c, "null", 4) == 0) {
+      parser->c += 4;
+   }
+   else if (first == 't' || first == 'f') {
+      parseBool(parser);
+   }
+   else {
+      parseNumber(parser);
+   }
+}
+
+// Calls parseField for each field of an object
+static void parseObject(
+   Parser* parser, void* object,
+   void (*parseField)(Parser* parser, const char* key, void* object)
+){
+   if (!expect(parser, '{')) {
+      return;
+   }
+   skipSpaces(parser);
+   if (*parser->c == '}') {
+      parser->c++;
+      return;
+   }
+   do {
+      char key[BASELINE_NAME_SIZE];
+      parseString(parser, key, sizeof(key));
+      expect(parser, ':');
+      if (!parser->failed) {
+         parseField(parser, key, object);
+      }
+      skipSpaces(parser);
+   } while (!parser->failed && *parser->c++ == ',');
+   if (!parser->failed && parser->c[-1] != '}') {
+      parser->failed = true;
+   }
+}
+
+static void parseEntryField(Parser* parser, const char* key, void* object)
+{
+   BaselineEntry* entry = object;
+   if (strcmp(key, "benchmark") == 0) {
+      parseString(parser, entry->benchmark, BASELINE_NAME_SIZE);
+   }
+   else if (strcmp(key, "type") == 0) {
+      parseString(parser, entry->type, BASELINE_NAME_SIZE);
+   }
+   else if (strcmp(key, "width") == 0) {
+      entry->width = (int) parseNumber(parser);
+   }
+   else if (strcmp(key, "height") == 0) {
+      entry->height = (int) parseNumber(parser);
+   }
+   else if (strcmp(key, "value") == 0) {
+      entry->value = parseNumber(parser);
+   }
+   else if (strcmp(key, "tolerance") == 0) {
+      entry->tolerance = parseNumber(parser);
+   }
+   else {
+      skipValue(parser, 0);
+   }
+}
+
+static void parseResults(Parser* parser, Baseline* baseline)
+{
+   if (!expect(parser, '[')) {
+      return;
+   }
+   skipSpaces(parser);
+   if (*parser->c == ']') {
+      parser->c++;
+      return;
+   }
+   do {
+      if (baseline->entriesCount == BASELINE_MAX_ENTRIES) {
+         parser->failed = true;
+         return;
+      }
+      BaselineEntry* entry = &baseline->entries[baseline->entriesCount++];
+      *entry = (BaselineEntry) {.tolerance = -1};
+      parseObject(parser, entry, parseEntryField);
+      skipSpaces(parser);
+   } while (!parser->failed && *parser->c++ == ',');
+   if (!parser->failed && parser->c[-1] != ']') {
+      parser->failed = true;
+   }
+}
+
+static void parseBaselineField(Parser* parser, const char* key, void* object)
+{
+   Baseline* baseline = object;
+   if (strcmp(key, "results") == 0) {
+      parseResults(parser, baseline);
+   }
+   else if (strcmp(key, "tolerance") == 0) {
+      baseline->tolerance = parseNumber(parser);
+   }
+   else if (strcmp(key, "software") == 0) {
+      baseline->software = parseBool(parser);
+   }
+   else {
+      skipValue(parser, 0);
+   }
+}
+
+bool loadBaseline(const char* path, Baseline* baseline)
+{
+   FILE* file = fopen(path, "rb");
+   if (file == NULL) {
+      fprintf(stderr, "Could not open baseline %s\n", path);
+      return false;
+   }
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   char* text = size >= 0 ? malloc(size + 1) : NULL;
+   if (text == NULL || fread(text, 1, size, file) != (size_t) size) {
+      fprintf(stderr, "Could not read baseline %s\n", path);
+      free(text);
+      fclose(file);
+      return false;
+   }
+   text[size] = '\0';
+   fclose(file);
+
+   baseline->entriesCount = 0;
+   baseline->tolerance = -1;
+   baseline->software = false;
+
+   Parser parser = {.c = text};
+   parseObject(&parser, baseline, parseBaselineField);
+   free(text);
+
+   if (parser.failed) {
+      fprintf(stderr, "Malformed baseline %s\n", path);
+      return false;
+   }
+   return true;
+}
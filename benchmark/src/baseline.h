@@ -0,0 +1,52 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+#define BASELINE_MAX_ENTRIES 256
+
+#define BASELINE_NAME_SIZE 32
+
+typedef struct {
+   char benchmark[BASELINE_NAME_SIZE];
+   char type[BASELINE_NAME_SIZE];
+   int width;
+   int height;
+   double value;
+   // Allowed relative deviation, negative when not given
+   double tolerance;
+} BaselineEntry;
+
+// Same layout as the JSON output of the benchmark, so that a run can be
+// checked in as the baseline, with optional "tolerance" fields at the top
+// level and in the results
+typedef struct {
+   BaselineEntry entries[BASELINE_MAX_ENTRIES];
+   int entriesCount;
+   double tolerance;
+   bool software;
+} Baseline;
+
+bool loadBaseline(const char* path, Baseline* baseline);
@@ -0,0 +1,668 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gput.h"
+
+#include "baseline.h"
+
+#define DATA_TYPES_COUNT (VEC4_UI32 + 1)
+
+#define MAX_SIZES 16
+
+#define MAX_ITERATIONS (1 << 16)
+
+// Every compiled program stays in the program cache until gput_terminate
+#define MAX_COMPILES 32
+
+#define TYPE_NAME_SIZE 16
+
+typedef enum {
+   FORMAT_CSV,
+   FORMAT_JSON
+} OutputFormat;
+
+typedef struct {
+   OutputFormat format;
+   const char* outputPath;
+   bool software;
+   int sizes[MAX_SIZES];
+   int sizesCount;
+   double minSeconds;
+   const char* baselinePath;
+   double tolerance;
+} Options;
+
+typedef struct {
+   FILE* file;
+   OutputFormat format;
+   int resultsCount;
+} Output;
+
+typedef struct {
+   GlDataType dataType;
+   int width;
+   int height;
+   void* hostData;
+   GputArray* a;
+   GputArray* b;
+   GputArray* output;
+   GputKernel* kernel;
+} Benchmark;
+
+typedef void (*RunFunc)(Benchmark* bench, int iterations);
+
+typedef struct {
+   const char* name;
+   int size;
+} ComponentInfo;
+
+// GlDataType repeats these for one to four components
+static const ComponentInfo componentsInfo[] = {
+   {"I8", 1}, {"I16", 2}, {"I32", 4}, {"F16", 2},
+   {"F32", 4}, {"UI8", 1}, {"UI16", 2}, {"UI32", 4}
+};
+
+#define COMPONENT_KINDS_COUNT \
+   (int) (sizeof(componentsInfo) / sizeof(ComponentInfo))
+
+static const char* addSource =
+   "#include \"gput/coord.glsl\"\n"
+   "void main()\n"
+   "{\n"
+   "   ivec2 coord = gput_coord();\n"
+   "   gput_out = texelFetch(gput_in0, coord, 0).GPUT_OUT_SWIZZLE\n"
+   "      + texelFetch(gput_in1, coord, 0).GPUT_OUT_SWIZZLE;\n"
+   "}\n";
+
+static int kernelsCompiled;
+
+static double getSeconds()
+{
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int getComponents(GlDataType dataType)
+{
+   return dataType / COMPONENT_KINDS_COUNT + 1;
+}
+
+static size_t getTypeSize(GlDataType dataType)
+{
+   return (size_t) getComponents(dataType)
+      * componentsInfo[dataType % COMPONENT_KINDS_COUNT].size;
+}
+
+static void getTypeName(GlDataType dataType, char name[TYPE_NAME_SIZE])
+{
+   const char* component =
+      componentsInfo[dataType % COMPONENT_KINDS_COUNT].name;
+   if (getComponents(dataType) == 1) {
+      snprintf(name, TYPE_NAME_SIZE, "%s", component);
+   }
+   else {
+      snprintf(name, TYPE_NAME_SIZE, "VEC%d_%s",
+         getComponents(dataType), component
+      );
+   }
+}
+
+// Three component formats are not color renderable, so they can't be kernel
+// outputs or be read back
+static bool isRenderable(GlDataType dataType)
+{
+   return getComponents(dataType) != 3;
+}
+
+static void waitGpu()
+{
+   GputEvent* event = gput_createEvent();
+   gput_waitEvent(event, -1);
+   gput_releaseEvent(event);
+}
+
+static GputKernel* createAddKernel(GlDataType dataType)
+{
+   // Programs are cached by source, a unique define forces a new compilation
+   char defines[64];
+   snprintf(defines, sizeof(defines),
+      "#define BENCHMARK_KERNEL %d", kernelsCompiled++
+   );
+   GputKernelSpec spec = {
+      .inputTypes = {dataType, dataType},
+      .inputsCount = 2,
+      .outputType = dataType,
+      .defines = defines
+   };
+   return gput_createSpecializedKernel(addSource, &spec, NULL, 0);
+}
+
+static bool createBenchmark(
+   Benchmark* bench, GlDataType dataType, int width, int height
+){
+   size_t size = (size_t) width * height * getTypeSize(dataType);
+   *bench = (Benchmark) {
+      .dataType = dataType,
+      .width = width,
+      .height = height,
+      .hostData = malloc(size)
+   };
+   if (bench->hostData == NULL) {
+      return false;
+   }
+   // Small values that neither overflow nor denormalize much when added
+   memset(bench->hostData, 1, size);
+
+   bench->a = gput_createArray(dataType, width, height, bench->hostData);
+   bench->b = gput_createArray(dataType, width, height, bench->hostData);
+   if (isRenderable(dataType)) {
+      bench->output = gput_createArray(dataType, width, height, NULL);
+      bench->kernel = createAddKernel(dataType);
+      if (bench->output == NULL || bench->kernel == NULL) {
+         return false;
+      }
+   }
+   return bench->a != NULL && bench->b != NULL;
+}
+
+static void deleteBenchmark(Benchmark* bench)
+{
+   if (bench->kernel != NULL) {
+      gput_deleteKernel(bench->kernel);
+   }
+   if (bench->output != NULL) {
+      gput_deleteArray(bench->output);
+   }
+   if (bench->b != NULL) {
+      gput_deleteArray(bench->b);
+   }
+   if (bench->a != NULL) {
+      gput_deleteArray(bench->a);
+   }
+   free(bench->hostData);
+}
+
+static void runUploads(Benchmark* bench, int iterations)
+{
+   for (int i = 0; i < iterations; i++) {
+      gput_uploadArray(bench->a, bench->hostData);
+   }
+   waitGpu();
+}
+
+static void runDownloads(Benchmark* bench, int iterations)
+{
+   for (int i = 0; i < iterations; i++) {
+      gput_downloadArray(bench->a, bench->hostData);
+   }
+}
+
+static void runKernels(Benchmark* bench, int iterations)
+{
+   GputArray* inputs[] = {bench->a, bench->b};
+   for (int i = 0; i < iterations; i++) {
+      gput_runKernel(bench->kernel, inputs, 2, bench->output);
+   }
+   waitGpu();
+}
+
+static void runCompiles(Benchmark* bench, int iterations)
+{
+   for (int i = 0; i < iterations; i++) {
+      gput_deleteKernel(createAddKernel(bench->dataType));
+   }
+}
+
+// Doubles the iterations until they take at least minSeconds, and returns
+// the time of one
+static double measure(
+   RunFunc run, Benchmark* bench, double minSeconds, int maxIterations,
+   int* iterations
+){
+   // Warms up the caches and the driver's lazy allocations
+   run(bench, 1);
+
+   int count = 1;
+   for (;;) {
+      double start = getSeconds();
+      run(bench, count);
+      double seconds = getSeconds() - start;
+      if (seconds >= minSeconds || count * 2 > maxIterations) {
+         *iterations = count;
+         return seconds / count;
+      }
+      count *= 2;
+   }
+}
+
+static void writeHeader(
+   Output* output, const char* deviceName, bool software
+){
+   if (output->format == FORMAT_CSV) {
+      fprintf(output->file,
+         "benchmark,type,width,height,iterations,seconds,value,unit\n"
+      );
+   }
+   else {
+      fprintf(output->file,
+         "{\n  \"device\": \"%s\",\n  \"software\": %s,\n  \"results\": [",
+         deviceName, software ? "true" : "false"
+      );
+   }
+}
+
+static void writeResult(
+   Output* output, const char* benchmark, const Benchmark* bench,
+   int iterations, double seconds, double value, const char* unit
+){
+   char typeName[TYPE_NAME_SIZE];
+   getTypeName(bench->dataType, typeName);
+
+   if (output->format == FORMAT_CSV) {
+      fprintf(output->file, "%s,%s,%d,%d,%d,%.9g,%.6g,%s\n",
+         benchmark, typeName, bench->width, bench->height, iterations,
+         seconds, value, unit
+      );
+   }
+   else {
+      fprintf(output->file,
+         "%s\n    {\"benchmark\": \"%s\", \"type\": \"%s\", "
+         "\"width\": %d, \"height\": %d, \"iterations\": %d, "
+         "\"seconds\": %.9g, \"value\": %.6g, \"unit\": \"%s\"}",
+         output->resultsCount > 0 ? "," : "", benchmark, typeName,
+         bench->width, bench->height, iterations, seconds, value, unit
+      );
+   }
+   output->resultsCount++;
+   fflush(output->file);
+}
+
+static void writeFooter(Output* output)
+{
+   if (output->format == FORMAT_JSON) {
+      fprintf(output->file, "\n  ]\n}\n");
+   }
+}
+
+typedef enum {
+   METRIC_LATENCY,
+   METRIC_BYTES_PER_SECOND,
+   METRIC_ELEMENTS_PER_SECOND
+} Metric;
+
+typedef struct {
+   const char* name;
+   RunFunc run;
+   int maxIterations;
+   // Measured once per type on 1x1 arrays, they barely depend on the size
+   bool sizeIndependent;
+   bool needsRenderable;
+   Metric metric;
+   double scale;
+   const char* unit;
+} BenchmarkKind;
+
+static const BenchmarkKind benchmarkKinds[] = {
+   {"compile", runCompiles, MAX_COMPILES, true, false,
+      METRIC_LATENCY, 1e3, "ms"},
+   {"draw", runKernels, MAX_ITERATIONS, true, true,
+      METRIC_LATENCY, 1e6, "us"},
+   {"upload", runUploads, MAX_ITERATIONS, false, false,
+      METRIC_BYTES_PER_SECOND, 1e-6, "MB/s"},
+   {"download", runDownloads, MAX_ITERATIONS, false, true,
+      METRIC_BYTES_PER_SECOND, 1e-6, "MB/s"},
+   {"elementwise", runKernels, MAX_ITERATIONS, false, true,
+      METRIC_ELEMENTS_PER_SECOND, 1e-6, "Melem/s"}
+};
+
+#define BENCHMARK_KINDS_COUNT \
+   (int) (sizeof(benchmarkKinds) / sizeof(BenchmarkKind))
+
+static double getValue(
+   const BenchmarkKind* kind, const Benchmark* bench, double seconds
+){
+   double elements = (double) bench->width * bench->height;
+   switch (kind->metric) {
+      case METRIC_BYTES_PER_SECOND:
+         return elements * getTypeSize(bench->dataType) / seconds
+            * kind->scale;
+      case METRIC_ELEMENTS_PER_SECOND:
+         return elements / seconds * kind->scale;
+      default:
+         return seconds * kind->scale;
+   }
+}
+
+static bool runBenchmark(
+   Output* output, const Options* options, const BenchmarkKind* kind,
+   GlDataType dataType, int width, int height, double* value
+){
+   Benchmark bench;
+   if (!createBenchmark(&bench, dataType, width, height)) {
+      fprintf(stderr, "Could not create the %dx%d benchmark\n", width,
+         height
+      );
+      deleteBenchmark(&bench);
+      return false;
+   }
+
+   int iterations;
+   double seconds = measure(kind->run, &bench, options->minSeconds,
+      kind->maxIterations, &iterations
+   );
+   *value = getValue(kind, &bench, seconds);
+   writeResult(output, kind->name, &bench, iterations, seconds, *value,
+      kind->unit
+   );
+
+   deleteBenchmark(&bench);
+   return true;
+}
+
+static void benchmarkType(
+   Output* output, const Options* options, GlDataType dataType
+){
+   for (int i = 0; i < BENCHMARK_KINDS_COUNT; i++) {
+      const BenchmarkKind* kind = &benchmarkKinds[i];
+      if (kind->needsRenderable && !isRenderable(dataType)) {
+         continue;
+      }
+
+      double value;
+      if (kind->sizeIndependent) {
+         runBenchmark(output, options, kind, dataType, 1, 1, &value);
+         continue;
+      }
+      for (int j = 0; j < options->sizesCount; j++) {
+         int size = options->sizes[j];
+         runBenchmark(output, options, kind, dataType, size, size, &value);
+      }
+   }
+}
+
+static const BenchmarkKind* findKind(const char* name)
+{
+   for (int i = 0; i < BENCHMARK_KINDS_COUNT; i++) {
+      if (strcmp(benchmarkKinds[i].name, name) == 0) {
+         return &benchmarkKinds[i];
+      }
+   }
+   return NULL;
+}
+
+static bool findDataType(const char* name, GlDataType* dataType)
+{
+   for (int i = 0; i < DATA_TYPES_COUNT; i++) {
+      char typeName[TYPE_NAME_SIZE];
+      getTypeName(i, typeName);
+      if (strcmp(typeName, name) == 0) {
+         *dataType = i;
+         return true;
+      }
+   }
+   return false;
+}
+
+// Runs the benchmarks of the baseline, and returns how many are slower than
+// their tolerance allows or could not be run
+static int checkBaseline(
+   Output* output, const Options* options, const Baseline* baseline
+){
+   int failures = 0;
+   for (int i = 0; i < baseline->entriesCount; i++) {
+      const BaselineEntry* entry = &baseline->entries[i];
+      const BenchmarkKind* kind = findKind(entry->benchmark);
+      GlDataType dataType;
+      if (kind == NULL || !findDataType(entry->type, &dataType)
+         || (kind->needsRenderable && !isRenderable(dataType))
+         || entry->width <= 0 || entry->height <= 0 || entry->value <= 0
+      ){
+         fprintf(stderr, "FAIL %s %s: invalid baseline entry\n",
+            entry->benchmark, entry->type
+         );
+         failures++;
+         continue;
+      }
+
+      double tolerance = entry->tolerance >= 0 ? entry->tolerance
+         : baseline->tolerance >= 0 ? baseline->tolerance
+         : options->tolerance;
+      double value;
+      if (!runBenchmark(output, options, kind, dataType,
+         entry->width, entry->height, &value
+      )){
+         failures++;
+         continue;
+      }
+
+      double change = (value - entry->value) / entry->value;
+      bool regressed = kind->metric == METRIC_LATENCY
+         ? change > tolerance : -change > tolerance;
+      fprintf(stderr, "%s %-11s %-9s %4dx%-4d %10.4g %-7s "
+         "baseline %10.4g (%+.0f%%, tolerance %.0f%%)\n",
+         regressed ? "FAIL" : "ok  ", kind->name, entry->type,
+         entry->width, entry->height, value, kind->unit, entry->value,
+         change * 100, tolerance * 100
+      );
+      if (regressed) {
+         failures++;
+      }
+   }
+   return failures;
+}
+
+static void printUsage(const char* program)
+{
+   fprintf(stderr,
+      "Usage: %s [options]\n"
+      "  --format csv|json   output format (default csv)\n"
+      "  --output PATH       output file, - for stdout (default\n"
+      "                      benchmark.csv or benchmark.json)\n"
+      "  --sizes N,N,...     sides of the square arrays (default "
+      "64,256,1024)\n"
+      "  --min-time SECONDS  minimum time of each measurement (default "
+      "0.1)\n"
+      "  --software          run on Mesa's software rasterizer\n"
+      "  --baseline PATH     only run the benchmarks of a JSON baseline and\n"
+      "                      fail if one is slower than it\n"
+      "  --tolerance F       allowed relative slowdown when the baseline\n"
+      "                      does not give one (default 0.25)\n",
+      program
+   );
+}
+
+static bool parseSizes(const char* list, Options* options)
+{
+   options->sizesCount = 0;
+   const char* c = list;
+   while (*c != '\0') {
+      char* end;
+      long size = strtol(c, &end, 10);
+      if (end == c || size <= 0 || options->sizesCount == MAX_SIZES) {
+         return false;
+      }
+      options->sizes[options->sizesCount++] = (int) size;
+      c = *end == ',' ? end + 1 : end;
+      if (*end != ',' && *end != '\0') {
+         return false;
+      }
+   }
+   return options->sizesCount > 0;
+}
+
+static bool parseOptions(int argc, const char* argv[], Options* options)
+{
+   *options = (Options) {
+      .format = FORMAT_CSV,
+      .sizes = {64, 256, 1024},
+      .sizesCount = 3,
+      .minSeconds = 0.1,
+      .tolerance = 0.25
+   };
+
+   for (int i = 1; i < argc; i++) {
+      const char* arg = argv[i];
+      const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+      if (strcmp(arg, "--software") == 0) {
+         options->software = true;
+         continue;
+      }
+      if (value == NULL) {
+         return false;
+      }
+      i++;
+
+      if (strcmp(arg, "--format") == 0) {
+         if (strcmp(value, "csv") == 0) {
+            options->format = FORMAT_CSV;
+         }
+         else if (strcmp(value, "json") == 0) {
+            options->format = FORMAT_JSON;
+         }
+         else {
+            return false;
+         }
+      }
+      else if (strcmp(arg, "--output") == 0) {
+         options->outputPath = value;
+      }
+      else if (strcmp(arg, "--sizes") == 0) {
+         if (!parseSizes(value, options)) {
+            return false;
+         }
+      }
+      else if (strcmp(arg, "--min-time") == 0) {
+         options->minSeconds = atof(value);
+      }
+      else if (strcmp(arg, "--baseline") == 0) {
+         options->baselinePath = value;
+      }
+      else if (strcmp(arg, "--tolerance") == 0) {
+         options->tolerance = atof(value);
+      }
+      else {
+         return false;
+      }
+   }
+
+   if (options->outputPath == NULL) {
+      options->outputPath = options->format == FORMAT_CSV
+         ? "benchmark.csv" : "benchmark.json";
+   }
+   return true;
+}
+
+int main(int argc, const char* argv[])
+{
+   Options options;
+   if (!parseOptions(argc, argv, &options)) {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   static Baseline baseline;
+   if (options.baselinePath != NULL
+      && !loadBaseline(options.baselinePath, &baseline)
+   ){
+      fprintf(stderr, "Could not load the baseline %s\n",
+         options.baselinePath
+      );
+      return EXIT_FAILURE;
+   }
+
+   // Compile times are only meaningful without Mesa's or gput's shader cache
+   setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+   unsetenv("GPUT_SHADER_CACHE_DIR");
+   if (options.software) {
+      // Also makes Mesa use llvmpipe on hardware render nodes
+      setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+   }
+
+   if (!gput_init() || gput_getBackend() != GPUT_BACKEND_GPU) {
+      fprintf(stderr, "No device to benchmark\n");
+      gput_terminate();
+      return EXIT_FAILURE;
+   }
+
+   if (options.software) {
+      for (int i = 0; i < gput_getDevicesCount(); i++) {
+         if (gput_isSoftwareDevice(gput_getDevice(i))) {
+            gput_setDevice(gput_getDevice(i));
+            break;
+         }
+      }
+   }
+   GputDevice* device = gput_getCurrentDevice();
+
+   Output output = {
+      .file = strcmp(options.outputPath, "-") == 0
+         ? stdout : fopen(options.outputPath, "w"),
+      .format = options.format
+   };
+   if (output.file == NULL) {
+      fprintf(stderr, "Could not open %s\n", options.outputPath);
+      gput_terminate();
+      return EXIT_FAILURE;
+   }
+
+   bool software = options.software || gput_isSoftwareDevice(device);
+   writeHeader(&output, gput_getDeviceName(device), software);
+   int failures = 0;
+   if (options.baselinePath != NULL) {
+      if (baseline.software != software) {
+         fprintf(stderr, "Warning: baseline recorded on a %s device\n",
+            baseline.software ? "software" : "hardware"
+         );
+      }
+      failures = checkBaseline(&output, &options, &baseline);
+   }
+   else {
+      for (int dataType = 0; dataType < DATA_TYPES_COUNT; dataType++) {
+         benchmarkType(&output, &options, dataType);
+      }
+   }
+   writeFooter(&output);
+
+   if (output.file != stdout) {
+      fclose(output.file);
+   }
+
+   gput_terminate();
+
+   if (failures > 0) {
+      fprintf(stderr, "%d of %d baseline benchmarks failed\n", failures,
+         baseline.entriesCount
+      );
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -24,9 +24,499 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+   I8,
+   I16,
+   I32,
+   F16,
+   F32,
+   UI8,
+   UI16,
+   UI32,
+
+   VEC2_I8,
+   VEC2_I16,
+   VEC2_I32,
+   VEC2_F16,
+   VEC2_F32,
+   VEC2_UI8,
+   VEC2_UI16,
+   VEC2_UI32,
+
+   VEC3_I8,
+   VEC3_I16,
+   VEC3_I32,
+   VEC3_F16,
+   VEC3_F32,
+   VEC3_UI8,
+   VEC3_UI16,
+   VEC3_UI32,
+
+   VEC4_I8,
+   VEC4_I16,
+   VEC4_I32,
+   VEC4_F16,
+   VEC4_F32,
+   VEC4_UI8,
+   VEC4_UI16,
+   VEC4_UI32,
+} GlDataType;
+
+typedef enum {
+   GPUT_BACKEND_GPU,
+   GPUT_BACKEND_CPU
+} GputBackend;
+
+typedef enum {
+   GPUT_BINARY_ADD,
+   GPUT_BINARY_SUB,
+   GPUT_BINARY_MUL,
+   GPUT_BINARY_MIN,
+   GPUT_BINARY_MAX
+} GputBinaryOp;
+
+typedef enum {
+   GPUT_REDUCE_SUM,
+   GPUT_REDUCE_MIN,
+   GPUT_REDUCE_MAX
+} GputReduceOp;
+
+typedef enum {
+   GPUT_DISPATCH_AUTO,
+   GPUT_DISPATCH_CPU,
+   GPUT_DISPATCH_GPU,
+   GPUT_DISPATCH_SPLIT
+} GputDispatchPolicy;
+
+typedef struct GputDevice GputDevice;
+typedef struct GputArray GputArray;
+typedef struct GputKernel GputKernel;
+typedef struct GputFuture GputFuture;
+typedef struct GputEvent GputEvent;
+typedef struct GputDispatchGroup GputDispatchGroup;
+
+typedef struct {
+   const char* name;
+   GlDataType dataType;
+} GputKernelParam;
+
+#define GPUT_MAX_KERNEL_INPUTS 8
+
+/** Array data in host memory, rows tightly packed */
+typedef struct {
+   GlDataType dataType;
+   int width;
+   int height;
+   void* data;
+} GputHostArray;
+
+/**
+ * Array types (and optionally the output size) a kernel template is compiled
+ * for. The output size is left to run time when zero. defines are extra
+ * "#define NAME VALUE" lines, e.g. for loop bounds.
+ */
+typedef struct {
+   GlDataType inputTypes[GPUT_MAX_KERNEL_INPUTS];
+   int inputsCount;
+   GlDataType outputType;
+   int outputWidth;
+   int outputHeight;
+   const char* defines;
+} GputKernelSpec;
+
+/**
+ * Sets the directory where linked program binaries are persisted between
+ * runs. Must be called before gput_init. Defaults to the value of the
+ * GPUT_SHADER_CACHE_DIR environment variable, the disk cache is disabled
+ * when neither is set.
+ */
+void gput_setShaderCacheDir(const char* dirPath);
+
+/**
+ * Selects the backend of arrays created with gput_createArray. Must be called
+ * before gput_init. Defaults to the GPU, or to the CPU when the GPUT_BACKEND
+ * environment variable is "cpu". gput_init falls back to the CPU when no
+ * device can be opened.
+ */
+void gput_setBackend(GputBackend backend);
+
+GputBackend gput_getBackend();
 
 bool gput_init();
 
 bool gput_terminate();
 
+int gput_getDevicesCount();
+
+/** Returns NULL when deviceIndex is out of range */
+GputDevice* gput_getDevice(int deviceIndex);
+
+/** Render node path of the device, or "software" for a software rasterizer */
+const char* gput_getDeviceName(const GputDevice* device);
+
+bool gput_isSoftwareDevice(const GputDevice* device);
+
+/**
+ * Selects the device used by the calling thread. Arrays and kernels belong to
+ * the device selected when they are created and must only be used while it is
+ * selected. The default device is the first hardware one, or the one chosen
+ * with the GPUT_DEVICE environment variable (an index or part of a name).
+ */
+bool gput_setDevice(GputDevice* device);
+
+GputDevice* gput_getCurrentDevice();
+
+/**
+ * Gives the calling thread its own context sharing objects with the thread
+ * that called gput_init, so that it can create arrays and kernels and upload
+ * data concurrently. Rendering into an array and downloading it must stay on
+ * the thread that called gput_init.
+ */
+bool gput_attachThread();
+
+void gput_detachThread();
+
 void gput_test();
+
+GputArray* gput_createArray(
+   GlDataType dataType, int width, int height, const void* data
+);
+
+/**
+ * Arrays on the CPU backend live in host memory. They can only be used with
+ * the built-in operations, which makes them a reference for GPU results.
+ * Returns NULL for the GPU backend when no device is available.
+ */
+GputArray* gput_createArrayOnBackend(
+   GputBackend backend,
+   GlDataType dataType, int width, int height, const void* data
+);
+
+void gput_uploadArray(GputArray* array, const void* data);
+
+/**
+ * Three component arrays on the GPU can't be read back, as their formats are
+ * not renderable. Downloading them is an error that leaves data untouched.
+ */
+void gput_downloadArray(GputArray* array, void* data);
+
+void gput_deleteArray(GputArray* array);
+
+/**
+ * Kernels are GLSL ES 3.10 fragment shaders without the #version line. The
+ * n-th input array is bound to texture unit n (declare it with
+ * layout(binding = n)) and the result is written to location 0.
+ * Parameters are declared by the library and must be 32-bit scalar or
+ * vector types. Returns NULL and logs the errors when the source does not
+ * compile.
+ */
+GputKernel* gput_createKernel(
+   const char* source, const GputKernelParam params[], int paramsCount
+);
+
+/**
+ * Same as gput_createKernel but returns before the kernel is compiled, so
+ * that many kernels can be compiled concurrently. Running a kernel that is
+ * not ready yet waits for its compilation.
+ */
+GputKernel* gput_createKernelAsync(
+   const char* source, const GputKernelParam params[], int paramsCount
+);
+
+/**
+ * Specializes a kernel template for the array types of the spec. The library
+ * declares the inputs as gput_in<n> with the matching sampler type, the output
+ * as gput_out of type GPUT_OUT_TYPE (GPUT_OUT_SWIZZLE narrows a texel to it),
+ * and resolves #include "gput/<name>.glsl" snippets. Every specialization is
+ * compiled once per process.
+ */
+GputKernel* gput_createSpecializedKernel(
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+);
+
+GputKernel* gput_createSpecializedKernelAsync(
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+);
+
+bool gput_isKernelReady(GputKernel* kernel);
+
+/**
+ * True once the asynchronous compilation of the kernel failed, the errors
+ * are logged. Such a kernel never becomes ready and running it does nothing
+ * but log an error.
+ */
+bool gput_hasKernelFailed(GputKernel* kernel);
+
+void gput_setKernelParam(GputKernel* kernel, int paramIndex, const void* value);
+
+void gput_runKernel(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount, GputArray* output
+);
+
+/** Name of the kernel in the profile, copied */
+void gput_setKernelName(GputKernel* kernel, const char* name);
+
+void gput_deleteKernel(GputKernel* kernel);
+
+/**
+ * Marks the point reached by the commands issued so far from the calling
+ * thread on the current device, without waiting for them. Events must be
+ * released with gput_releaseEvent.
+ */
+GputEvent* gput_createEvent();
+
+/**
+ * Starts reading the array into a buffer and returns right away. data is
+ * written once the returned event completed, and must stay valid until then,
+ * like the array. Returns NULL for three component arrays, like
+ * gput_downloadArray.
+ */
+GputEvent* gput_downloadArrayAsync(GputArray* array, void* data);
+
+/**
+ * Events without a callback are completed by the thread polling or waiting on
+ * them, which must not be done from several threads at the same time.
+ */
+bool gput_isEventDone(GputEvent* event);
+
+/**
+ * Waits at most timeoutSeconds for the event, or as long as needed when it is
+ * negative. Returns whether the event completed.
+ */
+bool gput_waitEvent(GputEvent* event, double timeoutSeconds);
+
+/** Returns the index of a completed event, or -1 after timeoutSeconds */
+int gput_waitAnyEvent(
+   GputEvent* events[], int eventsCount, double timeoutSeconds
+);
+
+typedef void (*GputEventCallback)(GputEvent* event, void* userData);
+
+/**
+ * Has callback called from the completion thread once the event completed,
+ * right away if it already has. An event gets at most one callback, after
+ * which any thread may wait on it. Callbacks should return quickly since
+ * they delay the other events.
+ */
+void gput_setEventCallback(
+   GputEvent* event, GputEventCallback callback, void* userData
+);
+
+void gput_releaseEvent(GputEvent* event);
+
+/**
+ * Starts a thread with its own context that executes enqueued commands in
+ * order, in batches, so that the enqueuing threads never block on the driver.
+ * While it runs, kernels must only be run and have their parameters set
+ * through the queue. Stopping it executes the commands still queued.
+ */
+bool gput_startSubmissionThread();
+
+void gput_stopSubmissionThread();
+
+void gput_enqueueSetKernelParam(
+   GputKernel* kernel, int paramIndex, const void* value
+);
+
+/**
+ * When future is not NULL it receives a future completed once the command
+ * finished, which must be released with gput_releaseFuture. Host memory
+ * passed to uploads and downloads must stay valid until then. Commands that
+ * can't be queued, as the submission thread is stopped or their arguments
+ * are invalid, are logged and leave future NULL.
+ */
+void gput_enqueueRunKernel(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount,
+   GputArray* output, GputFuture** future
+);
+
+void gput_enqueueUpload(
+   GputArray* array, const void* data, GputFuture** future
+);
+
+void gput_enqueueDownload(GputArray* array, void* data, GputFuture** future);
+
+bool gput_isFutureDone(GputFuture* future);
+
+void gput_waitFuture(GputFuture* future);
+
+void gput_releaseFuture(GputFuture* future);
+
+/**
+ * Enables timing the GPU work of each kernel run, upload and download. Must
+ * be called before gput_init. Defaults to the value of the GPUT_PROFILE
+ * environment variable. Timer queries are used when the device supports
+ * GL_EXT_disjoint_timer_query, otherwise the GPU is drained around each
+ * operation, which slows it down. The profile is printed by gput_terminate.
+ * Only available in Debug and Profile builds.
+ */
+void gput_setProfiling(bool enabled);
+
+/**
+ * Enables recording a timeline of the library calls of each thread and of
+ * the GPU work of each device. Must be called before gput_init. Defaults to
+ * on when the GPUT_TRACE environment variable is set, in which case
+ * gput_terminate writes the trace to the path it holds. Only available in
+ * Debug and Profile builds.
+ */
+void gput_setTracing(bool enabled);
+
+/**
+ * Writes the timeline recorded so far in the Chrome trace event format, which
+ * chrome://tracing and Perfetto open. GPU spans of other threads only appear
+ * once those threads have read back their timings.
+ */
+bool gput_writeTrace(const char* path);
+
+/** Times aggregated by kernel name, names are valid until gput_terminate */
+typedef struct {
+   const char* name;
+   int count;
+   double totalSeconds;
+   double minSeconds;
+   double meanSeconds;
+   double p99Seconds;
+   double maxSeconds;
+} GputProfileEntry;
+
+/**
+ * Fills profile with up to maxEntries entries, the most expensive first, and
+ * returns their count. Only includes the timings of other threads that they
+ * have read back already.
+ */
+int gput_getProfile(GputProfileEntry profile[], int maxEntries);
+
+void gput_printProfile();
+
+typedef struct {
+   size_t liveBytes;
+   size_t peakBytes;
+   int liveObjects;
+} GputMemoryUsage;
+
+/**
+ * Tags the GPU objects the calling thread creates from now on, so that their
+ * memory is accounted to it. NULL goes back to the default "untagged" tag.
+ * Textures count their texel data and buffers their size at creation.
+ * Objects still alive at gput_terminate are reported as leaks. Memory
+ * accounting is only available in Debug and Profile builds.
+ */
+void gput_setMemoryTag(const char* tag);
+
+/** Usage of the objects created under tag, or of all of them when NULL */
+void gput_getMemoryUsage(const char* tag, GputMemoryUsage* usage);
+
+/** Prints the usage of each tag and every live object with its origin */
+void gput_printMemoryUsage();
+
+/**
+ * Prints the count and CPU time of the GL calls made by the library, by GL
+ * function and by call site, and how many calls each kernel run makes. The
+ * time is spent in the driver, not on the GPU. Printed by gput_terminate as
+ * well. Only available in Debug and Profile builds configured with
+ * GPUT_GL_STATS, as timing every call adds to its overhead.
+ */
+void gput_printGlStats();
+
+/**
+ * Caps the bytes of array data resident on each device, 0 meaning no cap.
+ * When creating or using an array would exceed the budget, the least
+ * recently used arrays are read back to host memory and their textures
+ * deleted, to be uploaded again transparently on their next use. Arrays last
+ * used from another thread and three component arrays, which can't be read
+ * back, are never evicted. Defaults to the value of the GPUT_MEMORY_BUDGET
+ * environment variable, in bytes with an optional K, M or G suffix.
+ */
+void gput_setMemoryBudget(size_t bytes);
+
+/**
+ * Costs the dispatcher uses to choose between the CPU and a device. They are
+ * measured for each device the first time it is used for a dispatch. Element
+ * costs are per 32-bit component.
+ */
+typedef struct {
+   double uploadBytesPerSecond;
+   double downloadBytesPerSecond;
+   double drawSeconds;
+   double gpuElementSeconds;
+   double cpuElementSeconds;
+} GputCostModel;
+
+/**
+ * Defaults to GPUT_DISPATCH_AUTO, or to the value of the GPUT_DISPATCH
+ * environment variable ("auto", "cpu", "gpu" or "split").
+ */
+void gput_setDispatchPolicy(GputDispatchPolicy policy);
+
+/**
+ * With the auto policy, operations on fewer than cpuBelow components always
+ * run on the CPU and operations on at least gpuFrom components always run on
+ * the GPU. The cost model decides in between. Zero disables a threshold.
+ * Defaults to GPUT_DISPATCH_CPU_BELOW and GPUT_DISPATCH_GPU_FROM.
+ */
+void gput_setDispatchThresholds(size_t cpuBelow, size_t gpuFrom);
+
+/** Cost model of the current device, calibrating it if needed */
+void gput_getCostModel(GputCostModel* model);
+
+void gput_setCostModel(const GputCostModel* model);
+
+/**
+ * Runs a built-in operation on host arrays, on the CPU, the current device or
+ * both depending on which the cost model predicts to finish first. When both
+ * are used the device computes the first rows while the CPU computes the
+ * others, and the split follows the completion times of previous operations.
+ * Decisions are logged at debug level.
+ */
+void gput_computeBinaryOp(
+   GputBinaryOp op,
+   const GputHostArray* a, const GputHostArray* b, GputHostArray* output
+);
+
+void gput_computeReduce(
+   GputReduceOp op, const GputHostArray* array, void* result
+);
+
+/**
+ * Compiles the kernel on each of the devices so that a dispatch can be split
+ * between them. spec may be NULL for kernels that are not templates. Returns
+ * NULL when the kernel can't be created on one of the devices.
+ */
+GputDispatchGroup* gput_createDispatchGroup(
+   GputDevice* devices[], int devicesCount,
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+);
+
+void gput_setDispatchGroupParam(
+   GputDispatchGroup* group, int paramIndex, const void* value
+);
+
+/**
+ * Uploads the inputs to every device, has each device compute a band of the
+ * output rows and gathers the bands into output. Bands are sized by the
+ * throughput measured on the previous runs, starting with an even split.
+ */
+void gput_runDispatchGroup(
+   GputDispatchGroup* group,
+   const GputHostArray inputs[], int inputsCount, GputHostArray* output
+);
+
+void gput_deleteDispatchGroup(GputDispatchGroup* group);
+
+/**
+ * Built-in operations run on the backend of their arrays, which must all be
+ * on the same one and have the same type and size. They support types with
+ * 32-bit components, except three component types on the GPU since those are
+ * not renderable.
+ */
+void gput_runBinaryOp(
+   GputBinaryOp op, GputArray* a, GputArray* b, GputArray* output
+);
+
+/** result receives one value per component of the array type */
+void gput_reduceArray(GputReduceOp op, GputArray* array, void* result);
@@ -22,8 +22,12 @@
  * SOFTWARE.
  */
 
+#include <stdint.h>
+#include <string.h>
+
 #include "GlAbstract.h"
 #include "gputDebug.h"
+#include "gputMemory.h"
 
 typedef struct {
    int size;
@@ -102,25 +106,179 @@ static const DataTypeInfo dataTypesInfo[] = {
    {4 * sizeof(GLuint),    GL_UNSIGNED_INT,     GL_RGBA_INTEGER,  GL_RGBA32UI},
 };
 
-#define INFOLOG_SIZE 512
+static int getComponentsCount(const DataTypeInfo* info)
+{
+   switch (info->glFormat) {
+      case GL_RED: case GL_RED_INTEGER: return 1;
+      case GL_RG:  case GL_RG_INTEGER:  return 2;
+      case GL_RGB: case GL_RGB_INTEGER: return 3;
+      default:                          return 4;
+   }
+}
 
-char infolog[INFOLOG_SIZE];
+int gla_getDataTypeSize(GlDataType dataType)
+{
+   return dataTypesInfo[dataType].size;
+}
 
-GlShaderId gla_createShader(
+int gla_getDataTypeComponents(GlDataType dataType)
+{
+   return getComponentsCount(&dataTypesInfo[dataType]);
+}
+
+GLenum gla_getDataTypeComponentType(GlDataType dataType)
+{
+   return dataTypesInfo[dataType].glType;
+}
+
+bool gla_hasExtension(const char* name)
+{
+   GLint extensionsCount = 0;
+   GLC(glGetIntegerv(GL_NUM_EXTENSIONS, &extensionsCount));
+   for (int i = 0; i < extensionsCount; i++) {
+      const char* extension =
+         (const char*) GLC(glGetStringi(GL_EXTENSIONS, i));
+      if (extension != NULL && strcmp(extension, name) == 0) {
+         return true;
+      }
+   }
+   return false;
+}
+
+// Shadow of the binding state of the current context. Bind calls that would
+// not change anything are skipped instead of going through the driver. Each
+// context has its own shadow, selected per thread along with the context.
+#define UNKNOWN_BINDING ((GLuint) -1)
+
+typedef enum {
+   ARRAY_BUFFER_SLOT,
+   ELEMENT_BUFFER_SLOT,
+   UNIFORM_BUFFER_SLOT,
+   PIXEL_PACK_BUFFER_SLOT,
+   BUFFER_SLOTS_COUNT
+} BufferSlot;
+
+typedef struct {
+   GlBuffId buffer;
+   size_t offset;
+   size_t size;
+} BufferRange;
+
+struct GlState {
+   int shareGroup;
+   unsigned contextId;
+   GlProgId program;
+   GlBuffId buffers[BUFFER_SLOTS_COUNT];
+   BufferRange uniformRanges[GLA_MAX_UNIFORM_BINDINGS];
+   int activeTextureUnit;
+   GlTexId textures[GLA_MAX_TEXTURE_UNITS];
+   GlFramebufferId framebuffer;
+   GlVertexArrayId vertexArray;
+   int viewport[4];
+   GLint blendEnabled;
+};
+
+static _Thread_local GlState* glState;
+
+GlState* gla_createStateCache(int shareGroup, unsigned contextId)
+{
+   GlState* state = malloc(sizeof(GlState));
+   if (state != NULL) {
+      state->shareGroup = shareGroup;
+      state->contextId = contextId;
+   }
+   return state;
+}
+
+void gla_deleteStateCache(GlState* state)
+{
+   if (glState == state) {
+      glState = NULL;
+   }
+   free(state);
+}
+
+void gla_setCurrentStateCache(GlState* state)
+{
+   glState = state;
+}
+
+void gla_resetStateCache()
+{
+   glState->program = UNKNOWN_BINDING;
+   for (int i = 0; i < BUFFER_SLOTS_COUNT; i++) {
+      glState->buffers[i] = UNKNOWN_BINDING;
+   }
+   for (int i = 0; i < GLA_MAX_UNIFORM_BINDINGS; i++) {
+      glState->uniformRanges[i].buffer = UNKNOWN_BINDING;
+   }
+   glState->activeTextureUnit = -1;
+   for (int i = 0; i < GLA_MAX_TEXTURE_UNITS; i++) {
+      glState->textures[i] = UNKNOWN_BINDING;
+   }
+   glState->framebuffer = UNKNOWN_BINDING;
+   glState->vertexArray = UNKNOWN_BINDING;
+   glState->viewport[2] = -1;
+   glState->blendEnabled = -1;
+}
+
+static BufferSlot getBufferSlot(BufferType bufferType)
+{
+   switch (bufferType) {
+      case VERTEX_BUFFER:     return ARRAY_BUFFER_SLOT;
+      case INDEX_BUFFER:      return ELEMENT_BUFFER_SLOT;
+      case PIXEL_PACK_BUFFER: return PIXEL_PACK_BUFFER_SLOT;
+      default:                return UNIFORM_BUFFER_SLOT;
+   }
+}
+
+static void setActiveTextureUnit(int unit)
+{
+   if (glState->activeTextureUnit != unit) {
+      GLC(glActiveTexture(GL_TEXTURE0 + unit));
+      glState->activeTextureUnit = unit;
+   }
+}
+
+static void bindActiveTexture(GlTexId textureId)
+{
+   if (glState->activeTextureUnit == -1) {
+      setActiveTextureUnit(0);
+   }
+   GlTexId* boundTexture = &glState->textures[glState->activeTextureUnit];
+   if (*boundTexture != textureId) {
+      GLC(glBindTexture(GL_TEXTURE_2D, textureId));
+      *boundTexture = textureId;
+   }
+}
+
+#define INFOLOG_SIZE 512
+
+GlShaderId gla_compileShaderAsync(
    ShaderType shaderType, const char* sources[], int srcsCount
 ){
    GlShaderId shaderId = GLC(glCreateShader(shaderType));
    GLC(glShaderSource(shaderId, srcsCount, sources, NULL));
    GLC(glCompileShader(shaderId));
+   return shaderId;
+}
 
-   GPUT_DEBUG_SCOPE(
-      GLint success;
-      GLC(glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success));
-      if (!success) {
-         GLC(glGetShaderInfoLog(shaderId, INFOLOG_SIZE, NULL, infolog));
-         GPUT_ASSERT(success, "Shader compile error:\n%s", infolog);
-      }
-   )
+GlShaderId gla_createShader(
+   ShaderType shaderType, const char* sources[], int srcsCount
+){
+   GlShaderId shaderId = gla_compileShaderAsync(
+      shaderType, sources, srcsCount
+   );
+
+   GLint success;
+   GLC(glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success));
+   if (!success) {
+      char infolog[INFOLOG_SIZE];
+      GLC(glGetShaderInfoLog(shaderId, INFOLOG_SIZE, NULL, infolog));
+      GPUT_LOG_ERROR("Shader compile error:\n%s", infolog);
+      GLC(glDeleteShader(shaderId));
+      return 0;
+   }
    return shaderId;
 }
 
@@ -134,8 +292,10 @@ void gla_deleteShader(GlShaderId shaderId)
    GLC(glDeleteShader(shaderId));
 }
 
-GlProgId gla_linkProgram(GlShaderId vertexShader, GlShaderId fragmentShader)
-{
+GlProgId gla_linkProgramAt(
+   const char* file, int line,
+   GlShaderId vertexShader, GlShaderId fragmentShader
+){
    GPUT_DEBUG_SCOPE(
       GLint shaderType;
       GLC(glGetShaderiv(vertexShader, GL_SHADER_TYPE, &shaderType));
@@ -147,30 +307,137 @@ GlProgId gla_linkProgram(GlShaderId vertexShader, GlShaderId fragmentShader)
          "Second parameter should be a fragment shader"
       );
    )
+   GlProgId progId = gla_createProgramAt(file, line);
+   gla_linkProgramAsync(progId, vertexShader, fragmentShader);
+   if (!gla_checkProgramLinked(progId)) {
+      gla_deleteProgram(progId);
+      return 0;
+   }
+   return progId;
+}
+
+GlProgId gla_createProgramAt(const char* file, int line)
+{
    GlProgId progId = GLC(glCreateProgram());
+   gpm_track(GPM_PROGRAM, glState->shareGroup, progId, 0, file, line);
+   return progId;
+}
+
+void gla_linkProgramAsync(
+   GlProgId progId, GlShaderId vertexShader, GlShaderId fragmentShader
+){
    GLC(glAttachShader(progId, vertexShader));
    GLC(glAttachShader(progId, fragmentShader));
    GLC(glLinkProgram(progId));
+}
 
-   GPUT_DEBUG_SCOPE(
-      GLint success;
-      GLC(glGetProgramiv(progId, GL_LINK_STATUS, &success));
-      if (!success) {
-         GLC(glGetProgramInfoLog(progId, INFOLOG_SIZE, NULL, infolog));
-         GPUT_ASSERT(success, "Program link error:\n%s", infolog);
-      }
-   )
+bool gla_isProgramLinkDone(GlProgId progId)
+{
+   GLint done;
+   GLC(glGetProgramiv(progId, GL_COMPLETION_STATUS_KHR, &done));
+   return done;
+}
+
+bool gla_checkProgramLinked(GlProgId progId)
+{
+   GLint success;
+   GLC(glGetProgramiv(progId, GL_LINK_STATUS, &success));
+   if (!success) {
+      char infolog[INFOLOG_SIZE];
+      GLC(glGetProgramInfoLog(progId, INFOLOG_SIZE, NULL, infolog));
+      GPUT_LOG_ERROR("Program link error:\n%s", infolog);
+   }
+   return success;
+}
+
+void gla_setProgramRetrievable(GlProgId progId)
+{
+   GLC(glProgramParameteri(progId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+      GL_TRUE
+   ));
+}
+
+static bool isBinaryFormatSupported(GLenum binaryFormat)
+{
+   GLint formatsCount;
+   GLC(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatsCount));
+   if (formatsCount <= 0) {
+      return false;
+   }
+
+   GLint* formats = malloc(formatsCount * sizeof(GLint));
+   if (formats == NULL) {
+      return false;
+   }
+   GLC(glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats));
+   bool supported = false;
+   for (int i = 0; i < formatsCount && !supported; i++) {
+      supported = (GLenum) formats[i] == binaryFormat;
+   }
+   free(formats);
+   return supported;
+}
+
+GlProgId gla_createProgramFromBinaryAt(
+   const char* file, int line,
+   GLenum binaryFormat, const void* binary, int length
+){
+   // Binaries stored by another driver may use a format this one does not
+   // know, which glProgramBinary reports as a GL error
+   if (!isBinaryFormatSupported(binaryFormat)) {
+      return 0;
+   }
+
+   GlProgId progId = GLC(glCreateProgram());
+
+   // A driver update may invalidate stored binaries, so this is checked in
+   // every build and reported to the caller instead of asserted. Errors are
+   // cleared so that GLC does not take them for a bug.
+   glProgramBinary(progId, binaryFormat, binary, length);
+   bool failed = false;
+   while (glGetError() != GL_NO_ERROR) {
+      failed = true;
+   }
+   GLint success;
+   GLC(glGetProgramiv(progId, GL_LINK_STATUS, &success));
+   if (failed || !success) {
+      GLC(glDeleteProgram(progId));
+      return 0;
+   }
+   gpm_track(GPM_PROGRAM, glState->shareGroup, progId, 0, file, line);
    return progId;
 }
 
+void* gla_getProgramBinary(GlProgId progId, GLenum* binaryFormat, int* length)
+{
+   GLint binaryLength;
+   GLC(glGetProgramiv(progId, GL_PROGRAM_BINARY_LENGTH, &binaryLength));
+   if (binaryLength <= 0) {
+      return NULL;
+   }
+
+   void* binary = malloc(binaryLength);
+   if (binary == NULL) {
+      return NULL;
+   }
+
+   GLC(glGetProgramBinary(
+      progId, binaryLength, length, binaryFormat, binary
+   ));
+   return binary;
+}
+
 void gla_bindProgram(GlProgId progId)
 {
-   GLC(glUseProgram(progId));
+   if (glState->program != progId) {
+      GLC(glUseProgram(progId));
+      glState->program = progId;
+   }
 }
 
 void gla_unbindProgram()
 {
-   GLC(glUseProgram(0));
+   gla_bindProgram(0);
 }
 
 void gla_deleteProgram(GlProgId progId)
@@ -180,42 +447,170 @@ void gla_deleteProgram(GlProgId progId)
       GLC(glGetProgramiv(progId, GL_DELETE_STATUS, &deleted));
       GPUT_ASSERT(!deleted, "Attempt to delete an already deleted shader")
    )
-   GLC(glDeleteProgram(progId))
+   GLC(glDeleteProgram(progId));
+   gpm_untrack(GPM_PROGRAM, glState->shareGroup, progId);
+
+   // A program in use stays installed after deletion, but its name can be
+   // reused by the next program created
+   if (glState->program == progId) {
+      glState->program = UNKNOWN_BINDING;
+   }
+}
+
+GlUniformLoc gla_getUniformLocation(GlProgId progId, const char* name)
+{
+   GlUniformLoc location = GLC(glGetUniformLocation(progId, name));
+   return location;
+}
+
+void gla_setUniform(
+   GlProgId progId, GlUniformLoc location, GlDataType dataType,
+   const void* value
+){
+   // glProgramUniform* does not need the program to be bound
+   switch (dataType) {
+      case I32:
+         GLC(glProgramUniform1iv(progId, location, 1, value));
+         break;
+      case VEC2_I32:
+         GLC(glProgramUniform2iv(progId, location, 1, value));
+         break;
+      case VEC3_I32:
+         GLC(glProgramUniform3iv(progId, location, 1, value));
+         break;
+      case VEC4_I32:
+         GLC(glProgramUniform4iv(progId, location, 1, value));
+         break;
+      case UI32:
+         GLC(glProgramUniform1uiv(progId, location, 1, value));
+         break;
+      case VEC2_UI32:
+         GLC(glProgramUniform2uiv(progId, location, 1, value));
+         break;
+      case VEC3_UI32:
+         GLC(glProgramUniform3uiv(progId, location, 1, value));
+         break;
+      case VEC4_UI32:
+         GLC(glProgramUniform4uiv(progId, location, 1, value));
+         break;
+      case F32:
+         GLC(glProgramUniform1fv(progId, location, 1, value));
+         break;
+      case VEC2_F32:
+         GLC(glProgramUniform2fv(progId, location, 1, value));
+         break;
+      case VEC3_F32:
+         GLC(glProgramUniform3fv(progId, location, 1, value));
+         break;
+      case VEC4_F32:
+         GLC(glProgramUniform4fv(progId, location, 1, value));
+         break;
+      default:
+         GPUT_ASSERT(false, "Unsupported uniform data type %d", dataType);
+         break;
+   }
 }
 
-GlBuffId gla_createBuffer(
+GlBuffId gla_createBufferAt(
+   const char* file, int line,
    BufferType bufferType, const void* bufferData, size_t size
 ){
    GlBuffId BufferId;
    GLC(glGenBuffers(1, &BufferId));
-   GLC(glBindBuffer(bufferType, BufferId));
+   gla_bindBuffer(bufferType, BufferId);
    GLC(glBufferData(bufferType, size, bufferData, GL_STATIC_DRAW));
-   GLC(glBindBuffer(bufferType, 0));
+   gpm_track(GPM_BUFFER, glState->shareGroup, BufferId, size, file, line);
    return BufferId;
 }
 
+GlBuffId gla_createStreamBufferAt(
+   const char* file, int line, BufferType bufferType, size_t size
+){
+   GlBuffId bufferId;
+   GLC(glGenBuffers(1, &bufferId));
+   gla_orphanBuffer(bufferType, bufferId, size);
+   // Orphaning keeps the size, the storage still in use is the driver's
+   gpm_track(GPM_BUFFER, glState->shareGroup, bufferId, size, file, line);
+   return bufferId;
+}
+
+void gla_updateBuffer(
+   BufferType bufferType, GlBuffId bufferId, size_t offset,
+   const void* bufferData, size_t size
+){
+   gla_bindBuffer(bufferType, bufferId);
+   GLC(glBufferSubData(bufferType, offset, size, bufferData));
+}
+
+void gla_orphanBuffer(BufferType bufferType, GlBuffId bufferId, size_t size)
+{
+   // Reallocating the storage lets the driver keep the old one alive for
+   // pending draws instead of stalling on them
+   gla_bindBuffer(bufferType, bufferId);
+   GLC(glBufferData(bufferType, size, NULL, GL_STREAM_DRAW));
+}
+
 void gla_bindBuffer(BufferType bufferType, GlBuffId bufferId)
 {
-   GLC(glBindBuffer(bufferType, bufferId));
+   GlBuffId* boundBuffer = &glState->buffers[getBufferSlot(bufferType)];
+   if (*boundBuffer != bufferId) {
+      GLC(glBindBuffer(bufferType, bufferId));
+      *boundBuffer = bufferId;
+   }
+}
+
+void gla_bindUniformBufferRange(
+   int binding, GlBuffId bufferId, size_t offset, size_t size
+){
+   GPUT_ASSERT(binding >= 0 && binding < GLA_MAX_UNIFORM_BINDINGS,
+      "Uniform buffer binding %d out of range", binding
+   );
+   BufferRange* range = &glState->uniformRanges[binding];
+   if (range->buffer != bufferId
+      || range->offset != offset || range->size != size
+   ){
+      GLC(glBindBufferRange(
+         GL_UNIFORM_BUFFER, binding, bufferId, offset, size
+      ));
+      range->buffer = bufferId;
+      range->offset = offset;
+      range->size = size;
+
+      // Indexed binds also replace the generic binding point
+      glState->buffers[UNIFORM_BUFFER_SLOT] = bufferId;
+   }
 }
 
 void gla_unbindBuffer(BufferType bufferType)
 {
-   GLC(glBindBuffer(bufferType, 0));
+   gla_bindBuffer(bufferType, 0);
 }
 
 void gla_deleteBuffer(GlBuffId bufferId)
 {
    GlBuffId localBufferId = bufferId;
    GLC(glDeleteBuffers(1, &localBufferId));
+   gpm_untrack(GPM_BUFFER, glState->shareGroup, bufferId);
+
+   for (int i = 0; i < BUFFER_SLOTS_COUNT; i++) {
+      if (glState->buffers[i] == bufferId) {
+         glState->buffers[i] = 0;
+      }
+   }
+   for (int i = 0; i < GLA_MAX_UNIFORM_BINDINGS; i++) {
+      if (glState->uniformRanges[i].buffer == bufferId) {
+         glState->uniformRanges[i].buffer = 0;
+      }
+   }
 }
 
-GlTexId gla_createTexture(
-   GlDataType pixDataType, int width, int height, void* texData
+GlTexId gla_createTextureAt(
+   const char* file, int line,
+   GlDataType pixDataType, int width, int height, const void* texData
 ){
    GlTexId textureId;
    GLC(glGenTextures(1, &textureId));
-   GLC(glBindTexture(GL_TEXTURE_2D, textureId));
+   bindActiveTexture(textureId);
 
    GLC(glTexImage2D(
       GL_TEXTURE_2D, 0,
@@ -226,31 +621,76 @@ GlTexId gla_createTexture(
       texData
    ));
 
-   GLC(glBindTexture(GL_TEXTURE_2D, 0));
+   // Integer textures are incomplete with the default mipmapped filtering
+   GLC(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+   GLC(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+   GLC(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+   GLC(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+
+   gpm_track(GPM_TEXTURE, glState->shareGroup, textureId,
+      (size_t) width * height * dataTypesInfo[pixDataType].size, file, line
+   );
    return textureId;
 }
 
-void gla_bindTexture(GlTexId textureId)
+void gla_updateTexture(
+   GlTexId textureId, GlDataType pixDataType, int x, int y,
+   int width, int height, const void* texData
+){
+   bindActiveTexture(textureId);
+   GLC(glTexSubImage2D(
+      GL_TEXTURE_2D, 0, x, y, width, height,
+      dataTypesInfo[pixDataType].glFormat,
+      dataTypesInfo[pixDataType].glType,
+      texData
+   ));
+}
+
+void gla_bindTexture(int unit, GlTexId textureId)
 {
-   GLC(glBindTexture(GL_TEXTURE_2D, textureId));
+   GPUT_ASSERT(unit >= 0 && unit < GLA_MAX_TEXTURE_UNITS,
+      "Texture unit %d out of range", unit
+   );
+   if (glState->textures[unit] != textureId) {
+      setActiveTextureUnit(unit);
+      GLC(glBindTexture(GL_TEXTURE_2D, textureId));
+      glState->textures[unit] = textureId;
+   }
 }
 
-void gla_unbindTexture()
+void gla_unbindTexture(int unit)
 {
-   GLC(glBindTexture(GL_TEXTURE_2D, 0));
+   gla_bindTexture(unit, 0);
+}
+
+void gla_invalidateTextureBinding(GlTexId textureId)
+{
+   for (int i = 0; i < GLA_MAX_TEXTURE_UNITS; i++) {
+      if (glState->textures[i] == textureId) {
+         glState->textures[i] = UNKNOWN_BINDING;
+      }
+   }
 }
 
 void gla_deleteTexture(GlTexId textureId)
 {
    GlTexId localTextureId = textureId;
    GLC(glDeleteTextures(1, &localTextureId));
+   gpm_untrack(GPM_TEXTURE, glState->shareGroup, textureId);
+
+   for (int i = 0; i < GLA_MAX_TEXTURE_UNITS; i++) {
+      if (glState->textures[i] == textureId) {
+         glState->textures[i] = 0;
+      }
+   }
 }
 
-GlFramebufferId gla_createFramebuffer(GlTexId colorAttachment)
-{
+GlFramebufferId gla_createFramebufferAt(
+   const char* file, int line, GlTexId colorAttachment
+){
    GlFramebufferId framebufferId;
    GLC(glGenFramebuffers(1, &framebufferId));
-   GLC(glBindFramebuffer(GL_FRAMEBUFFER, framebufferId));
+   gla_bindFramebuffer(framebufferId);
    GLC(glFramebufferTexture2D(
       GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorAttachment, 0
    ));
@@ -258,22 +698,432 @@ GlFramebufferId gla_createFramebuffer(GlTexId colorAttachment)
       glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE,
       "Framebuffer not complete"
    ));
-   GLC(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+   gpm_track(
+      GPM_FRAMEBUFFER, glState->contextId, framebufferId, 0, file, line
+   );
    return framebufferId;
 }
 
 void gla_bindFramebuffer(GlFramebufferId framebufferId)
 {
-   GLC(glBindFramebuffer(GL_FRAMEBUFFER, framebufferId));
+   if (glState->framebuffer != framebufferId) {
+      GLC(glBindFramebuffer(GL_FRAMEBUFFER, framebufferId));
+      glState->framebuffer = framebufferId;
+   }
 }
 
 void gla_unbindFramebuffer()
 {
-   GLC(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+   gla_bindFramebuffer(0);
 }
 
 void gla_deleteFramebuffer(GlFramebufferId framebufferId)
 {
    GlFramebufferId localFramebufferId = framebufferId;
    GLC(glDeleteFramebuffers(1, &localFramebufferId));
+   gpm_untrack(GPM_FRAMEBUFFER, glState->contextId, framebufferId);
+
+   if (glState->framebuffer == framebufferId) {
+      glState->framebuffer = 0;
+   }
+}
+
+static GLhalf floatToHalf(float value)
+{
+   uint32_t bits;
+   memcpy(&bits, &value, sizeof(bits));
+
+   uint32_t sign = (bits >> 16) & 0x8000;
+   int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+   uint32_t mantissa = bits & 0x7fffff;
+
+   if (((bits >> 23) & 0xff) == 0xff) {
+      return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+   }
+   if (exponent >= 0x1f) {
+      return sign | 0x7c00;
+   }
+   if (exponent <= 0) {
+      if (exponent < -10) {
+         return sign;
+      }
+      mantissa |= 0x800000;
+      return sign | (mantissa >> (14 - exponent));
+   }
+   // A rounding carry out of the mantissa correctly bumps the exponent
+   return sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13));
+}
+
+static void convertFromRgba32(
+   const DataTypeInfo* info, const void* rgbaData, void* pixData,
+   int pixelsCount
+){
+   int componentsCount = getComponentsCount(info);
+
+   const GLint* intData = rgbaData;
+   const GLuint* uintData = rgbaData;
+   const GLfloat* floatData = rgbaData;
+
+   for (int pixel = 0; pixel < pixelsCount; pixel++) {
+      for (int component = 0; component < componentsCount; component++) {
+         int src = 4 * pixel + component;
+         int dst = componentsCount * pixel + component;
+
+         switch (info->glType) {
+            case GL_BYTE:
+               ((GLbyte*) pixData)[dst] = (GLbyte) intData[src]; break;
+            case GL_SHORT:
+               ((GLshort*) pixData)[dst] = (GLshort) intData[src]; break;
+            case GL_INT:
+               ((GLint*) pixData)[dst] = intData[src]; break;
+            case GL_UNSIGNED_BYTE:
+               ((GLubyte*) pixData)[dst] = (GLubyte) uintData[src]; break;
+            case GL_UNSIGNED_SHORT:
+               ((GLushort*) pixData)[dst] = (GLushort) uintData[src]; break;
+            case GL_UNSIGNED_INT:
+               ((GLuint*) pixData)[dst] = uintData[src]; break;
+            case GL_HALF_FLOAT:
+               ((GLhalf*) pixData)[dst] = floatToHalf(floatData[src]); break;
+            case GL_FLOAT:
+               ((GLfloat*) pixData)[dst] = floatData[src]; break;
+         }
+      }
+   }
+}
+
+// Picks the format of reads of the bound framebuffer. Returns false when the
+// data type cannot be read directly, in which case the RGBA 32-bit
+// combination ES 3 guarantees for each component class is used and has to be
+// narrowed on the CPU.
+static bool getReadFormat(
+   const DataTypeInfo* info, GLenum* readFormat, GLenum* readType
+){
+   GLint implFormat, implType;
+   GLC(glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &implFormat));
+   GLC(glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &implType));
+
+   if ((GLenum) implFormat == info->glFormat
+      && (GLenum) implType == info->glType
+   ){
+      *readFormat = info->glFormat;
+      *readType = info->glType;
+      return true;
+   }
+
+   *readFormat = GL_RGBA_INTEGER;
+   switch (info->glType) {
+      case GL_BYTE: case GL_SHORT: case GL_INT:
+         *readType = GL_INT;
+         break;
+      case GL_UNSIGNED_BYTE: case GL_UNSIGNED_SHORT: case GL_UNSIGNED_INT:
+         *readType = GL_UNSIGNED_INT;
+         break;
+      default:
+         *readFormat = GL_RGBA;
+         *readType = GL_FLOAT;
+         break;
+   }
+   return false;
+}
+
+void gla_readFramebuffer(
+   GlDataType pixDataType, int x, int y, int width, int height, void* pixData
+){
+   const DataTypeInfo* info = &dataTypesInfo[pixDataType];
+
+   GLenum readFormat, readType;
+   if (getReadFormat(info, &readFormat, &readType)) {
+      GLC(glReadPixels(x, y, width, height, readFormat, readType, pixData));
+      GPUT_GL_SYNC_POINT("framebuffer read");
+      return;
+   }
+
+   int pixelsCount = width * height;
+   void* rgbaData = malloc((size_t) pixelsCount * 4 * sizeof(GLuint));
+   GPUT_ASSERT(rgbaData != NULL, "Could not allocate readback buffer");
+   if (rgbaData == NULL) {
+      return;
+   }
+
+   GLC(glReadPixels(x, y, width, height, readFormat, readType, rgbaData));
+   GPUT_GL_SYNC_POINT("framebuffer read");
+   convertFromRgba32(info, rgbaData, pixData, pixelsCount);
+   free(rgbaData);
+}
+
+void gla_readFramebufferAsyncAt(
+   const char* file, int line,
+   GlDataType pixDataType, int x, int y, int width, int height,
+   GlPendingRead* read
+){
+   const DataTypeInfo* info = &dataTypesInfo[pixDataType];
+
+   GLenum readFormat, readType;
+   read->pixDataType = pixDataType;
+   read->pixelsCount = width * height;
+   read->rgba32 = !getReadFormat(info, &readFormat, &readType);
+   size_t size = (size_t) read->pixelsCount * (read->rgba32
+      ? 4 * sizeof(GLuint) : (size_t) gla_getDataTypeSize(pixDataType)
+   );
+
+   GLC(glGenBuffers(1, &read->buffer));
+   gla_bindBuffer(PIXEL_PACK_BUFFER, read->buffer);
+   GLC(glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ));
+   gpm_track(GPM_BUFFER, glState->shareGroup, read->buffer, size, file, line);
+   GLC(glReadPixels(x, y, width, height, readFormat, readType, NULL));
+
+   // Reads are written to the bound pack buffer, which must not catch the
+   // synchronous ones
+   gla_unbindBuffer(PIXEL_PACK_BUFFER);
+}
+
+void gla_finishRead(GlPendingRead* read, void* pixData)
+{
+   const DataTypeInfo* info = &dataTypesInfo[read->pixDataType];
+   size_t size = (size_t) read->pixelsCount * (read->rgba32
+      ? 4 * sizeof(GLuint) : (size_t) gla_getDataTypeSize(read->pixDataType)
+   );
+
+   gla_bindBuffer(PIXEL_PACK_BUFFER, read->buffer);
+   const void* mappedData = GLC(glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT
+   ));
+   GPUT_GL_SYNC_POINT("readback buffer map");
+   GPUT_ASSERT(mappedData != NULL, "Could not map readback buffer");
+   if (mappedData != NULL) {
+      if (read->rgba32) {
+         convertFromRgba32(info, mappedData, pixData, read->pixelsCount);
+      }
+      else {
+         memcpy(pixData, mappedData, size);
+      }
+      GLC(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+   }
+   gla_unbindBuffer(PIXEL_PACK_BUFFER);
+
+   gla_deleteBuffer(read->buffer);
+   read->buffer = 0;
+}
+
+GlVertexArrayId gla_createVertexArray()
+{
+   GlVertexArrayId vertexArrayId;
+   GLC(glGenVertexArrays(1, &vertexArrayId));
+   return vertexArrayId;
+}
+
+void gla_bindVertexArray(GlVertexArrayId vertexArrayId)
+{
+   if (glState->vertexArray != vertexArrayId) {
+      GLC(glBindVertexArray(vertexArrayId));
+      glState->vertexArray = vertexArrayId;
+
+      // The element buffer binding is part of the vertex array state
+      glState->buffers[ELEMENT_BUFFER_SLOT] = UNKNOWN_BINDING;
+   }
+}
+
+void gla_unbindVertexArray()
+{
+   gla_bindVertexArray(0);
+}
+
+void gla_deleteVertexArray(GlVertexArrayId vertexArrayId)
+{
+   GlVertexArrayId localVertexArrayId = vertexArrayId;
+   GLC(glDeleteVertexArrays(1, &localVertexArrayId));
+
+   if (glState->vertexArray == vertexArrayId) {
+      glState->vertexArray = 0;
+      glState->buffers[ELEMENT_BUFFER_SLOT] = UNKNOWN_BINDING;
+   }
+}
+
+void gla_setViewport(int x, int y, int width, int height)
+{
+   int* viewport = glState->viewport;
+   if (viewport[0] != x || viewport[1] != y
+      || viewport[2] != width || viewport[3] != height
+   ){
+      GLC(glViewport(x, y, width, height));
+      viewport[0] = x;
+      viewport[1] = y;
+      viewport[2] = width;
+      viewport[3] = height;
+   }
+}
+
+void gla_setBlending(bool enabled)
+{
+   if (glState->blendEnabled != enabled) {
+      if (enabled) {
+         GLC(glEnable(GL_BLEND));
+      }
+      else {
+         GLC(glDisable(GL_BLEND));
+      }
+      glState->blendEnabled = enabled;
+   }
+}
+
+void gla_finish()
+{
+   GLC(glFinish());
+   GPUT_GL_SYNC_POINT("finish");
+}
+
+GlFence gla_createFence()
+{
+   GlFence fence = GLC(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+   // Other contexts can only wait on a fence that has been flushed
+   GLC(glFlush());
+   return fence;
+}
+
+void gla_waitFenceOnGpu(GlFence fence)
+{
+   GLC(glWaitSync(fence, 0, GL_TIMEOUT_IGNORED));
+}
+
+void gla_waitFence(GlFence fence)
+{
+   GLenum status;
+   do {
+      status = GLC(glClientWaitSync(
+         fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000
+      ));
+   } while (status == GL_TIMEOUT_EXPIRED);
+   GPUT_ASSERT(status != GL_WAIT_FAILED, "Waiting on fence failed");
+   GPUT_GL_SYNC_POINT("fence wait");
+}
+
+bool gla_waitFenceTimeout(GlFence fence, double timeoutSeconds)
+{
+   GLenum status = GLC(glClientWaitSync(fence,
+      GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64) (timeoutSeconds * 1e9)
+   ));
+   GPUT_ASSERT(status != GL_WAIT_FAILED, "Waiting on fence failed");
+   GPUT_GL_SYNC_POINT("fence wait");
+   return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+bool gla_isFenceSignaled(GlFence fence)
+{
+   GLenum status = GLC(glClientWaitSync(fence, 0, 0));
+   return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void gla_deleteFence(GlFence fence)
+{
+   GLC(glDeleteSync(fence));
+}
+
+void gla_drawFullscreen()
+{
+   GLC(glDrawArrays(GL_TRIANGLES, 0, 3));
+}
+
+// GL_EXT_disjoint_timer_query, missing from the glad profile
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#define GL_TIMESTAMP_EXT 0x8E28
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#define GL_QUERY_COUNTER_BITS_EXT 0x8864
+
+typedef void (*GetQueryObjectUi64vProc)(
+   GLuint id, GLenum pname, GLuint64* params
+);
+typedef void (*QueryCounterProc)(GLuint id, GLenum target);
+
+static GetQueryObjectUi64vProc getQueryObjectUi64v;
+static QueryCounterProc queryCounter;
+
+void gla_loadExtensions(GLADloadproc loader)
+{
+   getQueryObjectUi64v = (GetQueryObjectUi64vProc)
+      loader("glGetQueryObjectui64vEXT");
+   queryCounter = (QueryCounterProc) loader("glQueryCounterEXT");
+}
+
+bool gla_hasTimerQueries()
+{
+   return getQueryObjectUi64v != NULL
+      && gla_hasExtension("GL_EXT_disjoint_timer_query");
+}
+
+GlQueryId gla_beginTimerQuery()
+{
+   GlQueryId query;
+   GLC(glGenQueries(1, &query));
+   GLC(glBeginQuery(GL_TIME_ELAPSED_EXT, query));
+   return query;
+}
+
+void gla_endTimerQuery()
+{
+   GLC(glEndQuery(GL_TIME_ELAPSED_EXT));
+}
+
+bool gla_getTimerQueryResult(GlQueryId query, double* elapsedSeconds)
+{
+   GLuint available = GL_FALSE;
+   GLC(glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+   if (!available) {
+      return false;
+   }
+
+   GLuint64 nanoseconds = 0;
+   GLC(getQueryObjectUi64v(query, GL_QUERY_RESULT, &nanoseconds));
+   *elapsedSeconds = nanoseconds * 1e-9;
+   return true;
+}
+
+bool gla_hasTimestampQueries()
+{
+   if (queryCounter == NULL || !gla_hasTimerQueries()) {
+      return false;
+   }
+   GLint counterBits = 0;
+   GLC(glGetQueryiv(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &counterBits));
+   return counterBits > 0;
+}
+
+GlQueryId gla_queryTimestamp()
+{
+   GlQueryId query;
+   GLC(glGenQueries(1, &query));
+   GLC(queryCounter(query, GL_TIMESTAMP_EXT));
+   return query;
+}
+
+bool gla_getTimestampResult(GlQueryId query, double* gpuSeconds)
+{
+   GLuint available = GL_FALSE;
+   GLC(glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+   if (!available) {
+      return false;
+   }
+
+   GLuint64 nanoseconds = 0;
+   GLC(getQueryObjectUi64v(query, GL_QUERY_RESULT, &nanoseconds));
+   *gpuSeconds = nanoseconds * 1e-9;
+   return true;
+}
+
+double gla_getGpuTime()
+{
+   GLint64 nanoseconds = 0;
+   GLC(glGetInteger64v(GL_TIMESTAMP_EXT, &nanoseconds));
+   return nanoseconds * 1e-9;
+}
+
+bool gla_isGpuDisjoint()
+{
+   GLint disjoint = GL_FALSE;
+   GLC(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+   return disjoint;
+}
+
+void gla_deleteQuery(GlQueryId query)
+{
+   GLC(glDeleteQueries(1, &query));
 }
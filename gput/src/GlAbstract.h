@@ -23,15 +23,43 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include "glad/glad.h"
 
+#include "gput.h"
+#include "gputDebug.h"
+
+#define GLA_GLSL_VERSION "#version 310 es\n"
+
+// ES 3.1 guarantees at least 16 fragment texture units
+#define GLA_MAX_TEXTURE_UNITS 16
+
+// ES 3.1 guarantees at least 24 uniform buffer bindings, the first ones are
+// enough for the library
+#define GLA_MAX_UNIFORM_BINDINGS 4
+
+// Attribute-less triangle covering the whole viewport, drawn with
+// gla_drawFullscreen() while an empty vertex array is bound
+#define GLA_FULLSCREEN_VERTEX_SHADER \
+   "void main()\n" \
+   "{\n" \
+   "   vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n" \
+   "   gl_Position = vec4(2.0 * pos - 1.0, 0.0, 1.0);\n" \
+   "}\n"
+
 typedef GLuint GlShaderId;
 typedef GLuint GlProgId;
 typedef GLuint GlBuffId;
 typedef GLuint GlTexId;
 typedef GLuint GlFramebufferId;
+typedef GLuint GlVertexArrayId;
+typedef GLint GlUniformLoc;
+typedef GLsync GlFence;
+typedef GLuint GlQueryId;
+
+typedef struct GlState GlState;
 
 typedef enum {
    VERTEX_SHADER = GL_VERTEX_SHADER,
@@ -40,54 +68,96 @@ typedef enum {
 
 typedef enum {
    VERTEX_BUFFER = GL_ARRAY_BUFFER,
-   INDEX_BUFFER = GL_ELEMENT_ARRAY_BUFFER
+   INDEX_BUFFER = GL_ELEMENT_ARRAY_BUFFER,
+   UNIFORM_BUFFER = GL_UNIFORM_BUFFER,
+   PIXEL_PACK_BUFFER = GL_PIXEL_PACK_BUFFER
 } BufferType;
 
-typedef enum {
-   I8,
-   I16,
-   I32,
-   F16,
-   F32,
-   UI8,
-   UI16,
-   UI32,
-
-   VEC2_I8,
-   VEC2_I16,
-   VEC2_I32,
-   VEC2_F16,
-   VEC2_F32,
-   VEC2_UI8,
-   VEC2_UI16,
-   VEC2_UI32,
-
-   VEC3_I8,
-   VEC3_I16,
-   VEC3_I32,
-   VEC3_F16,
-   VEC3_F32,
-   VEC3_UI8,
-   VEC3_UI16,
-   VEC3_UI32,
-
-   VEC4_I8,
-   VEC4_I16,
-   VEC4_I32,
-   VEC4_F16,
-   VEC4_F32,
-   VEC4_UI8,
-   VEC4_UI16,
-   VEC4_UI32,
-} GlDataType;
+// Read of the bound framebuffer into a buffer object, completed once the
+// commands before it have executed
+typedef struct {
+   GlBuffId buffer;
+   GlDataType pixDataType;
+   int pixelsCount;
+   bool rgba32;
+} GlPendingRead;
+
+int gla_getDataTypeSize(GlDataType dataType);
+
+int gla_getDataTypeComponents(GlDataType dataType);
+
+GLenum gla_getDataTypeComponentType(GlDataType dataType);
+
+// Checks the extensions of the current context
+bool gla_hasExtension(const char* name);
 
+// Bindings are shadowed per context to skip redundant calls. The state cache
+// of a context must be made current along with it, and reset once the
+// context is first made current or whenever GL state is changed behind
+// GlAbstract's back.
+// Contexts sharing objects share the same group, which identifies shared
+// objects in the memory accounting. Framebuffers are not shared and are
+// accounted to the context instead.
+GlState* gla_createStateCache(int shareGroup, unsigned contextId);
+
+void gla_deleteStateCache(GlState* state);
+
+void gla_setCurrentStateCache(GlState* state);
+
+void gla_resetStateCache();
+
+// Textures, buffers, framebuffers and programs are accounted to the tag of
+// the creating thread along with the source location creating them, which
+// the gla_create* macros below pass to the *At functions
+
+// The *Async variants only submit the work, leaving status checks to the
+// caller so that compilation can overlap with other work
+GlShaderId gla_compileShaderAsync(
+   ShaderType shaderType, const char* sources[], int srcsCount
+);
+
+// Returns 0 and logs the compile errors when the sources don't compile
 GlShaderId gla_createShader(
    ShaderType shaderType, const char* sources[], int srcsCount
 );
 
 void gla_deleteShader(GlShaderId shaderId);
 
-GlProgId gla_linkProgram(GlShaderId vertexShader, GlShaderId fragmentShader);
+// Returns 0 when the program does not link
+#define gla_linkProgram(...) \
+   gla_linkProgramAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlProgId gla_linkProgramAt(
+   const char* file, int line,
+   GlShaderId vertexShader, GlShaderId fragmentShader
+);
+
+#define gla_createProgram() gla_createProgramAt(GPUT_FILE_NAME, __LINE__)
+
+GlProgId gla_createProgramAt(const char* file, int line);
+
+void gla_linkProgramAsync(
+   GlProgId progId, GlShaderId vertexShader, GlShaderId fragmentShader
+);
+
+// Must be called before linking for gla_getProgramBinary to return a binary
+void gla_setProgramRetrievable(GlProgId progId);
+
+// Requires GL_KHR_parallel_shader_compile on the current device
+bool gla_isProgramLinkDone(GlProgId progId);
+
+// Logs the link errors when the program did not link
+bool gla_checkProgramLinked(GlProgId progId);
+
+#define gla_createProgramFromBinary(...) \
+   gla_createProgramFromBinaryAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlProgId gla_createProgramFromBinaryAt(
+   const char* file, int line,
+   GLenum binaryFormat, const void* binary, int length
+);
+
+void* gla_getProgramBinary(GlProgId progId, GLenum* binaryFormat, int* length);
 
 void gla_bindProgram(GlProgId progId);
 
@@ -95,30 +165,158 @@ void gla_unbindProgram();
 
 void gla_deleteProgram(GlProgId progId);
 
-GlBuffId gla_createBuffer(
+GlUniformLoc gla_getUniformLocation(GlProgId progId, const char* name);
+
+void gla_setUniform(
+   GlProgId progId, GlUniformLoc location, GlDataType dataType,
+   const void* value
+);
+
+#define gla_createBuffer(...) \
+   gla_createBufferAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlBuffId gla_createBufferAt(
+   const char* file, int line,
    BufferType bufferType, const void* bufferData, size_t size
 );
 
+#define gla_createStreamBuffer(...) \
+   gla_createStreamBufferAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlBuffId gla_createStreamBufferAt(
+   const char* file, int line, BufferType bufferType, size_t size
+);
+
+void gla_updateBuffer(
+   BufferType bufferType, GlBuffId bufferId, size_t offset,
+   const void* bufferData, size_t size
+);
+
+void gla_orphanBuffer(BufferType bufferType, GlBuffId bufferId, size_t size);
+
 void gla_bindBuffer(BufferType bufferType, GlBuffId bufferId);
 
+void gla_bindUniformBufferRange(
+   int binding, GlBuffId bufferId, size_t offset, size_t size
+);
+
 void gla_unbindBuffer(BufferType bufferType);
 
 void gla_deleteBuffer(GlBuffId bufferId);
 
-GlTexId gla_createTexture(
-   GlDataType pixDataType, int width, int height, void* texData
+#define gla_createTexture(...) \
+   gla_createTextureAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlTexId gla_createTextureAt(
+   const char* file, int line,
+   GlDataType pixDataType, int width, int height, const void* texData
+);
+
+void gla_updateTexture(
+   GlTexId textureId, GlDataType pixDataType, int x, int y,
+   int width, int height, const void* texData
 );
 
-void gla_bindTexture(GlTexId textureId);
+void gla_bindTexture(int unit, GlTexId textureId);
+
+void gla_unbindTexture(int unit);
 
-void gla_unbindTexture();
+// Forces the next bind of a texture modified by another context, which is
+// needed for the changes to be picked up
+void gla_invalidateTextureBinding(GlTexId textureId);
 
 void gla_deleteTexture(GlTexId textureId);
 
-GlFramebufferId gla_createFramebuffer(GlTexId colorAttachment);
+#define gla_createFramebuffer(...) \
+   gla_createFramebufferAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+GlFramebufferId gla_createFramebufferAt(
+   const char* file, int line, GlTexId colorAttachment
+);
 
 void gla_bindFramebuffer(GlFramebufferId framebufferId);
 
 void gla_unbindFramebuffer();
 
 void gla_deleteFramebuffer(GlFramebufferId framebufferId);
+
+void gla_readFramebuffer(
+   GlDataType pixDataType, int x, int y, int width, int height, void* pixData
+);
+
+// Returns without waiting for the GPU. The pixels are copied out by
+// gla_finishRead, which blocks until the read is done.
+#define gla_readFramebufferAsync(...) \
+   gla_readFramebufferAsyncAt(GPUT_FILE_NAME, __LINE__, __VA_ARGS__)
+
+void gla_readFramebufferAsyncAt(
+   const char* file, int line,
+   GlDataType pixDataType, int x, int y, int width, int height,
+   GlPendingRead* read
+);
+
+void gla_finishRead(GlPendingRead* read, void* pixData);
+
+GlVertexArrayId gla_createVertexArray();
+
+void gla_bindVertexArray(GlVertexArrayId vertexArrayId);
+
+void gla_unbindVertexArray();
+
+void gla_deleteVertexArray(GlVertexArrayId vertexArrayId);
+
+void gla_setViewport(int x, int y, int width, int height);
+
+void gla_setBlending(bool enabled);
+
+void gla_finish();
+
+GlFence gla_createFence();
+
+void gla_waitFenceOnGpu(GlFence fence);
+
+// Blocks the calling thread until the commands before the fence completed
+void gla_waitFence(GlFence fence);
+
+// Returns whether the fence was signaled before the timeout expired
+bool gla_waitFenceTimeout(GlFence fence, double timeoutSeconds);
+
+bool gla_isFenceSignaled(GlFence fence);
+
+void gla_deleteFence(GlFence fence);
+
+void gla_drawFullscreen();
+
+// Resolves the entry points of extensions glad does not know about, once the
+// first context is current
+void gla_loadExtensions(GLADloadproc loader);
+
+// Timer queries come from GL_EXT_disjoint_timer_query, which must be
+// supported by the current context. Only one can be active at a time.
+bool gla_hasTimerQueries();
+
+GlQueryId gla_beginTimerQuery();
+
+void gla_endTimerQuery();
+
+// Returns false while the result is not available. The result is only valid
+// if gla_isGpuDisjoint is false once it is.
+bool gla_getTimerQueryResult(GlQueryId query, double* elapsedSeconds);
+
+// Timestamps are optional even with the extension, some GPUs only measure
+// elapsed times
+bool gla_hasTimestampQueries();
+
+// Records the GPU time once the commands before it have executed
+GlQueryId gla_queryTimestamp();
+
+// Returns false while the result is not available
+bool gla_getTimestampResult(GlQueryId query, double* gpuSeconds);
+
+// Current GPU time, to relate timestamps to the CPU clock
+double gla_getGpuTime();
+
+// True when the GPU timings taken since the last call are unreliable
+bool gla_isGpuDisjoint();
+
+void gla_deleteQuery(GlQueryId query);
@@ -0,0 +1,812 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "GlProgramCache.h"
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputTrace.h"
+
+// Programs are identified by an FNV-1a hash of the defines followed by the
+// concatenated sources of each stage. Sources are hashed as one stream per
+// stage, so splitting the same text differently yields the same program.
+typedef uint64_t ProgramHash;
+
+#define FNV_OFFSET_BASIS   0xcbf29ce484222325ULL
+#define FNV_PRIME          0x100000001b3ULL
+#define STAGE_SEPARATOR    0xff
+
+// Programs requested asynchronously stay pending until their link is done.
+// Pending programs are heap allocated since the compile worker holds on to
+// them while the entries array may be reallocated.
+typedef struct PendingProgram {
+   GlProgId progId;
+   int device;
+   uint64_t diskKey;
+   bool onWorker;
+   atomic_bool ready;
+
+   char* defines;
+   char* vertexSource;
+   char* fragmentSource;
+   struct PendingProgram* next;
+} PendingProgram;
+
+// Program names are only unique within a device, so entries are looked up by
+// device as well. Entries whose asynchronous compilation failed stay until
+// released but are no longer found by hash, so that later requests compile
+// the program again and report the errors themselves.
+typedef struct {
+   int device;
+   ProgramHash hash;
+   GlProgId progId;
+   int refCount;
+   const void* uniformOwner;
+   PendingProgram* pending;
+   bool failed;
+} ProgramCacheEntry;
+
+// The cache is shared by all threads. Compilation itself happens outside of
+// the lock so that threads can compile different programs concurrently.
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static ProgramCacheEntry* entries;
+static int entriesCount;
+static int entriesCapacity;
+
+// Linked programs are also persisted as driver binaries. Binaries are only
+// valid for the driver that produced them, so the on-disk key mixes the
+// program hash with GL_RENDERER and GL_VERSION.
+#define DISK_CACHE_MAGIC      0x42505047 // "GPPB"
+#define DISK_CACHE_PATH_SIZE  4096
+
+typedef struct {
+   uint32_t magic;
+   uint32_t binaryFormat;
+   uint32_t binaryLength;
+   uint32_t reserved;
+   uint64_t key;
+} DiskCacheHeader;
+
+static char* diskCacheDir;
+static ProgramHash driverHashes[GPCTX_MAX_DEVICES];
+static bool devicesInitialized[GPCTX_MAX_DEVICES];
+
+static bool workerStarted;
+static bool workerStop;
+static pthread_t workerThread;
+static GputContext* workerContexts[GPCTX_MAX_DEVICES];
+static pthread_mutex_t workerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workerCond = PTHREAD_COND_INITIALIZER;
+static PendingProgram* workerQueueHead;
+static PendingProgram* workerQueueTail;
+
+static ProgramHash hashBytes(ProgramHash hash, const char* str)
+{
+   for (; *str != '\0'; str++) {
+      hash ^= (unsigned char) *str;
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+static ProgramHash hashStage(
+   ProgramHash hash, const char* sources[], int srcsCount
+){
+   for (int i = 0; i < srcsCount; i++) {
+      hash = hashBytes(hash, sources[i]);
+   }
+   hash ^= STAGE_SEPARATOR;
+   hash *= FNV_PRIME;
+   return hash;
+}
+
+static ProgramHash hashProgram(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount
+){
+   ProgramHash hash = FNV_OFFSET_BASIS;
+   hash = hashStage(hash, &defines, 1);
+   hash = hashStage(hash, vertexSources, vertexSrcsCount);
+   hash = hashStage(hash, fragmentSources, fragmentSrcsCount);
+   return hash;
+}
+
+static ProgramHash hashUint64(ProgramHash hash, uint64_t value)
+{
+   for (int i = 0; i < 8; i++) {
+      hash ^= (value >> (8 * i)) & 0xff;
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+bool glpc_init(const char* diskCacheDirPath)
+{
+   if (diskCacheDirPath == NULL || diskCacheDirPath[0] == '\0') {
+      return true;
+   }
+
+   GLint binaryFormatsCount;
+   GLC(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatsCount));
+   if (binaryFormatsCount == 0) {
+      GPUT_LOG_INFO("Driver exposes no program binary formats, "
+         "disk shader cache disabled"
+      );
+      return true;
+   }
+
+   if (mkdir(diskCacheDirPath, 0755) != 0 && errno != EEXIST) {
+      GPUT_LOG_WARN("Could not create shader cache directory %s: %s",
+         diskCacheDirPath, strerror(errno)
+      );
+      return false;
+   }
+
+   diskCacheDir = strdup(diskCacheDirPath);
+   GPUT_LOG_INFO("Shader cache directory: %s", diskCacheDir);
+   return diskCacheDir != NULL;
+}
+
+static void initDevice(int device)
+{
+   if (gpctx_hasParallelShaderCompile()) {
+      // Let the driver use as many compiler threads as it sees fit
+      GLC(glMaxShaderCompilerThreadsKHR(0xffffffff));
+   }
+
+   const char* renderer = (const char*) GLC(glGetString(GL_RENDERER));
+   const char* version = (const char*) GLC(glGetString(GL_VERSION));
+   driverHashes[device] = hashStage(FNV_OFFSET_BASIS, &renderer, 1);
+   driverHashes[device] = hashStage(driverHashes[device], &version, 1);
+
+   devicesInitialized[device] = true;
+}
+
+static void getDiskCachePath(uint64_t key, char* path)
+{
+   snprintf(path, DISK_CACHE_PATH_SIZE, "%s/%016llx.glbin",
+      diskCacheDir, (unsigned long long) key
+   );
+}
+
+static GlProgId loadProgramFromDisk(uint64_t key)
+{
+   char path[DISK_CACHE_PATH_SIZE];
+   getDiskCachePath(key, path);
+
+   FILE* file = fopen(path, "rb");
+   if (file == NULL) {
+      return 0;
+   }
+
+   GlProgId progId = 0;
+   DiskCacheHeader header;
+   void* binary = NULL;
+
+   if (fread(&header, sizeof(header), 1, file) != 1
+      || header.magic != DISK_CACHE_MAGIC || header.key != key
+   ){
+      goto cleanup;
+   }
+
+   binary = malloc(header.binaryLength);
+   if (binary == NULL
+      || fread(binary, header.binaryLength, 1, file) != 1
+   ){
+      goto cleanup;
+   }
+
+   double traceStart = gptr_begin();
+   progId = gla_createProgramFromBinary(
+      header.binaryFormat, binary, header.binaryLength
+   );
+   gptr_end("load program binary", traceStart);
+   if (progId == 0) {
+      GPUT_LOG_DEBUG("Driver rejected cached program binary %s", path);
+   }
+
+cleanup:
+   free(binary);
+   fclose(file);
+   return progId;
+}
+
+static void storeProgramToDisk(uint64_t key, GlProgId progId)
+{
+   GLenum binaryFormat;
+   int binaryLength;
+   void* binary = gla_getProgramBinary(progId, &binaryFormat, &binaryLength);
+   if (binary == NULL) {
+      return;
+   }
+
+   char path[DISK_CACHE_PATH_SIZE];
+   char tmpPath[DISK_CACHE_PATH_SIZE + 32];
+   getDiskCachePath(key, path);
+   snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int) getpid());
+
+   DiskCacheHeader header = {
+      .magic = DISK_CACHE_MAGIC,
+      .binaryFormat = binaryFormat,
+      .binaryLength = binaryLength,
+      .key = key
+   };
+
+   // Written to a temporary file and renamed so that concurrent processes
+   // never observe a partially written binary
+   FILE* file = fopen(tmpPath, "wb");
+   if (file != NULL) {
+      bool written = fwrite(&header, sizeof(header), 1, file) == 1
+         && fwrite(binary, binaryLength, 1, file) == 1;
+      written = fclose(file) == 0 && written;
+
+      if (!written || rename(tmpPath, path) != 0) {
+         GPUT_LOG_WARN("Could not write shader cache file %s", path);
+         unlink(tmpPath);
+      }
+   }
+
+   free(binary);
+}
+
+static int findEntryByHash(ProgramHash hash, int device)
+{
+   for (int i = 0; i < entriesCount; i++) {
+      if (entries[i].hash == hash && entries[i].device == device
+         && !entries[i].failed
+      ){
+         return i;
+      }
+   }
+   return -1;
+}
+
+static int findEntryByProgram(GlProgId progId)
+{
+   int device = gpctx_getCurrentDeviceIndex();
+   for (int i = 0; i < entriesCount; i++) {
+      if (entries[i].progId == progId && entries[i].device == device) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+static GlShaderId compileStage(
+   ShaderType shaderType, const char* defines,
+   const char* sources[], int srcsCount, bool async
+){
+   int fullSrcsCount = srcsCount + 2;
+   const char** fullSources = malloc(fullSrcsCount * sizeof(const char*));
+   GPUT_ASSERT(fullSources != NULL, "Could not allocate shader sources");
+
+   fullSources[0] = GLA_GLSL_VERSION;
+   fullSources[1] = defines;
+   for (int i = 0; i < srcsCount; i++) {
+      fullSources[i + 2] = sources[i];
+   }
+
+   GlShaderId shaderId = async
+      ? gla_compileShaderAsync(shaderType, fullSources, fullSrcsCount)
+      : gla_createShader(shaderType, fullSources, fullSrcsCount);
+   free(fullSources);
+   return shaderId;
+}
+
+// Only fails for synchronous compilations, asynchronous ones report errors
+// once their link status is checked
+static bool compileProgram(
+   GlProgId progId, const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount, bool async
+){
+   double traceStart = gptr_begin();
+   GlShaderId vertexShader = compileStage(
+      VERTEX_SHADER, defines, vertexSources, vertexSrcsCount, async
+   );
+   GlShaderId fragmentShader = compileStage(
+      FRAGMENT_SHADER, defines, fragmentSources, fragmentSrcsCount, async
+   );
+   if (vertexShader == 0 || fragmentShader == 0) {
+      if (vertexShader != 0) {
+         gla_deleteShader(vertexShader);
+      }
+      if (fragmentShader != 0) {
+         gla_deleteShader(fragmentShader);
+      }
+      return false;
+   }
+   if (diskCacheDir) {
+      gla_setProgramRetrievable(progId);
+   }
+   gla_linkProgramAsync(progId, vertexShader, fragmentShader);
+
+   // The program keeps its own reference to the attached shaders
+   gla_deleteShader(vertexShader);
+   gla_deleteShader(fragmentShader);
+   gptr_end(async ? "submit program" : "compile program", traceStart);
+   return true;
+}
+
+static char* concatSources(const char* sources[], int srcsCount)
+{
+   size_t length = 0;
+   for (int i = 0; i < srcsCount; i++) {
+      length += strlen(sources[i]);
+   }
+
+   char* concatenated = malloc(length + 1);
+   GPUT_ASSERT(concatenated != NULL, "Could not copy shader sources");
+   if (concatenated == NULL) {
+      return NULL;
+   }
+
+   length = 0;
+   for (int i = 0; i < srcsCount; i++) {
+      size_t srcLength = strlen(sources[i]);
+      memcpy(concatenated + length, sources[i], srcLength);
+      length += srcLength;
+   }
+   concatenated[length] = '\0';
+   return concatenated;
+}
+
+static bool makeWorkerContextCurrent(int device)
+{
+   // The worker keeps one context per device it compiled programs for
+   if (workerContexts[device] == NULL) {
+      workerContexts[device] = gpctx_createSharedContext(
+         gpctx_getDevice(device)
+      );
+   }
+   return workerContexts[device] != NULL
+      && gpctx_makeCurrent(workerContexts[device]);
+}
+
+static void* compileWorkerMain(void* arg)
+{
+   pthread_mutex_lock(&workerMutex);
+   while (true) {
+      while (workerQueueHead == NULL && !workerStop) {
+         pthread_cond_wait(&workerCond, &workerMutex);
+      }
+      if (workerQueueHead == NULL) {
+         break;
+      }
+
+      PendingProgram* pending = workerQueueHead;
+      workerQueueHead = pending->next;
+      if (workerQueueHead == NULL) {
+         workerQueueTail = NULL;
+      }
+      pthread_mutex_unlock(&workerMutex);
+
+      // Programs that could not be compiled are still marked ready, their
+      // link status tells the waiting thread
+      if (makeWorkerContextCurrent(pending->device)) {
+         const char* vertexSource = pending->vertexSource;
+         const char* fragmentSource = pending->fragmentSource;
+         double traceStart = gptr_begin();
+         compileProgram(
+            pending->progId, pending->defines,
+            &vertexSource, 1, &fragmentSource, 1, true
+         );
+
+         // Object changes made in one context are only guaranteed to be
+         // seen by other contexts once they have completed
+         gla_finish();
+         gptr_end("compile program", traceStart);
+      }
+      else {
+         GPUT_LOG_ERROR("Could not make compile worker context current");
+      }
+
+      pthread_mutex_lock(&workerMutex);
+      atomic_store(&pending->ready, true);
+      pthread_cond_broadcast(&workerCond);
+   }
+   pthread_mutex_unlock(&workerMutex);
+
+   gpctx_makeCurrent(NULL);
+   for (int i = 0; i < GPCTX_MAX_DEVICES; i++) {
+      if (workerContexts[i] != NULL) {
+         gpctx_destroyContext(workerContexts[i]);
+         workerContexts[i] = NULL;
+      }
+   }
+   return NULL;
+}
+
+static bool startCompileWorker()
+{
+   pthread_mutex_lock(&workerMutex);
+   if (!workerStarted) {
+      workerStop = false;
+      workerStarted =
+         pthread_create(&workerThread, NULL, compileWorkerMain, NULL) == 0;
+   }
+   bool started = workerStarted;
+   pthread_mutex_unlock(&workerMutex);
+   return started;
+}
+
+static void stopCompileWorker()
+{
+   if (!workerStarted) {
+      return;
+   }
+
+   pthread_mutex_lock(&workerMutex);
+   workerStop = true;
+   pthread_cond_broadcast(&workerCond);
+   pthread_mutex_unlock(&workerMutex);
+
+   pthread_join(workerThread, NULL);
+   workerStarted = false;
+}
+
+static void submitToCompileWorker(PendingProgram* pending)
+{
+   pthread_mutex_lock(&workerMutex);
+   pending->next = NULL;
+   if (workerQueueTail != NULL) {
+      workerQueueTail->next = pending;
+   }
+   else {
+      workerQueueHead = pending;
+   }
+   workerQueueTail = pending;
+   pthread_cond_signal(&workerCond);
+   pthread_mutex_unlock(&workerMutex);
+}
+
+static bool isPendingDone(PendingProgram* pending)
+{
+   if (pending->onWorker) {
+      return atomic_load(&pending->ready);
+   }
+   // Drivers without GL_KHR_parallel_shader_compile complete the link
+   // before any status query returns anyway
+   if (!gpctx_hasParallelShaderCompile()) {
+      return true;
+   }
+   return gla_isProgramLinkDone(pending->progId);
+}
+
+static void waitPending(PendingProgram* pending)
+{
+   // Without a worker the first status query blocks until the driver is done
+   if (pending->onWorker) {
+      double traceStart = gptr_begin();
+      pthread_mutex_lock(&workerMutex);
+      while (!atomic_load(&pending->ready)) {
+         pthread_cond_wait(&workerCond, &workerMutex);
+      }
+      pthread_mutex_unlock(&workerMutex);
+      gptr_end("wait compile worker", traceStart);
+   }
+}
+
+static void finishPending(ProgramCacheEntry* entry)
+{
+   PendingProgram* pending = entry->pending;
+
+   double traceStart = gptr_begin();
+   bool linked = gla_checkProgramLinked(entry->progId);
+   gptr_end("wait program link", traceStart);
+   if (linked && diskCacheDir) {
+      storeProgramToDisk(pending->diskKey, entry->progId);
+   }
+   entry->failed = !linked;
+
+   free(pending->defines);
+   free(pending->vertexSource);
+   free(pending->fragmentSource);
+   free(pending);
+   entry->pending = NULL;
+}
+
+// Returns false when the program failed to compile or link
+static bool waitEntry(ProgramCacheEntry* entry)
+{
+   if (entry->pending != NULL) {
+      waitPending(entry->pending);
+      finishPending(entry);
+   }
+   return !entry->failed;
+}
+
+static GlProgId acquireProgram(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount, bool async
+){
+   if (defines == NULL) {
+      defines = "";
+   }
+
+   ProgramHash hash = hashProgram(
+      defines,
+      vertexSources, vertexSrcsCount,
+      fragmentSources, fragmentSrcsCount
+   );
+
+   int device = gpctx_getCurrentDeviceIndex();
+
+   pthread_mutex_lock(&cacheMutex);
+   if (!devicesInitialized[device]) {
+      initDevice(device);
+   }
+   int entryIndex = findEntryByHash(hash, device);
+   if (entryIndex != -1) {
+      if (!async && !waitEntry(&entries[entryIndex])) {
+         pthread_mutex_unlock(&cacheMutex);
+         return 0;
+      }
+      entries[entryIndex].refCount++;
+      GlProgId progId = entries[entryIndex].progId;
+      pthread_mutex_unlock(&cacheMutex);
+      return progId;
+   }
+   pthread_mutex_unlock(&cacheMutex);
+
+   uint64_t diskKey = hashUint64(driverHashes[device], hash);
+   GlProgId progId = diskCacheDir ? loadProgramFromDisk(diskKey) : 0;
+   PendingProgram* pending = NULL;
+
+   if (progId == 0 && !async) {
+      progId = gla_createProgram();
+      if (!compileProgram(
+            progId, defines,
+            vertexSources, vertexSrcsCount,
+            fragmentSources, fragmentSrcsCount, false
+         )
+         || !gla_checkProgramLinked(progId)
+      ){
+         gla_deleteProgram(progId);
+         return 0;
+      }
+
+      if (diskCacheDir) {
+         storeProgramToDisk(diskKey, progId);
+      }
+      gpctx_publishObjects();
+   }
+   else if (progId == 0) {
+      pending = calloc(1, sizeof(PendingProgram));
+      GPUT_ASSERT(pending != NULL, "Could not allocate pending program");
+
+      progId = gla_createProgram();
+      pending->progId = progId;
+      pending->device = device;
+      pending->diskKey = diskKey;
+      atomic_init(&pending->ready, false);
+
+      // With GL_KHR_parallel_shader_compile the driver compiles in the
+      // background on its own, otherwise a worker thread with a shared
+      // context does the compilation. Other threads always go through the
+      // worker since it makes its results visible to every context.
+      bool useDriver = gpctx_hasParallelShaderCompile()
+         && gpctx_isCoreCurrent();
+      if (useDriver || !startCompileWorker()) {
+         compileProgram(
+            progId, defines,
+            vertexSources, vertexSrcsCount,
+            fragmentSources, fragmentSrcsCount, true
+         );
+      }
+      else {
+         pending->onWorker = true;
+         pending->defines = strdup(defines);
+         pending->vertexSource = concatSources(
+            vertexSources, vertexSrcsCount
+         );
+         pending->fragmentSource = concatSources(
+            fragmentSources, fragmentSrcsCount
+         );
+         submitToCompileWorker(pending);
+      }
+   }
+
+   pthread_mutex_lock(&cacheMutex);
+
+   // Another thread may have created the same program in the meantime. A
+   // synchronous request waits for it, and keeps its own program should the
+   // other compilation fail.
+   entryIndex = findEntryByHash(hash, device);
+   if (entryIndex != -1 && !async && !waitEntry(&entries[entryIndex])) {
+      entryIndex = -1;
+   }
+   if (entryIndex != -1) {
+      entries[entryIndex].refCount++;
+      GlProgId existingProgId = entries[entryIndex].progId;
+      pthread_mutex_unlock(&cacheMutex);
+
+      if (pending != NULL) {
+         waitPending(pending);
+         free(pending->defines);
+         free(pending->vertexSource);
+         free(pending->fragmentSource);
+         free(pending);
+      }
+      gla_deleteProgram(progId);
+      return existingProgId;
+   }
+
+   if (entriesCount == entriesCapacity) {
+      int newCapacity = entriesCapacity ? 2 * entriesCapacity : 16;
+      ProgramCacheEntry* newEntries = realloc(
+         entries, newCapacity * sizeof(ProgramCacheEntry)
+      );
+      GPUT_ASSERT(newEntries != NULL, "Could not grow the program cache");
+      entries = newEntries;
+      entriesCapacity = newCapacity;
+   }
+
+   entries[entriesCount++] = (ProgramCacheEntry) {
+      .device = device,
+      .hash = hash,
+      .progId = progId,
+      .refCount = 1,
+      .uniformOwner = NULL,
+      .pending = pending,
+      .failed = false
+   };
+   pthread_mutex_unlock(&cacheMutex);
+
+   GPUT_LOG_DEBUG("Created program %u (hash %016llx)",
+      progId, (unsigned long long) hash
+   );
+   return progId;
+}
+
+GlProgId glpc_acquireProgram(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount
+){
+   return acquireProgram(
+      defines,
+      vertexSources, vertexSrcsCount,
+      fragmentSources, fragmentSrcsCount, false
+   );
+}
+
+GlProgId glpc_acquireProgramAsync(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount
+){
+   return acquireProgram(
+      defines,
+      vertexSources, vertexSrcsCount,
+      fragmentSources, fragmentSrcsCount, true
+   );
+}
+
+bool glpc_isProgramReady(GlProgId progId, bool* failed)
+{
+   pthread_mutex_lock(&cacheMutex);
+   int entryIndex = findEntryByProgram(progId);
+   GPUT_ASSERT(entryIndex != -1, "Program %u is not in the cache", progId);
+
+   bool ready = false;
+   *failed = entryIndex == -1;
+   if (entryIndex != -1) {
+      ProgramCacheEntry* entry = &entries[entryIndex];
+      if (entry->pending != NULL && isPendingDone(entry->pending)) {
+         finishPending(entry);
+      }
+      ready = entry->pending == NULL && !entry->failed;
+      *failed = entry->failed;
+   }
+   pthread_mutex_unlock(&cacheMutex);
+   return ready;
+}
+
+bool glpc_waitProgram(GlProgId progId)
+{
+   pthread_mutex_lock(&cacheMutex);
+   int entryIndex = findEntryByProgram(progId);
+   GPUT_ASSERT(entryIndex != -1, "Program %u is not in the cache", progId);
+   bool linked = entryIndex != -1 && waitEntry(&entries[entryIndex]);
+   pthread_mutex_unlock(&cacheMutex);
+   return linked;
+}
+
+void glpc_retainProgram(GlProgId progId)
+{
+   pthread_mutex_lock(&cacheMutex);
+   int entryIndex = findEntryByProgram(progId);
+   GPUT_ASSERT(entryIndex != -1, "Program %u is not in the cache", progId);
+   if (entryIndex != -1) {
+      entries[entryIndex].refCount++;
+   }
+   pthread_mutex_unlock(&cacheMutex);
+}
+
+void glpc_releaseProgram(GlProgId progId)
+{
+   pthread_mutex_lock(&cacheMutex);
+   int entryIndex = findEntryByProgram(progId);
+   GPUT_ASSERT(entryIndex != -1, "Program %u is not in the cache", progId);
+
+   if (entryIndex != -1 && --entries[entryIndex].refCount == 0) {
+      // The worker may still be linking into the program
+      waitEntry(&entries[entryIndex]);
+      gla_deleteProgram(progId);
+      entries[entryIndex] = entries[--entriesCount];
+   }
+   pthread_mutex_unlock(&cacheMutex);
+}
+
+bool glpc_setUniformOwner(GlProgId progId, const void* owner)
+{
+   pthread_mutex_lock(&cacheMutex);
+   int entryIndex = findEntryByProgram(progId);
+   bool changed = entryIndex == -1
+      || entries[entryIndex].uniformOwner != owner;
+   if (entryIndex != -1) {
+      entries[entryIndex].uniformOwner = owner;
+   }
+   pthread_mutex_unlock(&cacheMutex);
+   return changed;
+}
+
+void glpc_terminate()
+{
+   for (int i = 0; i < entriesCount; i++) {
+      GPUT_LOG_WARN("Program %u still has %d reference(s) at termination",
+         entries[i].progId, entries[i].refCount
+      );
+      gpctx_setDevice(gpctx_getDevice(entries[i].device));
+      waitEntry(&entries[i]);
+      gla_deleteProgram(entries[i].progId);
+   }
+
+   stopCompileWorker();
+
+   for (int i = 0; i < GPCTX_MAX_DEVICES; i++) {
+      devicesInitialized[i] = false;
+   }
+
+   free(entries);
+   entries = NULL;
+   entriesCount = 0;
+   entriesCapacity = 0;
+
+   free(diskCacheDir);
+   diskCacheDir = NULL;
+}
@@ -0,0 +1,63 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+#include "GlAbstract.h"
+
+bool glpc_init(const char* diskCacheDir);
+
+// Returns 0 when the sources don't compile or link
+GlProgId glpc_acquireProgram(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount
+);
+
+// Submits the program for compilation and returns immediately. The handle
+// must not be used for drawing before glpc_isProgramReady returns true or
+// glpc_waitProgram returned.
+GlProgId glpc_acquireProgramAsync(
+   const char* defines,
+   const char* vertexSources[], int vertexSrcsCount,
+   const char* fragmentSources[], int fragmentSrcsCount
+);
+
+// failed is set once the compilation or link failed, the program then never
+// becomes ready
+bool glpc_isProgramReady(GlProgId progId, bool* failed);
+
+// Returns false when the program failed to compile or link
+bool glpc_waitProgram(GlProgId progId);
+
+void glpc_retainProgram(GlProgId progId);
+
+void glpc_releaseProgram(GlProgId progId);
+
+// Uniform values are program state shared by every user of a cached program.
+// Records which user last set them and returns true if it changed.
+bool glpc_setUniformOwner(GlProgId progId, const void* owner);
+
+void glpc_terminate();
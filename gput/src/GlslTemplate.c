@@ -0,0 +1,309 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "GlAbstract.h"
+#include "GlslTemplate.h"
+#include "gputDebug.h"
+
+typedef struct {
+   const char* name;
+   const char* source;
+} Snippet;
+
+static const Snippet snippets[] = {
+   {
+      "gput/coord.glsl",
+      "ivec2 gput_coord()\n"
+      "{\n"
+      "   return ivec2(gl_FragCoord.xy);\n"
+      "}\n"
+   },
+   {
+      // Folds to constants when the output size is specialized
+      "gput/index.glsl",
+      "#include \"gput/coord.glsl\"\n"
+      "#ifdef GPUT_OUT_WIDTH\n"
+      "int gput_index()\n"
+      "{\n"
+      "   ivec2 coord = gput_coord();\n"
+      "   return coord.y * GPUT_OUT_WIDTH + coord.x;\n"
+      "}\n"
+      "ivec2 gput_coordOf(int index)\n"
+      "{\n"
+      "   return ivec2(index % GPUT_OUT_WIDTH, index / GPUT_OUT_WIDTH);\n"
+      "}\n"
+      "#endif\n"
+   },
+};
+
+#define SNIPPETS_COUNT (sizeof(snippets) / sizeof(Snippet))
+
+#define MAX_INCLUDE_DEPTH 8
+
+typedef struct {
+   char* data;
+   size_t length;
+   size_t capacity;
+   bool failed;
+} StringBuilder;
+
+static void sbAppendN(StringBuilder* sb, const char* str, size_t length)
+{
+   if (sb->failed) {
+      return;
+   }
+   if (sb->length + length + 1 > sb->capacity) {
+      size_t newCapacity = sb->capacity ? sb->capacity : 256;
+      while (sb->length + length + 1 > newCapacity) {
+         newCapacity *= 2;
+      }
+      char* newData = realloc(sb->data, newCapacity);
+      if (newData == NULL) {
+         sb->failed = true;
+         return;
+      }
+      sb->data = newData;
+      sb->capacity = newCapacity;
+   }
+   memcpy(sb->data + sb->length, str, length);
+   sb->length += length;
+   sb->data[sb->length] = '\0';
+}
+
+static void sbAppendf(StringBuilder* sb, const char* fmt, ...)
+{
+   char line[256];
+   va_list args;
+   va_start(args, fmt);
+   int length = vsnprintf(line, sizeof(line), fmt, args);
+   va_end(args);
+
+   if (length < 0 || (size_t) length >= sizeof(line)) {
+      GPUT_LOG_ERROR("Generated GLSL line too long");
+      sb->failed = true;
+      return;
+   }
+   sbAppendN(sb, line, length);
+}
+
+static char* sbFinish(StringBuilder* sb)
+{
+   if (sb->failed) {
+      free(sb->data);
+      return NULL;
+   }
+   if (sb->data == NULL) {
+      return calloc(1, 1);
+   }
+   return sb->data;
+}
+
+typedef struct {
+   const char* scalarType;
+   const char* vectorPrefix;
+   const char* samplerType;
+   const char* precision;
+} GlslTypeInfo;
+
+static GlslTypeInfo getGlslTypeInfo(GlDataType dataType)
+{
+   GlslTypeInfo info;
+   switch (gla_getDataTypeComponentType(dataType)) {
+      case GL_BYTE: case GL_SHORT: case GL_INT:
+         info.scalarType = "int";
+         info.vectorPrefix = "i";
+         info.samplerType = "isampler2D";
+         break;
+      case GL_UNSIGNED_BYTE: case GL_UNSIGNED_SHORT: case GL_UNSIGNED_INT:
+         info.scalarType = "uint";
+         info.vectorPrefix = "u";
+         info.samplerType = "usampler2D";
+         break;
+      default:
+         info.scalarType = "float";
+         info.vectorPrefix = "";
+         info.samplerType = "sampler2D";
+         break;
+   }
+
+   // Narrow formats don't need full precision, which is cheaper on
+   // VideoCore. mediump ints only cover [-2^15, 2^15] so unsigned 16-bit
+   // values still need highp.
+   switch (gla_getDataTypeComponentType(dataType)) {
+      case GL_BYTE: case GL_UNSIGNED_BYTE:
+         info.precision = "lowp";
+         break;
+      case GL_SHORT: case GL_HALF_FLOAT:
+         info.precision = "mediump";
+         break;
+      default:
+         info.precision = "highp";
+         break;
+   }
+   return info;
+}
+
+static void appendGlslType(
+   StringBuilder* sb, const GlslTypeInfo* info, int componentsCount
+){
+   if (componentsCount == 1) {
+      sbAppendf(sb, "%s", info->scalarType);
+   }
+   else {
+      sbAppendf(sb, "%svec%d", info->vectorPrefix, componentsCount);
+   }
+}
+
+char* glslt_generatePrologue(const GputKernelSpec* spec)
+{
+   StringBuilder sb = {0};
+
+   if (spec->inputsCount < 0 || spec->inputsCount > GPUT_MAX_KERNEL_INPUTS) {
+      GPUT_LOG_ERROR("Invalid kernel inputs count %d", spec->inputsCount);
+      return NULL;
+   }
+
+   sbAppendf(&sb, "#define GPUT_INPUTS_COUNT %d\n", spec->inputsCount);
+   for (int i = 0; i < spec->inputsCount; i++) {
+      GlDataType dataType = spec->inputTypes[i];
+      GlslTypeInfo info = getGlslTypeInfo(dataType);
+
+      sbAppendf(&sb, "#define GPUT_IN%d_COMPONENTS %d\n",
+         i, gla_getDataTypeComponents(dataType)
+      );
+      sbAppendf(&sb, "#define GPUT_IN%d_SAMPLER %s\n", i, info.samplerType);
+      sbAppendf(&sb, "#define GPUT_IN%d_TYPE ", i);
+      appendGlslType(&sb, &info, 4);
+      sbAppendf(&sb, "\nlayout(binding = %d) uniform %s %s gput_in%d;\n",
+         i, info.precision, info.samplerType, i
+      );
+   }
+
+   GlslTypeInfo outInfo = getGlslTypeInfo(spec->outputType);
+   int outComponents = gla_getDataTypeComponents(spec->outputType);
+
+   sbAppendf(&sb, "#define GPUT_OUT_COMPONENTS %d\n", outComponents);
+   sbAppendf(&sb, "#define GPUT_OUT_SWIZZLE %.*s\n", outComponents, "xyzw");
+   sbAppendf(&sb, "#define GPUT_OUT_TYPE ");
+   appendGlslType(&sb, &outInfo, outComponents);
+   sbAppendf(&sb, "\n");
+   if (spec->outputWidth > 0 && spec->outputHeight > 0) {
+      sbAppendf(&sb, "#define GPUT_OUT_WIDTH %d\n", spec->outputWidth);
+      sbAppendf(&sb, "#define GPUT_OUT_HEIGHT %d\n", spec->outputHeight);
+   }
+
+   sbAppendf(&sb, "precision highp float;\nprecision highp int;\n");
+   sbAppendf(&sb, "layout(location = 0) out %s GPUT_OUT_TYPE gput_out;\n",
+      outInfo.precision
+   );
+
+   if (spec->defines != NULL) {
+      sbAppendN(&sb, spec->defines, strlen(spec->defines));
+      sbAppendN(&sb, "\n", 1);
+   }
+   return sbFinish(&sb);
+}
+
+static const Snippet* findSnippet(const char* name, size_t nameLength)
+{
+   for (size_t i = 0; i < SNIPPETS_COUNT; i++) {
+      if (strlen(snippets[i].name) == nameLength
+         && strncmp(snippets[i].name, name, nameLength) == 0
+      ){
+         return &snippets[i];
+      }
+   }
+   return NULL;
+}
+
+static bool expandIncludes(
+   StringBuilder* sb, const char* source, int depth, bool included[]
+){
+   if (depth > MAX_INCLUDE_DEPTH) {
+      GPUT_LOG_ERROR("GLSL includes nested too deeply");
+      return false;
+   }
+
+   const char* line = source;
+   while (*line != '\0') {
+      const char* lineEnd = strchr(line, '\n');
+      size_t lineLength = lineEnd
+         ? (size_t) (lineEnd - line) + 1
+         : strlen(line);
+
+      const char* directive = line + strspn(line, " \t");
+      if (strncmp(directive, "#include", 8) == 0) {
+         const char* nameStart = strchr(directive, '"');
+         const char* nameEnd = nameStart ? strchr(nameStart + 1, '"') : NULL;
+         if (nameEnd == NULL || (lineEnd && nameEnd > lineEnd)) {
+            GPUT_LOG_ERROR("Malformed GLSL include: %.*s",
+               (int) lineLength, line
+            );
+            return false;
+         }
+
+         const Snippet* snippet = findSnippet(
+            nameStart + 1, nameEnd - nameStart - 1
+         );
+         if (snippet == NULL) {
+            GPUT_LOG_ERROR("Unknown GLSL include \"%.*s\"",
+               (int) (nameEnd - nameStart - 1), nameStart + 1
+            );
+            return false;
+         }
+
+         // Snippets are only included once, like with an include guard
+         size_t snippetIndex = snippet - snippets;
+         if (!included[snippetIndex]) {
+            included[snippetIndex] = true;
+            if (!expandIncludes(sb, snippet->source, depth + 1, included)) {
+               return false;
+            }
+         }
+      }
+      else {
+         sbAppendN(sb, line, lineLength);
+      }
+      line += lineLength;
+   }
+   return true;
+}
+
+char* glslt_expandIncludes(const char* source)
+{
+   StringBuilder sb = {0};
+   bool included[SNIPPETS_COUNT] = {false};
+
+   if (!expandIncludes(&sb, source, 0, included)) {
+      free(sb.data);
+      return NULL;
+   }
+   return sbFinish(&sb);
+}
@@ -25,95 +25,89 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "glad/glad.h"
 
-#include <fcntl.h>
-#include <gbm.h>
-#include <EGL/egl.h>
-#include <EGL/eglext.h>
-
+#include "gput.h"
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputCpu.h"
 #include "gputDebug.h"
+#include "gputDispatch.h"
+#include "gputEvent.h"
+#include "gputGlStats.h"
 #include "GlAbstract.h"
+#include "GlProgramCache.h"
+#include "gputKernel.h"
+#include "gputMemory.h"
+#include "gputOps.h"
+#include "gputProfile.h"
+#include "gputQueue.h"
+#include "gputTrace.h"
+
+static const char* shaderCacheDir;
+static GputBackend backend = GPUT_BACKEND_GPU;
+static bool backendSelected;
+static bool gpuInitialized;
+
+void gput_setShaderCacheDir(const char* dirPath)
+{
+   shaderCacheDir = dirPath;
+}
 
-typedef struct gbm_device GbmDevice;
-typedef int DriDeviceFD;
-
-static const char* driDevPath = "/dev/dri/renderD128";
-static const char* eglVersion;
-static const char* eglExtentions;
+void gput_setBackend(GputBackend selectedBackend)
+{
+   backend = selectedBackend;
+   backendSelected = true;
+}
 
-static DriDeviceFD driDevice;
-static GbmDevice* gbmDevice;
-static EGLDisplay eglDisplay;
-static EGLContext coreContext;
+GputBackend gput_getBackend()
+{
+   return backend;
+}
 
 bool gput_init()
 {
-   bool returnVal;
-
    GPUT_LOG_INIT();
 
-   driDevice = open(driDevPath, O_RDWR);
-   GPUT_ASSERT(driDevice != -1, "Could not open dri device %s", driDevPath);
+   gptr_init();
 
-   gbmDevice = gbm_create_device(driDevice);
-   GPUT_ASSERT(gbmDevice != NULL, "Could not get a GBM device")
-
-   eglDisplay = eglGetDisplay(gbmDevice);
-   GPUT_ASSERT(eglDisplay != EGL_NO_DISPLAY, "Could not get an EGL display");
-
-   EGLint major, minor;
-   returnVal = eglInitialize(eglDisplay, &major, &minor);
-   GPUT_ASSERT(returnVal, "Failed to initialize EGL");
-
-   eglVersion = eglQueryString(eglDisplay, EGL_VERSION);
-   GPUT_LOG_INFO("EGL version: %s", eglVersion);
-
-   eglExtentions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
-   GPUT_LOG_TRACE("EGL extentions: %s", eglExtentions);
-
-   GPUT_ASSERT(strstr(eglExtentions, "EGL_KHR_create_context"),
-      "EGL_KHR_create_context extention not supported"
-   )
-   GPUT_ASSERT(strstr(eglExtentions, "EGL_KHR_surfaceless_context"),
-      "EGL_KHR_surfaceless_context extention not supported"
-   )
+   // The CPU backend is always available, GPU reductions also finish on it
+   if (!gpcpu_init()) {
+      return false;
+   }
 
-   const EGLint eglConfigAttribs[] = {
-      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
-      EGL_NONE
-   };
+   const char* backendName = getenv("GPUT_BACKEND");
+   if (!backendSelected && backendName && strcmp(backendName, "cpu") == 0) {
+      backend = GPUT_BACKEND_CPU;
+   }
+   if (backend == GPUT_BACKEND_CPU) {
+      gpd_init(false);
+      return true;
+   }
 
-   EGLConfig eglConfig;
-   EGLint eglConfigCount;
+   gpp_init();
 
-   returnVal = eglChooseConfig(
-      eglDisplay, eglConfigAttribs, &eglConfig, 1, &eglConfigCount
-   );
-   GPUT_ASSERT(returnVal, "Failed to configure EGL");
+   if (!gpctx_init()) {
+      GPUT_LOG_WARN("No usable device, falling back to the CPU backend");
+      backend = GPUT_BACKEND_CPU;
+      gpd_init(false);
+      return true;
+   }
+   gpuInitialized = true;
 
-   returnVal = eglBindAPI(EGL_OPENGL_ES_API);
-   GPUT_ASSERT(returnVal, "Failed to bind OpenGL API to EGL");
+   if (shaderCacheDir == NULL) {
+      shaderCacheDir = getenv("GPUT_SHADER_CACHE_DIR");
+   }
+   glpc_init(shaderCacheDir);
 
-   const EGLint contextAttribs[] = {
-      EGL_CONTEXT_CLIENT_VERSION, 3,
-      EGL_NONE
-   };
-   coreContext = eglCreateContext(
-      eglDisplay, eglConfig, EGL_NO_CONTEXT, contextAttribs
-   );
-   GPUT_ASSERT(coreContext != EGL_NO_CONTEXT, "Could not create OpenGL context");
+   gpa_init();
 
-   returnVal = eglMakeCurrent(
-      eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, coreContext
-   );
-   GPUT_ASSERT(returnVal, "Could not make context current");
+   gpk_init();
 
-   returnVal = gladLoadGLES2Loader((GLADloadproc) eglGetProcAddress);
-   GPUT_ASSERT(returnVal, "Failed to load opengl function pointers");
+   gpd_init(true);
 
    return true;
 }
@@ -122,79 +116,29 @@ int data[5][5][4];
 
 void gput_test()
 {
+   if (!gpuInitialized) {
+      GPUT_LOG_INFO("gput_test needs the GPU backend");
+      return;
+   }
+
    const char* glVersion = GLC(glGetString(GL_VERSION));
    GPUT_LOG_INFO("OpenGL version: %s", glVersion);
 
    const char* glslVersion = GLC(glGetString(GL_SHADING_LANGUAGE_VERSION));
    GPUT_LOG_INFO("GLSL version: %s", glslVersion);
 
-   const char* VSSrc = "#version 310 es\n"
-      "layout (location = 0) in vec3 aPos;\n"
-      "void main()"
-      "{"
-      "  gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);"
-      "}\n";
-
-   GlShaderId VSid = gla_createShader(VERTEX_SHADER, &VSSrc, 1);
-
-   const char* FSSrc = "#version 310 es\n"
-   ""
-   "out lowp vec4 FragColor;\n"
+   const char* kernelSrc =
+   "layout (location = 0) out highp ivec4 result;\n"
    "void main()\n"
    "{\n"
-   "  FragColor = intBitsToFloat(ivec4(1, 2, 3, 4));\n"
+   "  result = ivec4(1, 2, 3, 4);\n"
    "}\n";
 
-   GlShaderId FSid = gla_createShader(FRAGMENT_SHADER, &FSSrc, 1);
-
-   GlProgId ShProgId = gla_linkProgram(VSid, FSid);
-
-   GlTexId textureId = gla_createTexture(VEC4_I32, 5, 5, data);
-
-   GlFramebufferId framebufferId = gla_createFramebuffer(textureId);
-
-   float vertices[] = {
-       1.0f,  1.0f, 0.0f,
-      -1.0f,  1.0f, 0.0f,
-       0.0f, -1.0f, 0.0f
-   };
-
-   int indices[] = {
-      0, 1, 2
-   };
-
-   GlBuffId vertexBuffer = gla_createBuffer(
-      VERTEX_BUFFER, vertices, sizeof(vertices)
-   );
-   GlBuffId indexBuffer = gla_createBuffer(
-      INDEX_BUFFER, indices, sizeof(indices)
-   );
-
-   //GLuint vao;
-   //GLC(glGenVertexArrays(1, &vao));
-   //GLC(glBindVertexArray(vao));
-
-   gla_bindBuffer(VERTEX_BUFFER, vertexBuffer);
-   gla_bindBuffer(INDEX_BUFFER, indexBuffer);
-
-   GLC(glEnableVertexAttribArray(0));
-   GLC(glVertexAttribPointer(
-      0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0
-   ));
-
-   GLC(glViewport(0, 0, 5, 5));
-
-   gla_bindFramebuffer(framebufferId);
-   gla_bindProgram(ShProgId);
-   //GLC(glBindVertexArray(vao));
-
-   GLC(glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0));
+   GputKernel* kernel = gput_createKernel(kernelSrc, NULL, 0);
+   GputArray* array = gput_createArray(VEC4_I32, 5, 5, data);
 
-   GLenum readFormat, readType;
-   GLC(glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &readFormat));
-   GLC(glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &readType));
-
-   GLC(glReadPixels(0, 0, 5, 5, readFormat, readType, data));
+   gput_runKernel(kernel, NULL, 0, array);
+   gput_downloadArray(array, data);
 
    putchar('\n');
    for (int i = 0; i < 5; i++) {
@@ -207,30 +151,87 @@ void gput_test()
    }
    putchar('\n');
 
-   GPUT_LOG_INFO("%-10s%-10s", "macros", "returned");
-   GPUT_LOG_INFO("%-10p%-10p", GL_RGBA_INTEGER, readFormat);
-   GPUT_LOG_INFO("%-10p%-10p", GL_INT, readType);
+   gput_deleteArray(array);
+   gput_deleteKernel(kernel);
+}
+
+int gput_getDevicesCount()
+{
+   return gpctx_getDevicesCount();
+}
+
+GputDevice* gput_getDevice(int deviceIndex)
+{
+   return gpctx_getDevice(deviceIndex);
+}
+
+const char* gput_getDeviceName(const GputDevice* device)
+{
+   return gpctx_getDeviceName(device);
+}
+
+bool gput_isSoftwareDevice(const GputDevice* device)
+{
+   return gpctx_isSoftwareDevice(device);
+}
 
-   gla_deleteShader(VSid);
-   gla_deleteShader(FSid);
-   gla_deleteProgram(ShProgId);
-   gla_deleteFramebuffer(framebufferId);
-   gla_deleteTexture(textureId);
+bool gput_setDevice(GputDevice* device)
+{
+   return gpctx_setDevice(device);
+}
+
+GputDevice* gput_getCurrentDevice()
+{
+   return gpctx_getCurrentDevice();
+}
+
+bool gput_attachThread()
+{
+   return gpctx_attachThread();
+}
+
+void gput_detachThread()
+{
+   gpp_flushThread();
+   gpk_releaseThread();
+   gpctx_detachThread();
 }
 
 bool gput_terminate()
 {
-   bool returnVal;
+   if (gpuInitialized) {
+      gpq_stop();
+
+      gpe_terminate();
+
+      gpp_terminate();
+   }
 
-   returnVal = eglDestroyContext(eglDisplay, coreContext);
-   GPUT_ASSERT(returnVal, "Could not destroy core context");
+   // Written while the devices can still be named
+   gptr_terminate();
 
-   returnVal = eglTerminate(eglDisplay);
-   GPUT_ASSERT(returnVal, "Failed to terminate EGL");
+   if (gpuInitialized) {
+      gpd_terminate();
+
+      gpo_terminate();
+
+      gpk_terminate();
+
+      glpc_terminate();
+
+      // Whatever is left was not deleted by the application
+      gpm_terminate();
+
+      gpctx_terminate();
+
+      gpgl_terminate();
+
+      gpuInitialized = false;
+   }
 
-   gbm_device_destroy(gbmDevice);
+   gpcpu_terminate();
 
-   close(driDevice);
+   GPUT_LOG_TERMINATE();
 
    return true;
 }
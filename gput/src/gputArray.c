@@ -0,0 +1,572 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputArray.h"
+#include "gputDebug.h"
+#include "gputProfile.h"
+#include "gputTrace.h"
+
+static size_t memoryBudget;
+static bool budgetSelected;
+
+static pthread_mutex_t residencyMutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t residentBytes[GPCTX_MAX_DEVICES];
+static GputArray* leastRecentlyUsed[GPCTX_MAX_DEVICES];
+static GputArray* mostRecentlyUsed[GPCTX_MAX_DEVICES];
+
+static pthread_mutex_t fenceMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t framebuffersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+size_t gpa_getSize(const GputArray* array)
+{
+   return (size_t) array->width * array->height
+      * gla_getDataTypeSize(array->dataType);
+}
+
+void gput_setMemoryBudget(size_t bytes)
+{
+   pthread_mutex_lock(&residencyMutex);
+   memoryBudget = bytes;
+   budgetSelected = true;
+   pthread_mutex_unlock(&residencyMutex);
+}
+
+void gpa_init()
+{
+   const char* value = getenv("GPUT_MEMORY_BUDGET");
+   if (budgetSelected || value == NULL) {
+      return;
+   }
+
+   char* suffix;
+   double bytes = strtod(value, &suffix);
+   switch (*suffix) {
+      case 'G': case 'g':
+         bytes *= 1024;
+         // fallthrough
+      case 'M': case 'm':
+         bytes *= 1024;
+         // fallthrough
+      case 'K': case 'k':
+         bytes *= 1024;
+         break;
+   }
+   if (bytes < 0 || suffix == value) {
+      GPUT_LOG_WARN("Invalid GPUT_MEMORY_BUDGET %s", value);
+      return;
+   }
+   memoryBudget = (size_t) bytes;
+}
+
+// Must be called with residencyMutex locked
+static void linkResident(GputArray* array)
+{
+   int deviceIndex = gpctx_getDeviceIndex(array->device);
+   array->lruPrev = mostRecentlyUsed[deviceIndex];
+   array->lruNext = NULL;
+   if (array->lruPrev != NULL) {
+      array->lruPrev->lruNext = array;
+   }
+   else {
+      leastRecentlyUsed[deviceIndex] = array;
+   }
+   mostRecentlyUsed[deviceIndex] = array;
+   array->linked = true;
+}
+
+// Must be called with residencyMutex locked. Arrays taken as victims are
+// not linked anymore.
+static void unlinkResident(GputArray* array)
+{
+   if (!array->linked) {
+      return;
+   }
+
+   int deviceIndex = gpctx_getDeviceIndex(array->device);
+   if (array->lruPrev != NULL) {
+      array->lruPrev->lruNext = array->lruNext;
+   }
+   else {
+      leastRecentlyUsed[deviceIndex] = array->lruNext;
+   }
+   if (array->lruNext != NULL) {
+      array->lruNext->lruPrev = array->lruPrev;
+   }
+   else {
+      mostRecentlyUsed[deviceIndex] = array->lruPrev;
+   }
+   array->lruPrev = NULL;
+   array->lruNext = NULL;
+   array->linked = false;
+}
+
+static bool isKept(const GputArray* array, GputArray* kept[], int keptCount)
+{
+   for (int i = 0; i < keptCount; i++) {
+      if (kept[i] == array) {
+         return true;
+      }
+   }
+   return false;
+}
+
+// Must be called with residencyMutex locked. The victim is unlinked so that
+// no other thread picks it while it is read back.
+static GputArray* takeVictim(
+   int deviceIndex, GputArray* kept[], int keptCount
+){
+   unsigned contextId = gpctx_getCurrentId();
+   for (GputArray* array = leastRecentlyUsed[deviceIndex]; array != NULL;
+      array = array->lruNext
+   ){
+      if (array->useContextId == contextId
+         && array->pinCount == 0
+         && gpa_isRenderable(array)
+         && !isKept(array, kept, keptCount)
+      ){
+         unlinkResident(array);
+         residentBytes[deviceIndex] -= gpa_getSize(array);
+         return array;
+      }
+   }
+   return NULL;
+}
+
+// Those of other contexts are deleted once these are current again
+static void deleteFramebuffers(GputArray* array)
+{
+   pthread_mutex_lock(&framebuffersMutex);
+   for (int i = 0; i < array->framebuffersCount; i++) {
+      gpctx_deleteFramebuffer(
+         array->framebufferContextIds[i], array->framebuffers[i]
+      );
+   }
+   array->framebuffersCount = 0;
+   pthread_mutex_unlock(&framebuffersMutex);
+}
+
+static bool evict(GputArray* array)
+{
+   void* data = malloc(gpa_getSize(array));
+   if (data == NULL) {
+      return false;
+   }
+
+   double traceStart = gptr_begin();
+   gpa_waitWrites(array);
+   gla_bindFramebuffer(gpa_getFramebuffer(array));
+   gla_readFramebuffer(
+      array->dataType, 0, 0, array->width, array->height, data
+   );
+
+   deleteFramebuffers(array);
+   pthread_mutex_lock(&fenceMutex);
+   if (array->writeFence != NULL) {
+      gla_deleteFence(array->writeFence);
+      array->writeFence = NULL;
+   }
+   array->writeContextId = 0;
+   pthread_mutex_unlock(&fenceMutex);
+   gla_deleteTexture(array->texture);
+   array->texture = 0;
+   array->hostData = data;
+   array->evicted = true;
+   gptr_end("evict", traceStart);
+   return true;
+}
+
+// Evicts least recently used arrays of the current device until bytes more
+// fit in the budget, or nothing else can be evicted
+static void makeRoom(size_t bytes, GputArray* kept[], int keptCount)
+{
+   int deviceIndex = gpctx_getCurrentDeviceIndex();
+   for (;;) {
+      pthread_mutex_lock(&residencyMutex);
+      if (memoryBudget == 0
+         || residentBytes[deviceIndex] + bytes <= memoryBudget
+      ){
+         pthread_mutex_unlock(&residencyMutex);
+         return;
+      }
+      GputArray* victim = takeVictim(deviceIndex, kept, keptCount);
+      pthread_mutex_unlock(&residencyMutex);
+
+      if (victim == NULL) {
+         GPUT_LOG_DEBUG("Memory budget of %zu bytes exceeded", memoryBudget);
+         return;
+      }
+      if (!evict(victim)) {
+         GPUT_LOG_ERROR("Could not allocate memory to evict an array");
+         pthread_mutex_lock(&residencyMutex);
+         linkResident(victim);
+         residentBytes[deviceIndex] += gpa_getSize(victim);
+         pthread_mutex_unlock(&residencyMutex);
+         return;
+      }
+      GPUT_LOG_TRACE("Evicted a %dx%d array", victim->width, victim->height);
+   }
+}
+
+static void addResident(GputArray* array)
+{
+   pthread_mutex_lock(&residencyMutex);
+   linkResident(array);
+   residentBytes[gpctx_getDeviceIndex(array->device)] += gpa_getSize(array);
+   array->useContextId = gpctx_getCurrentId();
+   pthread_mutex_unlock(&residencyMutex);
+}
+
+static void restore(GputArray* array)
+{
+   double traceStart = gptr_begin();
+   array->texture = gla_createTexture(
+      array->dataType, array->width, array->height, array->hostData
+   );
+   free(array->hostData);
+   array->hostData = NULL;
+   array->evicted = false;
+   addResident(array);
+   gpa_markWritten(array);
+   gptr_end("restore", traceStart);
+}
+
+void gpa_makeResident(GputArray* arrays[], int arraysCount)
+{
+   size_t evictedBytes = 0;
+   for (int i = 0; i < arraysCount; i++) {
+      if (arrays[i]->evicted && !isKept(arrays[i], arrays, i)) {
+         evictedBytes += gpa_getSize(arrays[i]);
+      }
+   }
+   if (evictedBytes == 0 && memoryBudget == 0) {
+      return;
+   }
+
+   makeRoom(evictedBytes, arrays, arraysCount);
+   for (int i = 0; i < arraysCount; i++) {
+      if (arrays[i]->evicted) {
+         restore(arrays[i]);
+      }
+   }
+
+   // Least recently used first, so the operation's own arrays stay
+   pthread_mutex_lock(&residencyMutex);
+   unsigned contextId = gpctx_getCurrentId();
+   for (int i = 0; i < arraysCount; i++) {
+      if (arrays[i]->linked) {
+         unlinkResident(arrays[i]);
+         linkResident(arrays[i]);
+      }
+      arrays[i]->useContextId = contextId;
+   }
+   pthread_mutex_unlock(&residencyMutex);
+}
+
+GputArray* gput_createArrayOnBackend(
+   GputBackend backend,
+   GlDataType dataType, int width, int height, const void* data
+){
+   GputArray* array = calloc(1, sizeof(GputArray));
+   GPUT_ASSERT(array != NULL, "Could not allocate array");
+   if (array == NULL) {
+      return NULL;
+   }
+
+   array->backend = backend;
+   array->dataType = dataType;
+   array->width = width;
+   array->height = height;
+
+   if (backend == GPUT_BACKEND_CPU) {
+      array->hostData = malloc(gpa_getSize(array));
+      GPUT_ASSERT(array->hostData != NULL, "Could not allocate array data");
+      if (array->hostData == NULL) {
+         free(array);
+         return NULL;
+      }
+      if (data != NULL) {
+         memcpy(array->hostData, data, gpa_getSize(array));
+      }
+      return array;
+   }
+
+   array->device = gpctx_getCurrentDevice();
+   if (array->device == NULL) {
+      GPUT_LOG_ERROR("GPU backend is not available");
+      free(array);
+      return NULL;
+   }
+   makeRoom(gpa_getSize(array), NULL, 0);
+   array->texture = gla_createTexture(dataType, width, height, data);
+   array->framebuffersCount = 0;
+   array->shared = false;
+   array->writeFence = NULL;
+   array->writeContextId = 0;
+   array->fenceWaitersCount = 0;
+   addResident(array);
+   gpa_markWritten(array);
+   return array;
+}
+
+GputArray* gput_createArray(
+   GlDataType dataType, int width, int height, const void* data
+){
+   return gput_createArrayOnBackend(
+      gput_getBackend(), dataType, width, height, data
+   );
+}
+
+void gput_uploadArray(GputArray* array, const void* data)
+{
+   if (array->backend == GPUT_BACKEND_CPU) {
+      memcpy(array->hostData, data, gpa_getSize(array));
+      return;
+   }
+
+   gpa_uploadRows(array, 0, array->height, data);
+}
+
+void gpa_uploadRows(
+   GputArray* array, int firstRow, int rowsCount, const void* data
+){
+   GPUT_ASSERT(array->device == gpctx_getCurrentDevice(),
+      "Array used while another device is selected"
+   );
+   double traceStart = gptr_begin();
+   gpa_makeResident(&array, 1);
+   gpa_waitWrites(array);
+   GppScope* scope = gpp_begin("upload");
+   gla_updateTexture(array->texture, array->dataType,
+      0, firstRow, array->width, rowsCount, data
+   );
+   gpp_end(scope);
+   gpa_markWritten(array);
+   gptr_end("upload", traceStart);
+}
+
+static bool hasWaited(const GputArray* array, unsigned contextId)
+{
+   for (int i = 0; i < array->fenceWaitersCount; i++) {
+      if (array->fenceWaiters[i] == contextId) {
+         return true;
+      }
+   }
+   return false;
+}
+
+void gpa_pin(GputArray* array)
+{
+   pthread_mutex_lock(&residencyMutex);
+   array->pinCount++;
+   pthread_mutex_unlock(&residencyMutex);
+}
+
+void gpa_unpin(GputArray* array)
+{
+   pthread_mutex_lock(&residencyMutex);
+   GPUT_ASSERT(array->pinCount > 0, "Array unpinned more than pinned");
+   array->pinCount--;
+   pthread_mutex_unlock(&residencyMutex);
+}
+
+void gpa_waitWrites(GputArray* array)
+{
+   unsigned contextId = gpctx_getCurrentId();
+   pthread_mutex_lock(&fenceMutex);
+   if (array->writeContextId != contextId) {
+      // Later writes must be fenced for this context to see them
+      array->shared = true;
+   }
+   if (array->writeFence == NULL
+      || array->writeContextId == contextId
+      || hasWaited(array, contextId)
+   ){
+      pthread_mutex_unlock(&fenceMutex);
+      return;
+   }
+
+   // Waiting on the GPU keeps the calling thread free, and the texture may
+   // have been respecified so any cached binding of it is stale. The fence
+   // stays for the other contexts the array is handed over to.
+   gla_waitFenceOnGpu(array->writeFence);
+   gla_invalidateTextureBinding(array->texture);
+   if (array->fenceWaitersCount < GPA_MAX_FENCE_WAITERS) {
+      array->fenceWaiters[array->fenceWaitersCount++] = contextId;
+   }
+   pthread_mutex_unlock(&fenceMutex);
+}
+
+// Must be called with fenceMutex locked
+static void fenceWrites(GputArray* array)
+{
+   if (array->writeFence != NULL) {
+      gla_deleteFence(array->writeFence);
+   }
+   array->writeFence = gla_createFence();
+   array->fenceWaitersCount = 0;
+}
+
+void gpa_markWritten(GputArray* array)
+{
+   // Writes of other threads are handed back to the core one, while arrays
+   // only the core thread uses need no fence
+   pthread_mutex_lock(&fenceMutex);
+   array->writeContextId = gpctx_getCurrentId();
+   if (array->shared || !gpctx_isCoreCurrent()) {
+      fenceWrites(array);
+   }
+   else if (array->writeFence != NULL) {
+      gla_deleteFence(array->writeFence);
+      array->writeFence = NULL;
+   }
+   pthread_mutex_unlock(&fenceMutex);
+}
+
+void gpa_publishWrites(GputArray* array)
+{
+   if (array->backend == GPUT_BACKEND_CPU) {
+      return;
+   }
+
+   pthread_mutex_lock(&fenceMutex);
+   array->shared = true;
+   if (array->writeFence == NULL
+      && array->writeContextId == gpctx_getCurrentId()
+   ){
+      fenceWrites(array);
+   }
+   pthread_mutex_unlock(&fenceMutex);
+}
+
+bool gpa_isRenderable(const GputArray* array)
+{
+   return gla_getDataTypeComponents(array->dataType) != 3;
+}
+
+GlFramebufferId gpa_getFramebuffer(GputArray* array)
+{
+   gpctx_deleteOrphanFramebuffers();
+
+   unsigned contextId = gpctx_getCurrentId();
+   pthread_mutex_lock(&framebuffersMutex);
+   for (int i = 0; i < array->framebuffersCount; i++) {
+      if (array->framebufferContextIds[i] == contextId) {
+         GlFramebufferId framebuffer = array->framebuffers[i];
+         pthread_mutex_unlock(&framebuffersMutex);
+         return framebuffer;
+      }
+   }
+
+   // Only arrays used as kernel outputs or read back need a framebuffer.
+   // Past the limit the oldest one goes, it's recreated if used again.
+   if (array->framebuffersCount == GPA_MAX_FRAMEBUFFERS) {
+      gpctx_deleteFramebuffer(
+         array->framebufferContextIds[0], array->framebuffers[0]
+      );
+      array->framebuffersCount--;
+      memmove(array->framebuffers, array->framebuffers + 1,
+         array->framebuffersCount * sizeof(GlFramebufferId)
+      );
+      memmove(array->framebufferContextIds, array->framebufferContextIds + 1,
+         array->framebuffersCount * sizeof(unsigned)
+      );
+   }
+   GlFramebufferId framebuffer = gla_createFramebuffer(array->texture);
+   array->framebuffers[array->framebuffersCount] = framebuffer;
+   array->framebufferContextIds[array->framebuffersCount] = contextId;
+   array->framebuffersCount++;
+   pthread_mutex_unlock(&framebuffersMutex);
+   return framebuffer;
+}
+
+void gpa_downloadRows(
+   GputArray* array, int firstRow, int rowsCount, void* data
+){
+   GPUT_ASSERT(array->device == gpctx_getCurrentDevice(),
+      "Array used while another device is selected"
+   );
+   if (!gpa_isRenderable(array)) {
+      GPUT_LOG_ERROR("Three component arrays can't be downloaded");
+      return;
+   }
+   double traceStart = gptr_begin();
+   gpa_makeResident(&array, 1);
+   gpa_waitWrites(array);
+   gla_bindFramebuffer(gpa_getFramebuffer(array));
+   GppScope* scope = gpp_begin("download");
+   gla_readFramebuffer(
+      array->dataType, 0, firstRow, array->width, rowsCount, data
+   );
+   gpp_end(scope);
+   gptr_end("download", traceStart);
+}
+
+void gput_downloadArray(GputArray* array, void* data)
+{
+   if (array->backend == GPUT_BACKEND_CPU) {
+      memcpy(data, array->hostData, gpa_getSize(array));
+      return;
+   }
+   gpa_downloadRows(array, 0, array->height, data);
+}
+
+void gput_deleteArray(GputArray* array)
+{
+   if (array->backend == GPUT_BACKEND_CPU) {
+      free(array->hostData);
+      free(array);
+      return;
+   }
+
+   GPUT_ASSERT(array->device == gpctx_getCurrentDevice(),
+      "Array used while another device is selected"
+   );
+   if (array->evicted) {
+      free(array->hostData);
+      free(array);
+      return;
+   }
+
+   GPUT_ASSERT(array->pinCount == 0,
+      "Array deleted with queued commands or downloads pending"
+   );
+   pthread_mutex_lock(&residencyMutex);
+   if (array->linked) {
+      unlinkResident(array);
+      residentBytes[gpctx_getDeviceIndex(array->device)] -=
+         gpa_getSize(array);
+   }
+   pthread_mutex_unlock(&residencyMutex);
+
+   deleteFramebuffers(array);
+   if (array->writeFence != NULL) {
+      gla_deleteFence(array->writeFence);
+   }
+   gla_deleteTexture(array->texture);
+   free(array);
+}
@@ -0,0 +1,110 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "gput.h"
+#include "gputContext.h"
+#include "GlAbstract.h"
+
+#define GPA_MAX_FENCE_WAITERS 4
+#define GPA_MAX_FRAMEBUFFERS 4
+
+struct GputArray {
+   GputBackend backend;
+   GputDevice* device;
+   GlDataType dataType;
+   int width;
+   int height;
+   // Storage of CPU backend arrays, the GPU objects below are unused, and of
+   // GPU arrays evicted from the device to keep within the memory budget
+   void* hostData;
+   bool evicted;
+   GlTexId texture;
+   // Framebuffers are container objects that can't be shared, so each
+   // context rendering into the array or reading it back has its own
+   GlFramebufferId framebuffers[GPA_MAX_FRAMEBUFFERS];
+   unsigned framebufferContextIds[GPA_MAX_FRAMEBUFFERS];
+   int framebuffersCount;
+   // Set after the last write once the array is shared between contexts, so
+   // that each context the array is handed over to waits once for the write
+   // to land. Guarded by a lock since several contexts may wait at once.
+   bool shared;
+   GlFence writeFence;
+   unsigned writeContextId;
+   unsigned fenceWaiters[GPA_MAX_FENCE_WAITERS];
+   int fenceWaitersCount;
+   // Resident arrays of a device, from least to most recently used
+   GputArray* lruPrev;
+   GputArray* lruNext;
+   bool linked;
+   // Context of the last use, evictions never touch arrays another thread
+   // may be using
+   unsigned useContextId;
+   // Count of queued commands and pending downloads using the array, which
+   // keep it from being evicted
+   int pinCount;
+};
+
+// Reads GPUT_MEMORY_BUDGET unless the budget was set from the API
+void gpa_init();
+
+size_t gpa_getSize(const GputArray* array);
+
+// Three component formats are not color renderable, so those arrays can't be
+// kernel outputs nor be read back
+bool gpa_isRenderable(const GputArray* array);
+
+// Framebuffer of the array for the current context
+GlFramebufferId gpa_getFramebuffer(GputArray* array);
+
+// Writes rowsCount rows starting at firstRow from data
+void gpa_uploadRows(
+   GputArray* array, int firstRow, int rowsCount, const void* data
+);
+
+// Reads rowsCount rows starting at firstRow into data
+void gpa_downloadRows(
+   GputArray* array, int firstRow, int rowsCount, void* data
+);
+
+// Must be called before any access to the arrays of an operation. Uploads
+// the evicted ones again, evicting others if needed to stay within the
+// budget, and marks them as the most recently used.
+void gpa_makeResident(GputArray* arrays[], int arraysCount);
+
+// Keeps the array resident until unpinned, for work that is handed over to
+// another thread before it uses the array
+void gpa_pin(GputArray* array);
+
+void gpa_unpin(GputArray* array);
+
+// Must be called before any access to the array from the current context
+void gpa_waitWrites(GputArray* array);
+
+// Must be called after commands writing to the array have been issued
+void gpa_markWritten(GputArray* array);
+
+// Must be called before handing the array over to another context, fences
+// the last write if it was not yet
+void gpa_publishWrites(GputArray* array);
@@ -0,0 +1,799 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glad/glad.h"
+
+#include <fcntl.h>
+#include <gbm.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputMemory.h"
+#include "GlAbstract.h"
+
+#define DEVICE_NAME_SIZE 64
+
+typedef struct gbm_device GbmDevice;
+typedef int DriDeviceFD;
+
+static const char* driDirPath = "/dev/dri";
+
+struct GputContext {
+   // Unlike addresses, ids are never reused by a later context
+   unsigned id;
+   GputDevice* device;
+   EGLContext eglContext;
+   GlState* glState;
+   GlVertexArrayId fullscreenVertexArray;
+   bool initialized;
+   // Framebuffers are not shared, so the ones other threads delete wait for
+   // the context to be current again
+   GlFramebufferId* orphanFramebuffers;
+   atomic_int orphanFramebuffersCount;
+   int orphanFramebuffersCapacity;
+   GputContext* nextLive;
+};
+
+// Devices come from EGL_EXT_device_enumeration when available, which also
+// exposes Mesa's software rasterizer, otherwise from the DRM render nodes
+// opened through GBM. Displays and contexts are only created on first use.
+struct GputDevice {
+   char name[DEVICE_NAME_SIZE];
+   bool software;
+   EGLenum platform;
+   void* nativeDisplay;
+
+   DriDeviceFD driDevice;
+   GbmDevice* gbmDevice;
+   EGLDisplay eglDisplay;
+   EGLConfig eglConfig;
+
+   // Every thread using the library has its own context per device, all of
+   // them sharing objects with the core context owned by the gput_init thread
+   GputContext coreContext;
+   bool initialized;
+
+   // glad only records the extensions of the context current when it loaded
+   // the entry points, so they are queried again for each device
+   bool extensionsQueried;
+   bool parallelShaderCompile;
+   bool debugOutput;
+};
+
+static GputDevice devices[GPCTX_MAX_DEVICES];
+static int devicesCount;
+static int defaultDeviceIndex;
+static pthread_mutex_t devicesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+static bool glLoaded;
+
+static _Thread_local GputContext* currentContext;
+static _Thread_local bool isCoreThread;
+static _Thread_local GputContext* threadContexts[GPCTX_MAX_DEVICES];
+
+static pthread_mutex_t contextsMutex = PTHREAD_MUTEX_INITIALIZER;
+static GputContext* liveContexts;
+static atomic_uint contextsCreated;
+
+static const EGLint contextAttribs[] = {
+   EGL_CONTEXT_CLIENT_VERSION, 3,
+   EGL_NONE
+};
+
+static void registerContext(GputContext* context)
+{
+   context->id = atomic_fetch_add(&contextsCreated, 1) + 1;
+   pthread_mutex_lock(&contextsMutex);
+   context->nextLive = liveContexts;
+   liveContexts = context;
+   pthread_mutex_unlock(&contextsMutex);
+}
+
+// The orphan framebuffers of the context die with it
+static void unregisterContext(GputContext* context)
+{
+   pthread_mutex_lock(&contextsMutex);
+   GputContext** link = &liveContexts;
+   while (*link != NULL && *link != context) {
+      link = &(*link)->nextLive;
+   }
+   if (*link != NULL) {
+      *link = context->nextLive;
+   }
+   free(context->orphanFramebuffers);
+   context->orphanFramebuffers = NULL;
+   atomic_store(&context->orphanFramebuffersCount, 0);
+   context->orphanFramebuffersCapacity = 0;
+   pthread_mutex_unlock(&contextsMutex);
+}
+
+static void addDevice(
+   const char* name, bool software, EGLenum platform, void* nativeDisplay
+){
+   if (devicesCount == GPCTX_MAX_DEVICES) {
+      GPUT_LOG_WARN("Ignoring device %s, at most %d devices are supported",
+         name, GPCTX_MAX_DEVICES
+      );
+      return;
+   }
+
+   GputDevice* device = &devices[devicesCount++];
+   memset(device, 0, sizeof(GputDevice));
+   snprintf(device->name, DEVICE_NAME_SIZE, "%s", name);
+   device->software = software;
+   device->platform = platform;
+   device->nativeDisplay = nativeDisplay;
+   device->driDevice = -1;
+
+   GPUT_LOG_INFO("Found device %d: %s%s",
+      devicesCount - 1, device->name, software ? " (software)" : ""
+   );
+}
+
+static void enumerateEglDevices(const char* clientExtensions)
+{
+   if (!strstr(clientExtensions, "EGL_EXT_device_enumeration")
+      || !strstr(clientExtensions, "EGL_EXT_platform_device")
+   ){
+      return;
+   }
+
+   PFNEGLQUERYDEVICESEXTPROC queryDevices =
+      (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+   PFNEGLQUERYDEVICESTRINGEXTPROC queryDeviceString =
+      (PFNEGLQUERYDEVICESTRINGEXTPROC)
+      eglGetProcAddress("eglQueryDeviceStringEXT");
+
+   EGLDeviceEXT eglDevices[GPCTX_MAX_DEVICES];
+   EGLint eglDevicesCount = 0;
+   if (queryDevices == NULL || queryDeviceString == NULL
+      || !queryDevices(GPCTX_MAX_DEVICES, eglDevices, &eglDevicesCount)
+   ){
+      return;
+   }
+
+   for (int i = 0; i < eglDevicesCount; i++) {
+      const char* extensions = queryDeviceString(
+         eglDevices[i], EGL_EXTENSIONS
+      );
+      if (extensions == NULL) {
+         extensions = "";
+      }
+
+      const char* name = NULL;
+      bool software = strstr(extensions, "EGL_MESA_device_software");
+      if (strstr(extensions, "EGL_EXT_device_drm_render_node")) {
+         name = queryDeviceString(
+            eglDevices[i], EGL_DRM_RENDER_NODE_FILE_EXT
+         );
+      }
+      else if (strstr(extensions, "EGL_EXT_device_drm")) {
+         name = queryDeviceString(
+            eglDevices[i], EGL_DRM_DEVICE_FILE_EXT
+         );
+      }
+      if (name == NULL) {
+         name = software ? "software" : "unknown";
+      }
+
+      addDevice(name, software, EGL_PLATFORM_DEVICE_EXT, eglDevices[i]);
+   }
+}
+
+static int isRenderNode(const struct dirent* entry)
+{
+   return strncmp(entry->d_name, "renderD", 7) == 0;
+}
+
+static void enumerateRenderNodes()
+{
+   struct dirent** entries;
+   int entriesCount = scandir(driDirPath, &entries, isRenderNode, alphasort);
+   if (entriesCount < 0) {
+      return;
+   }
+
+   for (int i = 0; i < entriesCount; i++) {
+      char path[DEVICE_NAME_SIZE];
+      snprintf(path, DEVICE_NAME_SIZE, "%s/%s",
+         driDirPath, entries[i]->d_name
+      );
+      addDevice(path, false, EGL_PLATFORM_GBM_KHR, NULL);
+      free(entries[i]);
+   }
+   free(entries);
+}
+
+static int findDefaultDevice()
+{
+   // GPUT_DEVICE holds either a device index or part of a device name
+   const char* requested = getenv("GPUT_DEVICE");
+   if (requested != NULL && requested[0] != '\0') {
+      char* end;
+      long index = strtol(requested, &end, 10);
+      if (*end == '\0' && index >= 0 && index < devicesCount) {
+         return index;
+      }
+      for (int i = 0; i < devicesCount; i++) {
+         if (strstr(devices[i].name, requested)) {
+            return i;
+         }
+      }
+      GPUT_LOG_WARN("GPUT_DEVICE=%s matches no device", requested);
+   }
+
+   for (int i = 0; i < devicesCount; i++) {
+      if (!devices[i].software) {
+         return i;
+      }
+   }
+   return 0;
+}
+
+// Closes what initDevice opened before creating the display
+static void releaseNativeDisplay(GputDevice* device)
+{
+   if (device->gbmDevice != NULL) {
+      gbm_device_destroy(device->gbmDevice);
+      device->gbmDevice = NULL;
+   }
+   if (device->driDevice != -1) {
+      close(device->driDevice);
+      device->driDevice = -1;
+   }
+}
+
+// Undoes a successful eglInitialize and what came before it
+static void releaseDisplay(GputDevice* device)
+{
+   eglTerminate(device->eglDisplay);
+   releaseNativeDisplay(device);
+}
+
+static bool initDevice(GputDevice* device)
+{
+   void* nativeDisplay = device->nativeDisplay;
+
+   if (device->platform == EGL_PLATFORM_GBM_KHR) {
+      // Missing permissions or drivers are not programming errors, callers
+      // fall back to another backend
+      device->driDevice = open(device->name, O_RDWR);
+      if (device->driDevice == -1) {
+         GPUT_LOG_ERROR("Could not open dri device %s", device->name);
+         return false;
+      }
+
+      device->gbmDevice = gbm_create_device(device->driDevice);
+      if (device->gbmDevice == NULL) {
+         GPUT_LOG_ERROR("Could not get a GBM device");
+         close(device->driDevice);
+         device->driDevice = -1;
+         return false;
+      }
+      nativeDisplay = device->gbmDevice;
+   }
+
+   device->eglDisplay = getPlatformDisplay
+      ? getPlatformDisplay(device->platform, nativeDisplay, NULL)
+      : eglGetDisplay(nativeDisplay);
+   EGLint major, minor;
+   if (device->eglDisplay == EGL_NO_DISPLAY
+      || !eglInitialize(device->eglDisplay, &major, &minor)
+   ){
+      GPUT_LOG_ERROR("Failed to initialize EGL on %s", device->name);
+      releaseNativeDisplay(device);
+      return false;
+   }
+
+   GPUT_LOG_INFO("EGL version of %s: %s",
+      device->name, eglQueryString(device->eglDisplay, EGL_VERSION)
+   );
+
+   const char* eglExtensions = eglQueryString(
+      device->eglDisplay, EGL_EXTENSIONS
+   );
+   GPUT_LOG_TRACE("EGL extentions: %s", eglExtensions);
+
+   if (eglExtensions == NULL
+      || !strstr(eglExtensions, "EGL_KHR_create_context")
+      || !strstr(eglExtensions, "EGL_KHR_surfaceless_context")
+   ){
+      GPUT_LOG_ERROR("%s lacks EGL_KHR_create_context or "
+         "EGL_KHR_surfaceless_context", device->name
+      );
+      releaseDisplay(device);
+      return false;
+   }
+
+   // Contexts are only made current without surfaces, while the default
+   // surface type would require window support the device and surfaceless
+   // platforms lack
+   const EGLint eglConfigAttribs[] = {
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+      EGL_SURFACE_TYPE, 0,
+      EGL_NONE
+   };
+
+   EGLint eglConfigCount;
+
+   if (!eglChooseConfig(device->eglDisplay,
+         eglConfigAttribs, &device->eglConfig, 1, &eglConfigCount
+      )
+      || eglConfigCount == 0
+   ){
+      GPUT_LOG_ERROR("Failed to configure EGL on %s", device->name);
+      releaseDisplay(device);
+      return false;
+   }
+
+   if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+      GPUT_LOG_ERROR("Failed to bind OpenGL API to EGL");
+      releaseDisplay(device);
+      return false;
+   }
+
+   device->coreContext.device = device;
+   device->coreContext.eglContext = eglCreateContext(
+      device->eglDisplay, device->eglConfig, EGL_NO_CONTEXT, contextAttribs
+   );
+   if (device->coreContext.eglContext == EGL_NO_CONTEXT) {
+      GPUT_LOG_ERROR("Could not create OpenGL context on %s", device->name);
+      releaseDisplay(device);
+      return false;
+   }
+   registerContext(&device->coreContext);
+   device->coreContext.glState = gla_createStateCache(
+      gpctx_getDeviceIndex(device), device->coreContext.id
+   );
+   device->coreContext.initialized = false;
+
+   device->initialized = true;
+   return true;
+}
+
+static bool ensureDeviceInitialized(GputDevice* device)
+{
+   pthread_mutex_lock(&devicesMutex);
+   bool initialized = device->initialized || initDevice(device);
+   pthread_mutex_unlock(&devicesMutex);
+   return initialized;
+}
+
+bool gpctx_init()
+{
+   // Client extensions are queried without a display
+   const char* clientExtensions = eglQueryString(
+      EGL_NO_DISPLAY, EGL_EXTENSIONS
+   );
+   if (clientExtensions == NULL) {
+      clientExtensions = "";
+   }
+   if (strstr(clientExtensions, "EGL_EXT_platform_base")) {
+      getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+         eglGetProcAddress("eglGetPlatformDisplayEXT");
+   }
+
+   devicesCount = 0;
+   if (getPlatformDisplay != NULL) {
+      enumerateEglDevices(clientExtensions);
+   }
+   if (devicesCount == 0) {
+      enumerateRenderNodes();
+   }
+
+   // Machines without any GPU can still run on Mesa's software rasterizer
+   if (devicesCount == 0 && getPlatformDisplay != NULL
+      && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")
+   ){
+      addDevice("surfaceless", true,
+         EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY
+      );
+   }
+
+   if (devicesCount == 0) {
+      GPUT_LOG_ERROR("No device found");
+      return false;
+   }
+
+   defaultDeviceIndex = findDefaultDevice();
+   GPUT_LOG_INFO("Default device: %s", devices[defaultDeviceIndex].name);
+
+   isCoreThread = true;
+   return gpctx_setDevice(&devices[defaultDeviceIndex]);
+}
+
+int gpctx_getDevicesCount()
+{
+   return devicesCount;
+}
+
+GputDevice* gpctx_getDevice(int deviceIndex)
+{
+   if (deviceIndex < 0 || deviceIndex >= devicesCount) {
+      GPUT_LOG_ERROR("Device index %d out of range", deviceIndex);
+      return NULL;
+   }
+   return &devices[deviceIndex];
+}
+
+int gpctx_getDeviceIndex(const GputDevice* device)
+{
+   return (int) (device - devices);
+}
+
+const char* gpctx_getDeviceName(const GputDevice* device)
+{
+   return device->name;
+}
+
+bool gpctx_isSoftwareDevice(const GputDevice* device)
+{
+   return device->software;
+}
+
+bool gpctx_hasParallelShaderCompile()
+{
+   return currentContext != NULL
+      && currentContext->device->parallelShaderCompile;
+}
+
+bool gpctx_hasDebugOutput()
+{
+   return currentContext != NULL && currentContext->device->debugOutput;
+}
+
+// Entry points of extensions the device that loaded glad lacked are
+// resolved for the devices that have them
+static void queryExtensions(GputDevice* device)
+{
+   pthread_mutex_lock(&devicesMutex);
+   if (!device->extensionsQueried) {
+      device->parallelShaderCompile =
+         gla_hasExtension("GL_KHR_parallel_shader_compile");
+      if (device->parallelShaderCompile
+         && glad_glMaxShaderCompilerThreadsKHR == NULL
+      ){
+         glad_glMaxShaderCompilerThreadsKHR =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)
+            eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+         device->parallelShaderCompile =
+            glad_glMaxShaderCompilerThreadsKHR != NULL;
+      }
+
+      device->debugOutput = gla_hasExtension("GL_KHR_debug");
+      if (device->debugOutput
+         && glad_glDebugMessageCallbackKHR == NULL
+      ){
+         glad_glDebugMessageCallbackKHR =
+            (PFNGLDEBUGMESSAGECALLBACKKHRPROC)
+            eglGetProcAddress("glDebugMessageCallbackKHR");
+         glad_glDebugMessageControlKHR =
+            (PFNGLDEBUGMESSAGECONTROLKHRPROC)
+            eglGetProcAddress("glDebugMessageControlKHR");
+         device->debugOutput = glad_glDebugMessageCallbackKHR != NULL
+            && glad_glDebugMessageControlKHR != NULL;
+      }
+      device->extensionsQueried = true;
+   }
+   pthread_mutex_unlock(&devicesMutex);
+}
+
+static void initContextState(GputContext* context)
+{
+   gla_resetStateCache();
+   queryExtensions(context->device);
+
+   GPUT_GL_DEBUG_INIT();
+
+   // Arrays are tightly packed on the host side
+   GLC(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+   GLC(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+
+   // Every kernel is a full-screen triangle generated from gl_VertexID, so a
+   // single empty vertex array is bound once for the lifetime of the context.
+   // Vertex arrays are not shared between contexts.
+   context->fullscreenVertexArray = gla_createVertexArray();
+   gla_bindVertexArray(context->fullscreenVertexArray);
+
+   context->initialized = true;
+}
+
+bool gpctx_setDevice(GputDevice* device)
+{
+   if (device == NULL) {
+      GPUT_LOG_ERROR("No device to select");
+      return false;
+   }
+   if (!ensureDeviceInitialized(device)) {
+      return false;
+   }
+
+   GputContext* context = &device->coreContext;
+   if (!isCoreThread) {
+      int deviceIndex = gpctx_getDeviceIndex(device);
+      if (threadContexts[deviceIndex] == NULL) {
+         threadContexts[deviceIndex] = gpctx_createSharedContext(device);
+      }
+      context = threadContexts[deviceIndex];
+      if (context == NULL) {
+         return false;
+      }
+   }
+
+   return context == currentContext || gpctx_makeCurrent(context);
+}
+
+GputDevice* gpctx_getCurrentDevice()
+{
+   return currentContext ? currentContext->device : NULL;
+}
+
+int gpctx_getCurrentDeviceIndex()
+{
+   GPUT_ASSERT(currentContext != NULL, "No current context");
+   return gpctx_getDeviceIndex(currentContext->device);
+}
+
+bool gpctx_attachThread()
+{
+   GPUT_ASSERT(currentContext == NULL, "Thread already has a current context");
+   return gpctx_setDevice(&devices[defaultDeviceIndex]);
+}
+
+void gpctx_detachThread()
+{
+   GPUT_ASSERT(!isCoreThread, "The core thread can not be detached");
+
+   gpctx_makeCurrent(NULL);
+   for (int i = 0; i < GPCTX_MAX_DEVICES; i++) {
+      if (threadContexts[i] != NULL) {
+         gpctx_destroyContext(threadContexts[i]);
+         threadContexts[i] = NULL;
+      }
+   }
+}
+
+GputContext* gpctx_createSharedContext(GputDevice* device)
+{
+   if (!ensureDeviceInitialized(device)) {
+      return NULL;
+   }
+
+   GputContext* context = calloc(1, sizeof(GputContext));
+   GPUT_ASSERT(context != NULL, "Could not allocate context");
+   if (context == NULL) {
+      return NULL;
+   }
+
+   // eglCreateContext is thread safe, so worker threads can create their own
+   context->device = device;
+   context->eglContext = eglCreateContext(device->eglDisplay,
+      device->eglConfig, device->coreContext.eglContext, contextAttribs
+   );
+   if (context->eglContext == EGL_NO_CONTEXT) {
+      GPUT_LOG_ERROR("Could not create shared context");
+      free(context);
+      return NULL;
+   }
+   registerContext(context);
+   context->glState = gla_createStateCache(
+      gpctx_getDeviceIndex(device), context->id
+   );
+
+   if (context->glState == NULL) {
+      unregisterContext(context);
+      eglDestroyContext(device->eglDisplay, context->eglContext);
+      free(context);
+      return NULL;
+   }
+   return context;
+}
+
+bool gpctx_makeCurrent(GputContext* context)
+{
+   bool returnVal;
+   if (context != NULL) {
+      returnVal = eglMakeCurrent(context->device->eglDisplay,
+         EGL_NO_SURFACE, EGL_NO_SURFACE, context->eglContext
+      );
+   }
+   else if (currentContext != NULL) {
+      returnVal = eglMakeCurrent(currentContext->device->eglDisplay,
+         EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT
+      );
+   }
+   else {
+      returnVal = true;
+   }
+   if (!returnVal) {
+      GPUT_LOG_ERROR("Could not make context current");
+      return false;
+   }
+
+   // Function pointers are resolved once. With libglvnd they dispatch to the
+   // vendor library of whichever context is current, so they are valid for
+   // every device.
+   if (context != NULL && !glLoaded) {
+      if (!gladLoadGLES2Loader((GLADloadproc) eglGetProcAddress)) {
+         GPUT_LOG_ERROR("Failed to load opengl function pointers");
+         eglMakeCurrent(context->device->eglDisplay,
+            EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT
+         );
+         currentContext = NULL;
+         gla_setCurrentStateCache(NULL);
+         return false;
+      }
+      gla_loadExtensions((GLADloadproc) eglGetProcAddress);
+      glLoaded = true;
+   }
+
+   currentContext = context;
+   gla_setCurrentStateCache(context ? context->glState : NULL);
+   if (context != NULL && !context->initialized) {
+      initContextState(context);
+   }
+   gpctx_deleteOrphanFramebuffers();
+   return true;
+}
+
+GputContext* gpctx_getCurrent()
+{
+   return currentContext;
+}
+
+unsigned gpctx_getCurrentId()
+{
+   return currentContext ? currentContext->id : 0;
+}
+
+void gpctx_deleteFramebuffer(unsigned contextId, GlFramebufferId framebuffer)
+{
+   if (currentContext != NULL && currentContext->id == contextId) {
+      gla_deleteFramebuffer(framebuffer);
+      return;
+   }
+
+   // Framebuffers of destroyed contexts are already gone
+   pthread_mutex_lock(&contextsMutex);
+   GputContext* context = liveContexts;
+   while (context != NULL && context->id != contextId) {
+      context = context->nextLive;
+   }
+   if (context != NULL) {
+      int count = atomic_load(&context->orphanFramebuffersCount);
+      if (count == context->orphanFramebuffersCapacity) {
+         int capacity = count ? 2 * count : 16;
+         GlFramebufferId* orphans = realloc(context->orphanFramebuffers,
+            capacity * sizeof(GlFramebufferId)
+         );
+         if (orphans != NULL) {
+            context->orphanFramebuffers = orphans;
+            context->orphanFramebuffersCapacity = capacity;
+         }
+      }
+      if (count < context->orphanFramebuffersCapacity) {
+         context->orphanFramebuffers[count] = framebuffer;
+         atomic_store(&context->orphanFramebuffersCount, count + 1);
+      }
+      else {
+         GPUT_LOG_WARN("Could not defer the deletion of framebuffer %u",
+            framebuffer
+         );
+      }
+   }
+   pthread_mutex_unlock(&contextsMutex);
+}
+
+void gpctx_deleteOrphanFramebuffers()
+{
+   if (currentContext == NULL
+      || atomic_load(&currentContext->orphanFramebuffersCount) == 0
+   ){
+      return;
+   }
+
+   pthread_mutex_lock(&contextsMutex);
+   int count = atomic_load(&currentContext->orphanFramebuffersCount);
+   for (int i = 0; i < count; i++) {
+      gla_deleteFramebuffer(currentContext->orphanFramebuffers[i]);
+   }
+   atomic_store(&currentContext->orphanFramebuffersCount, 0);
+   pthread_mutex_unlock(&contextsMutex);
+}
+
+bool gpctx_isCoreCurrent()
+{
+   return currentContext != NULL
+      && currentContext == &currentContext->device->coreContext;
+}
+
+void gpctx_publishObjects()
+{
+   // Objects changed in a context are only guaranteed to be visible to other
+   // contexts once the commands changing them have completed
+   if (!gpctx_isCoreCurrent()) {
+      gla_finish();
+   }
+}
+
+void gpctx_destroyContext(GputContext* context)
+{
+   if (currentContext == context) {
+      gpctx_makeCurrent(NULL);
+   }
+
+   // Container objects like the vertex array die with their context
+   if (!eglDestroyContext(context->device->eglDisplay, context->eglContext)) {
+      GPUT_LOG_WARN("Could not destroy context");
+   }
+   unregisterContext(context);
+   gpm_untrackOwner(GPM_FRAMEBUFFER, context->id);
+
+   gla_deleteStateCache(context->glState);
+   free(context);
+}
+
+void gpctx_terminate()
+{
+   if (!gpctx_makeCurrent(NULL)) {
+      GPUT_LOG_WARN("Could not release core context");
+   }
+
+   for (int i = 0; i < devicesCount; i++) {
+      GputDevice* device = &devices[i];
+      if (!device->initialized) {
+         continue;
+      }
+
+      if (!eglDestroyContext(
+         device->eglDisplay, device->coreContext.eglContext
+      )){
+         GPUT_LOG_WARN("Could not destroy core context");
+      }
+      unregisterContext(&device->coreContext);
+
+      gla_deleteStateCache(device->coreContext.glState);
+      device->coreContext.glState = NULL;
+
+      if (!eglTerminate(device->eglDisplay)) {
+         GPUT_LOG_WARN("Failed to terminate EGL");
+      }
+      releaseNativeDisplay(device);
+      device->initialized = false;
+   }
+
+   isCoreThread = false;
+}
@@ -0,0 +1,97 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "gput.h"
+#include "GlAbstract.h"
+
+#define GPCTX_MAX_DEVICES 8
+
+typedef struct GputContext GputContext;
+
+// Enumerates the devices and makes the core context of the default one
+// current on the calling thread, which becomes the core thread
+bool gpctx_init();
+
+void gpctx_terminate();
+
+int gpctx_getDevicesCount();
+
+GputDevice* gpctx_getDevice(int deviceIndex);
+
+int gpctx_getDeviceIndex(const GputDevice* device);
+
+const char* gpctx_getDeviceName(const GputDevice* device);
+
+bool gpctx_isSoftwareDevice(const GputDevice* device);
+
+// Extensions of the current device, the GLAD_GL_* flags only hold for the
+// device that was current when the entry points were loaded
+bool gpctx_hasParallelShaderCompile();
+
+bool gpctx_hasDebugOutput();
+
+// Makes the context of the calling thread for the device current, creating
+// the device's display and contexts on first use
+bool gpctx_setDevice(GputDevice* device);
+
+GputDevice* gpctx_getCurrentDevice();
+
+// Index of the current device, used to key per-device state
+int gpctx_getCurrentDeviceIndex();
+
+bool gpctx_attachThread();
+
+void gpctx_detachThread();
+
+GputContext* gpctx_createSharedContext(GputDevice* device);
+
+// Also selects the GlAbstract state cache of the context for the calling
+// thread. Passing NULL releases the current context.
+bool gpctx_makeCurrent(GputContext* context);
+
+GputContext* gpctx_getCurrent();
+
+// Identifies the current context, 0 when there is none. Unlike context
+// addresses, ids are never reused.
+unsigned gpctx_getCurrentId();
+
+// Framebuffers can't be shared, so deleting one created on another context
+// is deferred until that context is current again, or dropped when the
+// context is gone already
+void gpctx_deleteFramebuffer(unsigned contextId, GlFramebufferId framebuffer);
+
+// Deletes the framebuffers of the current context other threads deleted
+void gpctx_deleteOrphanFramebuffers();
+
+bool gpctx_isCoreCurrent();
+
+// Must be called after creating objects on a context other than the core
+// one, before handing them over to another thread
+void gpctx_publishObjects();
+
+void gpctx_destroyContext(GputContext* context);
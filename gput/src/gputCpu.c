@@ -0,0 +1,450 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define GPCPU_X86
+#elif defined(__ARM_NEON)
+   #include <arm_neon.h>
+#endif
+
+#include "gputCpu.h"
+#include "gputDebug.h"
+#include "gputThreadPool.h"
+#include "GlAbstract.h"
+
+typedef enum {
+   KIND_F32,
+   KIND_I32,
+   KIND_U32,
+   KINDS_COUNT
+} ComponentKind;
+
+typedef void (*BinaryLoop)(
+   const void* a, const void* b, void* output, size_t count
+);
+
+// count is in scalars, components in {1, 2, 3, 4}
+typedef void (*ReduceLoop)(
+   const void* data, size_t count, int components, void* result
+);
+
+static BinaryLoop binaryLoops[GPCPU_BINARY_OPS_COUNT][KINDS_COUNT];
+static ReduceLoop reduceLoops[GPCPU_REDUCE_OPS_COUNT][KINDS_COUNT];
+
+#define ADD(x, y) ((x) + (y))
+#define SUB(x, y) ((x) - (y))
+#define MUL(x, y) ((x) * (y))
+#define MIN(x, y) ((y) < (x) ? (y) : (x))
+#define MAX(x, y) ((x) < (y) ? (y) : (x))
+
+// Signed integers wrap around like on the GPU instead of overflowing
+#define I32_ADD(x, y) ((int32_t) ((uint32_t) (x) + (uint32_t) (y)))
+#define I32_SUB(x, y) ((int32_t) ((uint32_t) (x) - (uint32_t) (y)))
+#define I32_MUL(x, y) ((int32_t) ((uint32_t) (x) * (uint32_t) (y)))
+
+// Loops are generated for each instruction set from its vector type, lane
+// count and load, store and operation. Scalar loops use a single lane and
+// are left to the auto-vectorizer.
+#define DEFINE_BINARY_LOOP(name, attr, type, lanes, load, store, vecOp, op) \
+   attr static void name( \
+      const void* aData, const void* bData, void* outData, size_t count \
+   ){ \
+      const type* a = aData; \
+      const type* b = bData; \
+      type* out = outData; \
+      size_t i = 0; \
+      for (; i + (lanes) <= count; i += (lanes)) { \
+         store(out + i, vecOp(load(a + i), load(b + i))); \
+      } \
+      for (; i < count; i++) { \
+         out[i] = op(a[i], b[i]); \
+      } \
+   }
+
+// Vector lanes accumulate the components they hold, so the vector part is
+// used when the lane count is a multiple of the components
+#define DEFINE_REDUCE_LOOP( \
+   name, attr, type, vecType, lanes, load, store, vecOp, op \
+) \
+   attr static void name( \
+      const void* data, size_t count, int components, void* result \
+   ){ \
+      const type* values = data; \
+      type* acc = result; \
+      size_t i = components; \
+      for (int c = 0; c < components; c++) { \
+         acc[c] = values[c]; \
+      } \
+      if ((lanes) % components == 0 && count >= 2 * (lanes)) { \
+         vecType vecAcc = load(values); \
+         for (i = (lanes); i + (lanes) <= count; i += (lanes)) { \
+            vecAcc = vecOp(vecAcc, load(values + i)); \
+         } \
+         type laneValues[lanes]; \
+         store(laneValues, vecAcc); \
+         for (int l = 0; l < (lanes); l++) { \
+            acc[l % components] = l < components \
+               ? laneValues[l] : op(acc[l % components], laneValues[l]); \
+         } \
+      } \
+      for (; i < count; i++) { \
+         acc[i % components] = op(acc[i % components], values[i]); \
+      } \
+   }
+
+#define SCALAR_LOAD(p) (*(p))
+#define SCALAR_STORE(p, v) (*(p) = (v))
+
+#define DEFINE_SCALAR_LOOPS(kind, type, add, sub, mul) \
+   DEFINE_BINARY_LOOP(scalar##kind##Add, , type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, add, add) \
+   DEFINE_BINARY_LOOP(scalar##kind##Sub, , type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, sub, sub) \
+   DEFINE_BINARY_LOOP(scalar##kind##Mul, , type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, mul, mul) \
+   DEFINE_BINARY_LOOP(scalar##kind##Min, , type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, MIN, MIN) \
+   DEFINE_BINARY_LOOP(scalar##kind##Max, , type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, MAX, MAX) \
+   DEFINE_REDUCE_LOOP(scalar##kind##Sum, , type, type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, add, add) \
+   DEFINE_REDUCE_LOOP(scalar##kind##RMin, , type, type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, MIN, MIN) \
+   DEFINE_REDUCE_LOOP(scalar##kind##RMax, , type, type, 1, \
+      SCALAR_LOAD, SCALAR_STORE, MAX, MAX)
+
+DEFINE_SCALAR_LOOPS(F32, float, ADD, SUB, MUL)
+DEFINE_SCALAR_LOOPS(I32, int32_t, I32_ADD, I32_SUB, I32_MUL)
+DEFINE_SCALAR_LOOPS(U32, uint32_t, ADD, SUB, MUL)
+
+#define SET_LOOPS(prefix, kind, kindIndex) \
+   binaryLoops[GPUT_BINARY_ADD][kindIndex] = prefix##kind##Add; \
+   binaryLoops[GPUT_BINARY_SUB][kindIndex] = prefix##kind##Sub; \
+   binaryLoops[GPUT_BINARY_MUL][kindIndex] = prefix##kind##Mul; \
+   binaryLoops[GPUT_BINARY_MIN][kindIndex] = prefix##kind##Min; \
+   binaryLoops[GPUT_BINARY_MAX][kindIndex] = prefix##kind##Max; \
+   reduceLoops[GPUT_REDUCE_SUM][kindIndex] = prefix##kind##Sum; \
+   reduceLoops[GPUT_REDUCE_MIN][kindIndex] = prefix##kind##RMin; \
+   reduceLoops[GPUT_REDUCE_MAX][kindIndex] = prefix##kind##RMax;
+
+#ifdef GPCPU_X86
+
+// SSE2 is part of x86-64, but lacks 32-bit integer multiplication and
+// min/max, which stay scalar
+#define SSE_LOADF(p) _mm_loadu_ps(p)
+#define SSE_STOREF(p, v) _mm_storeu_ps(p, v)
+#define SSE_LOADI(p) _mm_loadu_si128((const __m128i*) (p))
+#define SSE_STOREI(p, v) _mm_storeu_si128((__m128i*) (p), v)
+
+#define SSE_TARGET __attribute__((target("sse2")))
+
+DEFINE_BINARY_LOOP(sseF32Add, SSE_TARGET, float, 4,
+   SSE_LOADF, SSE_STOREF, _mm_add_ps, ADD)
+DEFINE_BINARY_LOOP(sseF32Sub, SSE_TARGET, float, 4,
+   SSE_LOADF, SSE_STOREF, _mm_sub_ps, SUB)
+DEFINE_BINARY_LOOP(sseF32Mul, SSE_TARGET, float, 4,
+   SSE_LOADF, SSE_STOREF, _mm_mul_ps, MUL)
+DEFINE_BINARY_LOOP(sseF32Min, SSE_TARGET, float, 4,
+   SSE_LOADF, SSE_STOREF, _mm_min_ps, MIN)
+DEFINE_BINARY_LOOP(sseF32Max, SSE_TARGET, float, 4,
+   SSE_LOADF, SSE_STOREF, _mm_max_ps, MAX)
+DEFINE_BINARY_LOOP(sseI32Add, SSE_TARGET, int32_t, 4,
+   SSE_LOADI, SSE_STOREI, _mm_add_epi32, I32_ADD)
+DEFINE_BINARY_LOOP(sseI32Sub, SSE_TARGET, int32_t, 4,
+   SSE_LOADI, SSE_STOREI, _mm_sub_epi32, I32_SUB)
+DEFINE_BINARY_LOOP(sseU32Add, SSE_TARGET, uint32_t, 4,
+   SSE_LOADI, SSE_STOREI, _mm_add_epi32, ADD)
+DEFINE_BINARY_LOOP(sseU32Sub, SSE_TARGET, uint32_t, 4,
+   SSE_LOADI, SSE_STOREI, _mm_sub_epi32, SUB)
+DEFINE_REDUCE_LOOP(sseF32Sum, SSE_TARGET, float, __m128, 4,
+   SSE_LOADF, SSE_STOREF, _mm_add_ps, ADD)
+DEFINE_REDUCE_LOOP(sseF32RMin, SSE_TARGET, float, __m128, 4,
+   SSE_LOADF, SSE_STOREF, _mm_min_ps, MIN)
+DEFINE_REDUCE_LOOP(sseF32RMax, SSE_TARGET, float, __m128, 4,
+   SSE_LOADF, SSE_STOREF, _mm_max_ps, MAX)
+DEFINE_REDUCE_LOOP(sseI32Sum, SSE_TARGET, int32_t, __m128i, 4,
+   SSE_LOADI, SSE_STOREI, _mm_add_epi32, I32_ADD)
+DEFINE_REDUCE_LOOP(sseU32Sum, SSE_TARGET, uint32_t, __m128i, 4,
+   SSE_LOADI, SSE_STOREI, _mm_add_epi32, ADD)
+
+static void setSseLoops()
+{
+   binaryLoops[GPUT_BINARY_ADD][KIND_F32] = sseF32Add;
+   binaryLoops[GPUT_BINARY_SUB][KIND_F32] = sseF32Sub;
+   binaryLoops[GPUT_BINARY_MUL][KIND_F32] = sseF32Mul;
+   binaryLoops[GPUT_BINARY_MIN][KIND_F32] = sseF32Min;
+   binaryLoops[GPUT_BINARY_MAX][KIND_F32] = sseF32Max;
+   binaryLoops[GPUT_BINARY_ADD][KIND_I32] = sseI32Add;
+   binaryLoops[GPUT_BINARY_SUB][KIND_I32] = sseI32Sub;
+   binaryLoops[GPUT_BINARY_ADD][KIND_U32] = sseU32Add;
+   binaryLoops[GPUT_BINARY_SUB][KIND_U32] = sseU32Sub;
+   reduceLoops[GPUT_REDUCE_SUM][KIND_F32] = sseF32Sum;
+   reduceLoops[GPUT_REDUCE_MIN][KIND_F32] = sseF32RMin;
+   reduceLoops[GPUT_REDUCE_MAX][KIND_F32] = sseF32RMax;
+   reduceLoops[GPUT_REDUCE_SUM][KIND_I32] = sseI32Sum;
+   reduceLoops[GPUT_REDUCE_SUM][KIND_U32] = sseU32Sum;
+}
+
+// AVX2 loops are compiled for the instruction set regardless of the build
+// flags and only selected when the CPU supports it
+#define AVX_LOADF(p) _mm256_loadu_ps(p)
+#define AVX_STOREF(p, v) _mm256_storeu_ps(p, v)
+#define AVX_LOADI(p) _mm256_loadu_si256((const __m256i*) (p))
+#define AVX_STOREI(p, v) _mm256_storeu_si256((__m256i*) (p), v)
+
+#define AVX_TARGET __attribute__((target("avx2")))
+
+#define DEFINE_AVX_LOOPS( \
+   kind, type, vecType, load, store, \
+   vecAdd, vecSub, vecMul, vecMin, vecMax, add, sub, mul \
+) \
+   DEFINE_BINARY_LOOP(avx##kind##Add, AVX_TARGET, type, 8, \
+      load, store, vecAdd, add) \
+   DEFINE_BINARY_LOOP(avx##kind##Sub, AVX_TARGET, type, 8, \
+      load, store, vecSub, sub) \
+   DEFINE_BINARY_LOOP(avx##kind##Mul, AVX_TARGET, type, 8, \
+      load, store, vecMul, mul) \
+   DEFINE_BINARY_LOOP(avx##kind##Min, AVX_TARGET, type, 8, \
+      load, store, vecMin, MIN) \
+   DEFINE_BINARY_LOOP(avx##kind##Max, AVX_TARGET, type, 8, \
+      load, store, vecMax, MAX) \
+   DEFINE_REDUCE_LOOP(avx##kind##Sum, AVX_TARGET, type, vecType, 8, \
+      load, store, vecAdd, add) \
+   DEFINE_REDUCE_LOOP(avx##kind##RMin, AVX_TARGET, type, vecType, 8, \
+      load, store, vecMin, MIN) \
+   DEFINE_REDUCE_LOOP(avx##kind##RMax, AVX_TARGET, type, vecType, 8, \
+      load, store, vecMax, MAX)
+
+DEFINE_AVX_LOOPS(F32, float, __m256, AVX_LOADF, AVX_STOREF,
+   _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+   _mm256_min_ps, _mm256_max_ps, ADD, SUB, MUL)
+DEFINE_AVX_LOOPS(I32, int32_t, __m256i, AVX_LOADI, AVX_STOREI,
+   _mm256_add_epi32, _mm256_sub_epi32, _mm256_mullo_epi32,
+   _mm256_min_epi32, _mm256_max_epi32, I32_ADD, I32_SUB, I32_MUL)
+DEFINE_AVX_LOOPS(U32, uint32_t, __m256i, AVX_LOADI, AVX_STOREI,
+   _mm256_add_epi32, _mm256_sub_epi32, _mm256_mullo_epi32,
+   _mm256_min_epu32, _mm256_max_epu32, ADD, SUB, MUL)
+
+#elif defined(__ARM_NEON)
+
+#define DEFINE_NEON_LOOPS(kind, type, vecType, suffix, add, sub, mul) \
+   DEFINE_BINARY_LOOP(neon##kind##Add, , type, 4, \
+      vld1q_##suffix, vst1q_##suffix, vaddq_##suffix, add) \
+   DEFINE_BINARY_LOOP(neon##kind##Sub, , type, 4, \
+      vld1q_##suffix, vst1q_##suffix, vsubq_##suffix, sub) \
+   DEFINE_BINARY_LOOP(neon##kind##Mul, , type, 4, \
+      vld1q_##suffix, vst1q_##suffix, vmulq_##suffix, mul) \
+   DEFINE_BINARY_LOOP(neon##kind##Min, , type, 4, \
+      vld1q_##suffix, vst1q_##suffix, vminq_##suffix, MIN) \
+   DEFINE_BINARY_LOOP(neon##kind##Max, , type, 4, \
+      vld1q_##suffix, vst1q_##suffix, vmaxq_##suffix, MAX) \
+   DEFINE_REDUCE_LOOP(neon##kind##Sum, , type, vecType, 4, \
+      vld1q_##suffix, vst1q_##suffix, vaddq_##suffix, add) \
+   DEFINE_REDUCE_LOOP(neon##kind##RMin, , type, vecType, 4, \
+      vld1q_##suffix, vst1q_##suffix, vminq_##suffix, MIN) \
+   DEFINE_REDUCE_LOOP(neon##kind##RMax, , type, vecType, 4, \
+      vld1q_##suffix, vst1q_##suffix, vmaxq_##suffix, MAX)
+
+DEFINE_NEON_LOOPS(F32, float, float32x4_t, f32, ADD, SUB, MUL)
+DEFINE_NEON_LOOPS(I32, int32_t, int32x4_t, s32, I32_ADD, I32_SUB, I32_MUL)
+DEFINE_NEON_LOOPS(U32, uint32_t, uint32x4_t, u32, ADD, SUB, MUL)
+
+#endif
+
+static int getComponentKind(GlDataType dataType)
+{
+   switch (gla_getDataTypeComponentType(dataType)) {
+      case GL_FLOAT:
+         return KIND_F32;
+      case GL_INT:
+         return KIND_I32;
+      case GL_UNSIGNED_INT:
+         return KIND_U32;
+      default:
+         return -1;
+   }
+}
+
+bool gpcpu_init()
+{
+   SET_LOOPS(scalar, F32, KIND_F32)
+   SET_LOOPS(scalar, I32, KIND_I32)
+   SET_LOOPS(scalar, U32, KIND_U32)
+
+   const char* instructionSet = "scalar";
+#ifdef GPCPU_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      SET_LOOPS(avx, F32, KIND_F32)
+      SET_LOOPS(avx, I32, KIND_I32)
+      SET_LOOPS(avx, U32, KIND_U32)
+      instructionSet = "AVX2";
+   }
+   else if (__builtin_cpu_supports("sse2")) {
+      setSseLoops();
+      instructionSet = "SSE2";
+   }
+#elif defined(__ARM_NEON)
+   SET_LOOPS(neon, F32, KIND_F32)
+   SET_LOOPS(neon, I32, KIND_I32)
+   SET_LOOPS(neon, U32, KIND_U32)
+   instructionSet = "NEON";
+#endif
+
+   if (!gptp_init(0)) {
+      return false;
+   }
+   GPUT_LOG_INFO("CPU backend: %s, %d threads",
+      instructionSet, gptp_getThreadsCount()
+   );
+   return true;
+}
+
+void gpcpu_terminate()
+{
+   gptp_terminate();
+}
+
+bool gpcpu_isSupportedType(GlDataType dataType)
+{
+   return getComponentKind(dataType) != -1;
+}
+
+typedef struct {
+   BinaryLoop loop;
+   const unsigned char* a;
+   const unsigned char* b;
+   unsigned char* output;
+} BinaryTask;
+
+static void runBinaryChunk(
+   void* context, size_t chunkIndex, size_t begin, size_t end
+){
+   BinaryTask* task = context;
+   size_t offset = begin * sizeof(uint32_t);
+   task->loop(
+      task->a + offset, task->b + offset, task->output + offset, end - begin
+   );
+}
+
+void gpcpu_runBinaryOp(
+   GputBinaryOp op, GlDataType dataType,
+   const void* a, const void* b, void* output, size_t elementsCount
+){
+   int kind = getComponentKind(dataType);
+   GPUT_ASSERT(kind != -1, "Unsupported type for built-in operations");
+   if (kind == -1) {
+      return;
+   }
+
+   BinaryTask task = {binaryLoops[op][kind], a, b, output};
+   size_t count = elementsCount * gla_getDataTypeComponents(dataType);
+   gptp_parallelFor(count, GPCPU_CHUNK_SIZE, runBinaryChunk, &task);
+}
+
+typedef struct {
+   ReduceLoop loop;
+   const unsigned char* data;
+   int components;
+   uint32_t* partials;
+} ReduceTask;
+
+static void runReduceChunk(
+   void* context, size_t chunkIndex, size_t begin, size_t end
+){
+   ReduceTask* task = context;
+   task->loop(
+      task->data + begin * task->components * sizeof(uint32_t),
+      (end - begin) * task->components, task->components,
+      task->partials + chunkIndex * task->components
+   );
+}
+
+// Result of reducing no element at all
+static void writeIdentity(
+   GputReduceOp op, int kind, int components, void* result
+){
+   for (int c = 0; c < components; c++) {
+      switch (kind) {
+         case KIND_F32:
+            ((float*) result)[c] = op == GPUT_REDUCE_MIN ? INFINITY
+               : op == GPUT_REDUCE_MAX ? -INFINITY : 0.0f;
+            break;
+         case KIND_I32:
+            ((int32_t*) result)[c] = op == GPUT_REDUCE_MIN ? INT32_MAX
+               : op == GPUT_REDUCE_MAX ? INT32_MIN : 0;
+            break;
+         case KIND_U32:
+            ((uint32_t*) result)[c] = op == GPUT_REDUCE_MIN ? UINT32_MAX : 0;
+            break;
+      }
+   }
+}
+
+void gpcpu_reduce(
+   GputReduceOp op, GlDataType dataType,
+   const void* data, size_t elementsCount, void* result
+){
+   int kind = getComponentKind(dataType);
+   GPUT_ASSERT(kind != -1, "Unsupported type for built-in operations");
+   if (kind == -1) {
+      return;
+   }
+
+   int components = gla_getDataTypeComponents(dataType);
+   if (elementsCount == 0) {
+      writeIdentity(op, kind, components, result);
+      return;
+   }
+
+   ReduceLoop loop = reduceLoops[op][kind];
+
+   // Chunks are whole elements and a multiple of every lane count, so that
+   // each chunk starts on the first component
+   size_t chunkElements = GPCPU_CHUNK_SIZE / 4;
+   size_t chunksCount = (elementsCount + chunkElements - 1) / chunkElements;
+   if (chunksCount == 1) {
+      loop(data, elementsCount * components, components, result);
+      return;
+   }
+
+   uint32_t* partials = malloc(chunksCount * components * sizeof(uint32_t));
+   GPUT_ASSERT(partials != NULL, "Could not allocate reduction partials");
+   if (partials == NULL) {
+      return;
+   }
+
+   ReduceTask task = {loop, data, components, partials};
+   gptp_parallelFor(elementsCount, chunkElements, runReduceChunk, &task);
+
+   // The partials are laid out like an array of chunksCount elements
+   loop(partials, chunksCount * components, components, result);
+   free(partials);
+}
@@ -0,0 +1,55 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gput.h"
+
+#define GPCPU_BINARY_OPS_COUNT (GPUT_BINARY_MAX + 1)
+#define GPCPU_REDUCE_OPS_COUNT (GPUT_REDUCE_MAX + 1)
+
+// Scalars processed by a thread pool chunk. Smaller arrays stay on the
+// calling thread since waking the pool costs more than the loop.
+#define GPCPU_CHUNK_SIZE (64 * 1024)
+
+bool gpcpu_init();
+
+void gpcpu_terminate();
+
+// Built-in operations support 32-bit component types
+bool gpcpu_isSupportedType(GlDataType dataType);
+
+void gpcpu_runBinaryOp(
+   GputBinaryOp op, GlDataType dataType,
+   const void* a, const void* b, void* output, size_t elementsCount
+);
+
+// result receives one value per component
+void gpcpu_reduce(
+   GputReduceOp op, GlDataType dataType,
+   const void* data, size_t elementsCount, void* result
+);
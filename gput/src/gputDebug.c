@@ -22,6 +22,9 @@
  * SOFTWARE.
  */
 
+#include <stdatomic.h>
+
+#include "gputContext.h"
 #include "gputDebug.h"
 
 #ifdef GPUT_DEBUG
@@ -38,14 +41,78 @@ static const char* errorStrs[] = {
    "GL_INVALID_FRAMEBUFFER_OPERATION"
 };
 
+// Errors reported by the debug callbacks of every context since the last
+// sync point
+static atomic_int glErrorsCount;
+
 const char* getGlErrorStr(int errorCode)
 {
-   if (errorCode >= 0 && errorCode < ERRORS_COUNT) {
+   if (errorCode < GL_INVALID_ENUM
+      || errorCode >= GL_INVALID_ENUM + ERRORS_COUNT
+   ){
       return "(Unsupported error)";
    }
    else {
-      return errorStrs[errorCode + GL_INVALID_ENUM];
+      return errorStrs[errorCode - GL_INVALID_ENUM];
+   }
+}
+
+static void APIENTRY onGlDebugMessage(
+   GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+   const GLchar* message, const void* userParam
+){
+   if (type == GL_DEBUG_TYPE_ERROR_KHR) {
+      // Synchronous output runs from within the failing call, so stop there
+      // to have it in the backtrace
+      GPUT_ASSERT(GPUT_GL_CHECK_MODE != GPUT_GL_CHECK_DEBUG_SYNC,
+         "GL error: %s", message
+      );
+      GPUT_LOG_ERROR("GL error: %s", message);
+      atomic_fetch_add(&glErrorsCount, 1);
+   }
+   else if (severity == GL_DEBUG_SEVERITY_LOW_KHR) {
+      GPUT_LOG_DEBUG("GL: %s", message);
    }
+   else {
+      GPUT_LOG_WARN("GL: %s", message);
+   }
+}
+
+void installGlDebugOutput()
+{
+   if (!gpctx_hasDebugOutput()) {
+      GPUT_LOG_WARN("GL_KHR_debug not supported, GL errors will only be "
+         "detected at sync points"
+      );
+      return;
+   }
+
+   glDebugMessageCallbackKHR(onGlDebugMessage, NULL);
+   glDebugMessageControlKHR(GL_DONT_CARE, GL_DONT_CARE,
+      GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, NULL, GL_FALSE
+   );
+   glEnable(GL_DEBUG_OUTPUT_KHR);
+   if (GPUT_GL_CHECK_MODE == GPUT_GL_CHECK_DEBUG_SYNC) {
+      glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+   }
+   else {
+      glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+   }
+}
+
+void checkGlErrors(const char* syncPoint)
+{
+   // The error flags still catch what the callback did not report, or
+   // everything without KHR_debug
+   int errorsCount = 0;
+   GLenum errorCode;
+   while ((errorCode = glGetError()) != GL_NO_ERROR) {
+      GPUT_LOG_ERROR("GL error %s", getGlErrorStr(errorCode));
+      errorsCount++;
+   }
+   errorsCount += atomic_exchange(&glErrorsCount, 0);
+
+   GPUT_ASSERT(errorsCount == 0, "GL errors before %s", syncPoint);
 }
 
 #endif // ifdef GPUT_DEBUG
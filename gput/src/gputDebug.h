@@ -26,10 +26,10 @@
 #include <assert.h>
 #include <stdbool.h>
 
-#include <libgen.h>
-
 #include "glad/glad.h"
 
+#include "gputGlStats.h"
+#include "gputLog.h"
 #include "logger.h"
 
 #define GPUT_LOG_LEVEL_TRACE  LogLevel_TRACE
@@ -43,6 +43,8 @@
 #define GPUT_CONSOLE_LOG   0
 #define GPUT_FILE_LOG      1
 #define GPUT_MULTI_LOG     2
+// Records are formatted by the caller and written by a background thread
+#define GPUT_ASYNC_LOG     3
 
 
 #ifndef GPUT_ACTIVE_LOG_LEVEL
@@ -53,6 +55,15 @@
    #define GPUT_LOG_MODE GPUT_CONSOLE_LOG
 #endif
 
+// Name of the source file without its directories, folded at compile time
+#ifdef __FILE_NAME__
+   #define GPUT_FILE_NAME __FILE_NAME__
+#else
+   #define GPUT_FILE_NAME \
+      (__builtin_strrchr(__FILE__, '/') \
+         ? __builtin_strrchr(__FILE__, '/') + 1 : __FILE__)
+#endif
+
 #if GPUT_ACTIVE_LOG_LEVEL != GPUT_LOG_LEVEL_OFF
 
       #ifndef GPUT_LOG_FILE_NAME
@@ -88,18 +99,41 @@
             GPUT_MAX_LOG_BACKUP_FILES \
          )
 
+   #elif GPUT_LOG_MODE == GPUT_ASYNC_LOG
+
+      // Console when NULL
+      #ifndef GPUT_ASYNC_LOG_FILE_NAME
+         #define GPUT_ASYNC_LOG_FILE_NAME NULL
+      #endif
+
+      #define GPUT_LOG_INIT() gplog_init(GPUT_ASYNC_LOG_FILE_NAME)
+      #define GPUT_LOG_TERMINATE() gplog_terminate()
+
    #else
       #error unsupported logging mode
    #endif
+
+   #if GPUT_LOG_MODE == GPUT_ASYNC_LOG
+      #define GPUT_LOG_WRITE(level, fmt, ...) \
+         gplog_log( \
+            level, GPUT_FILE_NAME, __LINE__, fmt __VA_OPT__(,) __VA_ARGS__ \
+         )
+   #else
+      #define GPUT_LOG_TERMINATE()
+      #define GPUT_LOG_WRITE(level, fmt, ...) \
+         logger_log( \
+            level, GPUT_FILE_NAME, __LINE__, fmt __VA_OPT__(,) __VA_ARGS__ \
+         )
+   #endif
+#else
+   #define GPUT_LOG_INIT()
+   #define GPUT_LOG_TERMINATE()
 #endif
 
 #if GPUT_ACTIVE_LOG_LEVEL == GPUT_LOG_LEVEL_TRACE
 
    #define GPUT_LOG_TRACE(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_TRACE, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_TRACE, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_TRACE(fmt, ...)
@@ -108,10 +142,7 @@
 #if GPUT_ACTIVE_LOG_LEVEL <= GPUT_LOG_LEVEL_DEBUG
 
    #define GPUT_LOG_DEBUG(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_DEBUG, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_DEBUG(fmt, ...)
@@ -120,10 +151,7 @@
 #if GPUT_ACTIVE_LOG_LEVEL <= GPUT_LOG_LEVEL_INFO
 
    #define GPUT_LOG_INFO(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_INFO, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_INFO, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_INFO(fmt, ...)
@@ -132,10 +160,7 @@
 #if GPUT_ACTIVE_LOG_LEVEL <= GPUT_LOG_LEVEL_WARN
 
    #define GPUT_LOG_WARN(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_WARN, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_WARN, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_WARN(fmt, ...)
@@ -144,10 +169,7 @@
 #if GPUT_ACTIVE_LOG_LEVEL <= GPUT_LOG_LEVEL_ERROR
 
    #define GPUT_LOG_ERROR(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_ERROR, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_ERROR(fmt, ...)
@@ -156,17 +178,32 @@
 #if GPUT_ACTIVE_LOG_LEVEL <= GPUT_LOG_LEVEL_FATAL
 
    #define GPUT_LOG_FATAL(fmt, ...) \
-      logger_log( \
-         GPUT_LOG_LEVEL_FATAL, basename(__FILE__), __LINE__, \
-         fmt __VA_OPT__(,) __VA_ARGS__ \
-      )
+      GPUT_LOG_WRITE(GPUT_LOG_LEVEL_FATAL, fmt __VA_OPT__(,) __VA_ARGS__)
 
 #else
    #define GPUT_LOG_FATAL(fmt, ...)
 #endif
 
+// How GLC reports GL errors in debug builds. Checking after every call forces
+// a round trip to the driver. The KHR_debug modes have the driver report
+// errors through a callback instead, either from within the failing call
+// (sync) or later on (async), and only check the error flags at sync points.
+#define GPUT_GL_CHECK_GET_ERROR     0
+#define GPUT_GL_CHECK_DEBUG_SYNC    1
+#define GPUT_GL_CHECK_DEBUG_ASYNC   2
+
+#ifndef GPUT_GL_CHECK_MODE
+   #define GPUT_GL_CHECK_MODE GPUT_GL_CHECK_GET_ERROR
+#endif
+
 const char* getGlErrorStr(int errorCode);
 
+// Installs the debug message callback on the current context
+void installGlDebugOutput();
+
+// Asserts that no GL error happened since the previous sync point
+void checkGlErrors(const char* syncPoint);
+
 #ifdef GPUT_DEBUG
 
    #define GPUT_ASSERT(statement, message, ...) \
@@ -178,15 +215,31 @@ const char* getGlErrorStr(int errorCode);
       } \
    }
 
-   #define GLC(glCall) \
-      glCall; \
-   { \
-      GLint glErrorCode = glGetError(); \
-      GPUT_ASSERT(glErrorCode == GL_NO_ERROR, \
-         "Error %s en GL call %s", \
-          getGlErrorStr(glErrorCode), #glCall \
-      ) \
-   }
+   #if GPUT_GL_CHECK_MODE == GPUT_GL_CHECK_GET_ERROR
+
+      #define GLC(glCall) \
+         glCall; \
+      { \
+         GLint glErrorCode = glGetError(); \
+         GPUT_ASSERT(glErrorCode == GL_NO_ERROR, \
+            "Error %s en GL call %s", \
+             getGlErrorStr(glErrorCode), #glCall \
+         ) \
+      }
+
+      #define GPUT_GL_DEBUG_INIT()
+      #define GPUT_GL_SYNC_POINT(syncPoint)
+
+   #elif GPUT_GL_CHECK_MODE == GPUT_GL_CHECK_DEBUG_SYNC \
+      || GPUT_GL_CHECK_MODE == GPUT_GL_CHECK_DEBUG_ASYNC
+
+      #define GLC(glCall) glCall
+      #define GPUT_GL_DEBUG_INIT() installGlDebugOutput()
+      #define GPUT_GL_SYNC_POINT(syncPoint) checkGlErrors(syncPoint)
+
+   #else
+      #error unsupported GL check mode
+   #endif
 
    #define GPUT_DEBUG_SCOPE(debugCode) \
    { \
@@ -196,5 +249,14 @@ const char* getGlErrorStr(int errorCode);
 #else
    #define GPUT_ASSERT(statement, message, ...)
    #define GLC(glCall) glCall
+   #define GPUT_GL_DEBUG_INIT()
+   #define GPUT_GL_SYNC_POINT(syncPoint)
    #define GPUT_DEBUG_SCOPE(debugCode)
 #endif
+
+// Counts and times every GLC. In the mode checking for errors after every
+// call, gpgl_endCall does it once the clock stopped.
+#ifdef GPUT_GL_STATS
+   #undef GLC
+   #define GLC(glCall) GPGL_CALL(glCall)
+#endif
@@ -0,0 +1,586 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputCpu.h"
+#include "gputDebug.h"
+#include "gputDispatch.h"
+#include "gputOps.h"
+#include "gputTime.h"
+#include "gputTrace.h"
+#include "GlAbstract.h"
+
+typedef enum {
+   STAGING_A,
+   STAGING_B,
+   STAGING_OUTPUT,
+   STAGING_ROWS,
+   STAGING_SLOTS_COUNT
+} StagingSlot;
+
+static bool gpuEnabled;
+static GputDispatchPolicy policy;
+static size_t cpuBelow;
+static size_t gpuFrom;
+
+typedef enum {
+   OP_KIND_BINARY,
+   OP_KIND_REDUCE,
+   OP_KINDS_COUNT
+} OpKind;
+
+static GputCostModel models[GPCTX_MAX_DEVICES];
+static bool calibrated[GPCTX_MAX_DEVICES];
+
+// Seconds per component of each side of split operations, starting from the
+// cost model and following the completion times observed since
+static double splitCpuSeconds[GPCTX_MAX_DEVICES][OP_KINDS_COUNT];
+static double splitGpuSeconds[GPCTX_MAX_DEVICES][OP_KINDS_COUNT];
+
+// Device copies of host arrays are kept between operations of the same shape
+static pthread_mutex_t dispatchMutex = PTHREAD_MUTEX_INITIALIZER;
+static GputArray* staging[GPCTX_MAX_DEVICES][STAGING_SLOTS_COUNT];
+
+static size_t getEnvSize(const char* name)
+{
+   const char* value = getenv(name);
+   return value ? strtoull(value, NULL, 10) : 0;
+}
+
+void gpd_init(bool gpuAvailable)
+{
+   gpuEnabled = gpuAvailable;
+
+   const char* policyName = getenv("GPUT_DISPATCH");
+   policy = GPUT_DISPATCH_AUTO;
+   if (policyName != NULL && strcmp(policyName, "cpu") == 0) {
+      policy = GPUT_DISPATCH_CPU;
+   }
+   else if (policyName != NULL && strcmp(policyName, "gpu") == 0) {
+      policy = GPUT_DISPATCH_GPU;
+   }
+   else if (policyName != NULL && strcmp(policyName, "split") == 0) {
+      policy = GPUT_DISPATCH_SPLIT;
+   }
+
+   cpuBelow = getEnvSize("GPUT_DISPATCH_CPU_BELOW");
+   gpuFrom = getEnvSize("GPUT_DISPATCH_GPU_FROM");
+}
+
+void gpd_terminate()
+{
+   GputDevice* currentDevice = gpctx_getCurrentDevice();
+   for (int device = 0; device < GPCTX_MAX_DEVICES; device++) {
+      for (int slot = 0; slot < STAGING_SLOTS_COUNT; slot++) {
+         if (staging[device][slot] != NULL) {
+            gpctx_setDevice(gpctx_getDevice(device));
+            gput_deleteArray(staging[device][slot]);
+            staging[device][slot] = NULL;
+         }
+      }
+      calibrated[device] = false;
+   }
+   gpctx_setDevice(currentDevice);
+}
+
+static void calibrate(GputCostModel* model)
+{
+   const int size = GPD_CALIBRATION_SIZE;
+   const size_t components = (size_t) size * size * 4;
+   const size_t bytes = components * sizeof(uint32_t);
+
+   uint32_t* data = calloc(components, sizeof(uint32_t));
+   uint32_t* result = malloc(bytes);
+   GPUT_ASSERT(data != NULL && result != NULL,
+      "Could not allocate calibration data"
+   );
+   if (data == NULL || result == NULL) {
+      free(data);
+      free(result);
+      return;
+   }
+
+   GputArray* a = gput_createArrayOnBackend(
+      GPUT_BACKEND_GPU, VEC4_UI32, size, size, data
+   );
+   GputArray* out = gput_createArrayOnBackend(
+      GPUT_BACKEND_GPU, VEC4_UI32, size, size, NULL
+   );
+   GputArray* small = gput_createArrayOnBackend(
+      GPUT_BACKEND_GPU, VEC4_UI32, 1, 1, data
+   );
+   GputArray* smallOut = gput_createArrayOnBackend(
+      GPUT_BACKEND_GPU, VEC4_UI32, 1, 1, NULL
+   );
+
+   // Compiles the kernel and creates the framebuffers before measuring
+   gput_runBinaryOp(GPUT_BINARY_ADD, small, small, smallOut);
+   gput_runBinaryOp(GPUT_BINARY_ADD, a, a, out);
+   gput_downloadArray(out, result);
+
+   double start = gptime_getSeconds();
+   gput_uploadArray(a, data);
+   gla_finish();
+   model->uploadBytesPerSecond = bytes / (gptime_getSeconds() - start);
+
+   start = gptime_getSeconds();
+   for (int i = 0; i < GPD_CALIBRATION_DRAWS; i++) {
+      gput_runBinaryOp(GPUT_BINARY_ADD, small, small, smallOut);
+   }
+   gla_finish();
+   model->drawSeconds =
+      (gptime_getSeconds() - start) / GPD_CALIBRATION_DRAWS;
+
+   start = gptime_getSeconds();
+   gput_runBinaryOp(GPUT_BINARY_ADD, a, a, out);
+   gla_finish();
+   double drawTime = gptime_getSeconds() - start - model->drawSeconds;
+   model->gpuElementSeconds = (drawTime > 0 ? drawTime : 0) / components;
+
+   start = gptime_getSeconds();
+   gput_downloadArray(out, result);
+   model->downloadBytesPerSecond = bytes / (gptime_getSeconds() - start);
+
+   start = gptime_getSeconds();
+   gpcpu_runBinaryOp(GPUT_BINARY_ADD, VEC4_UI32, data, data, result,
+      (size_t) size * size
+   );
+   model->cpuElementSeconds = (gptime_getSeconds() - start) / components;
+
+   gput_deleteArray(a);
+   gput_deleteArray(out);
+   gput_deleteArray(small);
+   gput_deleteArray(smallOut);
+   free(data);
+   free(result);
+
+   GPUT_LOG_INFO("Cost model of %s: upload %.0f MB/s, download %.0f MB/s, "
+      "draw %.1f us, GPU %.3f ns/element, CPU %.3f ns/element",
+      gpctx_getDeviceName(gpctx_getCurrentDevice()),
+      model->uploadBytesPerSecond * 1e-6,
+      model->downloadBytesPerSecond * 1e-6, model->drawSeconds * 1e6,
+      model->gpuElementSeconds * 1e9, model->cpuElementSeconds * 1e9
+   );
+}
+
+static void setModel(int device, const GputCostModel* model)
+{
+   models[device] = *model;
+   calibrated[device] = true;
+   for (int kind = 0; kind < OP_KINDS_COUNT; kind++) {
+      splitCpuSeconds[device][kind] = model->cpuElementSeconds;
+      splitGpuSeconds[device][kind] = model->gpuElementSeconds;
+   }
+}
+
+static GputCostModel* getModel()
+{
+   int device = gpctx_getCurrentDeviceIndex();
+   if (!calibrated[device]) {
+      GputCostModel model = {0};
+      calibrate(&model);
+      setModel(device, &model);
+   }
+   return &models[device];
+}
+
+void gput_setDispatchPolicy(GputDispatchPolicy newPolicy)
+{
+   policy = newPolicy;
+}
+
+void gput_setDispatchThresholds(size_t newCpuBelow, size_t newGpuFrom)
+{
+   cpuBelow = newCpuBelow;
+   gpuFrom = newGpuFrom;
+}
+
+void gput_getCostModel(GputCostModel* model)
+{
+   GPUT_ASSERT(gpuEnabled, "Cost model needs the GPU backend");
+   if (gpuEnabled) {
+      pthread_mutex_lock(&dispatchMutex);
+      *model = *getModel();
+      pthread_mutex_unlock(&dispatchMutex);
+   }
+}
+
+void gput_setCostModel(const GputCostModel* model)
+{
+   GPUT_ASSERT(gpuEnabled, "Cost model needs the GPU backend");
+   if (gpuEnabled) {
+      int device = gpctx_getCurrentDeviceIndex();
+      pthread_mutex_lock(&dispatchMutex);
+      setModel(device, model);
+      pthread_mutex_unlock(&dispatchMutex);
+   }
+}
+
+typedef enum {
+   TARGET_CPU,
+   TARGET_GPU,
+   TARGET_SPLIT
+} Target;
+
+static const char* targetNames[] = {"CPU", "GPU", "CPU+GPU"};
+
+// Share of the components given to the GPU when splitting, so that its slice
+// is ready when the CPU finishes its own
+static double getGpuShare(int device, OpKind kind)
+{
+   getModel();
+   double cpuSeconds = splitCpuSeconds[device][kind];
+   double gpuSeconds = splitGpuSeconds[device][kind];
+   return cpuSeconds + gpuSeconds > 0
+      ? cpuSeconds / (cpuSeconds + gpuSeconds) : 0.5;
+}
+
+static Target chooseTarget(
+   const char* opName, OpKind kind, size_t components, int rows,
+   size_t uploadBytes, size_t downloadBytes
+){
+   if (!gpuEnabled || policy == GPUT_DISPATCH_CPU) {
+      return TARGET_CPU;
+   }
+   if (policy == GPUT_DISPATCH_GPU) {
+      return TARGET_GPU;
+   }
+   if (policy == GPUT_DISPATCH_SPLIT) {
+      return rows > 1 ? TARGET_SPLIT : TARGET_GPU;
+   }
+
+   if (cpuBelow != 0 && components < cpuBelow) {
+      GPUT_LOG_DEBUG("%s of %zu components: CPU (threshold)",
+         opName, components
+      );
+      return TARGET_CPU;
+   }
+   if (gpuFrom != 0 && components >= gpuFrom) {
+      GPUT_LOG_DEBUG("%s of %zu components: GPU (threshold)",
+         opName, components
+      );
+      return TARGET_GPU;
+   }
+
+   int device = gpctx_getCurrentDeviceIndex();
+   const GputCostModel* model = getModel();
+   double transferCost = uploadBytes / model->uploadBytesPerSecond
+      + downloadBytes / model->downloadBytesPerSecond;
+   double cpuCost = components * model->cpuElementSeconds;
+   double gpuCost = transferCost + model->drawSeconds
+      + components * model->gpuElementSeconds;
+
+   // The CPU works on its slice while the GPU computes, but the transfers
+   // happen on the calling thread
+   double gpuShare = getGpuShare(device, kind);
+   double splitCost = gpuShare * transferCost + model->drawSeconds
+      + components * gpuShare * splitGpuSeconds[device][kind];
+
+   Target target = gpuCost < cpuCost ? TARGET_GPU : TARGET_CPU;
+   if (rows > 1 && splitCost < (gpuCost < cpuCost ? gpuCost : cpuCost)) {
+      target = TARGET_SPLIT;
+   }
+   GPUT_LOG_DEBUG("%s of %zu components: %s "
+      "(CPU %.1f us, GPU %.1f us, CPU+GPU %.1f us)",
+      opName, components, targetNames[target],
+      cpuCost * 1e6, gpuCost * 1e6, splitCost * 1e6
+   );
+   return target;
+}
+
+static GputArray* getStaging(
+   StagingSlot slot, GlDataType dataType, int width, int height
+){
+   GputArray** array = &staging[gpctx_getCurrentDeviceIndex()][slot];
+   if (*array != NULL
+      && ((*array)->dataType != dataType
+         || (*array)->width != width
+         || (*array)->height != height)
+   ){
+      gput_deleteArray(*array);
+      *array = NULL;
+   }
+
+   if (*array == NULL) {
+      *array = gput_createArrayOnBackend(
+         GPUT_BACKEND_GPU, dataType, width, height, NULL
+      );
+   }
+   return *array;
+}
+
+static GputArray* uploadStaging(
+   StagingSlot slot, const GputHostArray* host, int rowsCount
+){
+   GputArray* array =
+      getStaging(slot, host->dataType, host->width, host->height);
+   gpa_uploadRows(array, 0, rowsCount, host->data);
+   return array;
+}
+
+static size_t getHostArraySize(const GputHostArray* array)
+{
+   return (size_t) array->width * array->height
+      * gla_getDataTypeSize(array->dataType);
+}
+
+// The GPU takes the first rows of a split operation and the CPU the others,
+// in pieces so that the GPU completion can be observed in between
+typedef struct {
+   OpKind kind;
+   int gpuRows;
+   size_t gpuComponents;
+   size_t cpuComponents;
+   GlFence fence;
+   double kernelStart;
+   double gpuDone;
+   double cpuStart;
+} Split;
+
+static int getSplitRows(OpKind kind, int height)
+{
+   int device = gpctx_getCurrentDeviceIndex();
+   int rows = (int) (height * getGpuShare(device, kind) + 0.5);
+   return rows < 1 ? 1 : rows >= height ? height - 1 : rows;
+}
+
+static void startCpuSlice(Split* split)
+{
+   split->fence = gla_createFence();
+   split->gpuDone = -1;
+   split->cpuStart = gptime_getSeconds();
+}
+
+static void pollGpuSlice(Split* split)
+{
+   if (split->gpuDone < 0 && gla_isFenceSignaled(split->fence)) {
+      split->gpuDone = gptime_getSeconds();
+   }
+}
+
+static void finishSplit(Split* split)
+{
+   double cpuTime = gptime_getSeconds() - split->cpuStart;
+   gptr_end("CPU slice", split->cpuStart);
+   if (split->gpuDone < 0) {
+      gla_waitFence(split->fence);
+      split->gpuDone = gptime_getSeconds();
+   }
+   gla_deleteFence(split->fence);
+
+   // The GPU time is only known to the granularity of the CPU pieces, which
+   // is enough for the split to settle
+   int device = gpctx_getCurrentDeviceIndex();
+   double measuredCpu = cpuTime / split->cpuComponents;
+   double measuredGpu = (split->gpuDone - split->kernelStart)
+      / split->gpuComponents;
+   double* cpuSeconds = &splitCpuSeconds[device][split->kind];
+   double* gpuSeconds = &splitGpuSeconds[device][split->kind];
+   *cpuSeconds = GPD_SPLIT_SMOOTHING * measuredCpu
+      + (1 - GPD_SPLIT_SMOOTHING) * *cpuSeconds;
+   *gpuSeconds = GPD_SPLIT_SMOOTHING * measuredGpu
+      + (1 - GPD_SPLIT_SMOOTHING) * *gpuSeconds;
+
+   GPUT_LOG_DEBUG("Split of %d rows on the GPU: CPU %.1f us, GPU %.1f us, "
+      "GPU share now %.3f", split->gpuRows, cpuTime * 1e6,
+      (split->gpuDone - split->kernelStart) * 1e6,
+      getGpuShare(device, split->kind)
+   );
+}
+
+static size_t getPieceBegin(size_t count, int piece)
+{
+   return count * piece / GPD_SPLIT_PIECES;
+}
+
+static void runSplitBinaryOp(
+   GputBinaryOp op,
+   const GputHostArray* a, const GputHostArray* b, GputHostArray* output
+){
+   int components = gla_getDataTypeComponents(output->dataType);
+   int elementSize = gla_getDataTypeSize(output->dataType);
+   Split split = {
+      .kind = OP_KIND_BINARY,
+      .gpuRows = getSplitRows(OP_KIND_BINARY, output->height)
+   };
+   size_t gpuElements = (size_t) split.gpuRows * output->width;
+   size_t cpuElements =
+      (size_t) output->width * output->height - gpuElements;
+   split.gpuComponents = gpuElements * components;
+   split.cpuComponents = cpuElements * components;
+
+   GputArray* gpuA = uploadStaging(STAGING_A, a, split.gpuRows);
+   GputArray* gpuB = uploadStaging(STAGING_B, b, split.gpuRows);
+   GputArray* gpuOutput = getStaging(STAGING_OUTPUT,
+      output->dataType, output->width, output->height
+   );
+   split.kernelStart = gptime_getSeconds();
+   gpo_runBinaryOpRows(op, gpuA, gpuB, gpuOutput, split.gpuRows);
+   startCpuSlice(&split);
+
+   for (int piece = 0; piece < GPD_SPLIT_PIECES; piece++) {
+      size_t begin = getPieceBegin(cpuElements, piece);
+      size_t end = getPieceBegin(cpuElements, piece + 1);
+      size_t offset = (gpuElements + begin) * elementSize;
+      if (end > begin) {
+         gpcpu_runBinaryOp(op, output->dataType,
+            (const char*) a->data + offset, (const char*) b->data + offset,
+            (char*) output->data + offset, end - begin
+         );
+      }
+      pollGpuSlice(&split);
+   }
+
+   finishSplit(&split);
+   gpa_downloadRows(gpuOutput, 0, split.gpuRows, output->data);
+}
+
+static void runSplitReduce(
+   GputReduceOp op, const GputHostArray* array, void* result
+){
+   int components = gla_getDataTypeComponents(array->dataType);
+   int elementSize = gla_getDataTypeSize(array->dataType);
+   Split split = {
+      .kind = OP_KIND_REDUCE,
+      .gpuRows = getSplitRows(OP_KIND_REDUCE, array->height)
+   };
+   size_t gpuElements = (size_t) split.gpuRows * array->width;
+   size_t cpuElements = (size_t) array->width * array->height - gpuElements;
+   split.gpuComponents = gpuElements * components;
+   split.cpuComponents = cpuElements * components;
+
+   // Row results of the GPU followed by one partial result per CPU piece
+   char* partials = malloc(
+      (size_t) (split.gpuRows + GPD_SPLIT_PIECES) * elementSize
+   );
+   GPUT_ASSERT(partials != NULL, "Could not allocate partial results");
+   if (partials == NULL) {
+      return;
+   }
+   int partialsCount = split.gpuRows;
+
+   GputArray* gpuArray = uploadStaging(STAGING_A, array, split.gpuRows);
+   GputArray* gpuRows =
+      getStaging(STAGING_ROWS, array->dataType, 1, array->height);
+   split.kernelStart = gptime_getSeconds();
+   gpo_reduceRows(op, gpuArray, gpuRows, split.gpuRows);
+   startCpuSlice(&split);
+
+   for (int piece = 0; piece < GPD_SPLIT_PIECES; piece++) {
+      size_t begin = getPieceBegin(cpuElements, piece);
+      size_t end = getPieceBegin(cpuElements, piece + 1);
+      if (end > begin) {
+         gpcpu_reduce(op, array->dataType,
+            (const char*) array->data + (gpuElements + begin) * elementSize,
+            end - begin, partials + (size_t) partialsCount * elementSize
+         );
+         partialsCount++;
+      }
+      pollGpuSlice(&split);
+   }
+
+   finishSplit(&split);
+   gpa_downloadRows(gpuRows, 0, split.gpuRows, partials);
+   gpcpu_reduce(op, array->dataType, partials, partialsCount, result);
+   free(partials);
+}
+
+void gput_computeBinaryOp(
+   GputBinaryOp op,
+   const GputHostArray* a, const GputHostArray* b, GputHostArray* output
+){
+   size_t elements = (size_t) output->width * output->height;
+   size_t components = elements
+      * gla_getDataTypeComponents(output->dataType);
+   size_t size = getHostArraySize(output);
+   double traceStart = gptr_begin();
+
+   // Three component types are not renderable and always stay on the CPU
+   pthread_mutex_lock(&dispatchMutex);
+   Target target = TARGET_CPU;
+   if (gla_getDataTypeComponents(output->dataType) != 3) {
+      target = chooseTarget("Binary operation", OP_KIND_BINARY,
+         components, output->height, 2 * size, size
+      );
+   }
+
+   if (target == TARGET_GPU) {
+      GputArray* gpuA = uploadStaging(STAGING_A, a, a->height);
+      GputArray* gpuB = uploadStaging(STAGING_B, b, b->height);
+      GputArray* gpuOutput = getStaging(STAGING_OUTPUT,
+         output->dataType, output->width, output->height
+      );
+      gput_runBinaryOp(op, gpuA, gpuB, gpuOutput);
+      gput_downloadArray(gpuOutput, output->data);
+   }
+   else if (target == TARGET_SPLIT) {
+      runSplitBinaryOp(op, a, b, output);
+   }
+   pthread_mutex_unlock(&dispatchMutex);
+
+   if (target == TARGET_CPU) {
+      gpcpu_runBinaryOp(
+         op, output->dataType, a->data, b->data, output->data, elements
+      );
+   }
+   gptr_end("compute binary op", traceStart);
+}
+
+void gput_computeReduce(
+   GputReduceOp op, const GputHostArray* array, void* result
+){
+   size_t elements = (size_t) array->width * array->height;
+   size_t components = elements * gla_getDataTypeComponents(array->dataType);
+   size_t rowsSize = (size_t) array->height
+      * gla_getDataTypeSize(array->dataType);
+   double traceStart = gptr_begin();
+
+   pthread_mutex_lock(&dispatchMutex);
+   Target target = TARGET_CPU;
+   if (gla_getDataTypeComponents(array->dataType) != 3) {
+      target = chooseTarget("Reduction", OP_KIND_REDUCE,
+         components, array->height, getHostArraySize(array), rowsSize
+      );
+   }
+
+   if (target == TARGET_GPU) {
+      gput_reduceArray(op, uploadStaging(STAGING_A, array, array->height),
+         result
+      );
+   }
+   else if (target == TARGET_SPLIT) {
+      runSplitReduce(op, array, result);
+   }
+   pthread_mutex_unlock(&dispatchMutex);
+
+   if (target == TARGET_CPU) {
+      gpcpu_reduce(op, array->dataType, array->data, elements, result);
+   }
+   gptr_end("compute reduce", traceStart);
+}
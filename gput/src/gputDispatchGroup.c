@@ -0,0 +1,258 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include "gputArray.h"
+#include "gputDebug.h"
+#include "gputDispatchGroup.h"
+#include "gputKernel.h"
+#include "gputTime.h"
+#include "gputTrace.h"
+
+GputDispatchGroup* gput_createDispatchGroup(
+   GputDevice* devices[], int devicesCount,
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+){
+   if (devicesCount <= 0 || devicesCount > GPCTX_MAX_DEVICES) {
+      GPUT_LOG_ERROR("Invalid dispatch group devices count %d", devicesCount);
+      return NULL;
+   }
+
+   GputDispatchGroup* group = calloc(1, sizeof(GputDispatchGroup));
+   GPUT_ASSERT(group != NULL, "Could not allocate dispatch group");
+   if (group == NULL) {
+      return NULL;
+   }
+
+   // Compiled asynchronously so that the devices compile concurrently
+   GputDevice* callerDevice = gpctx_getCurrentDevice();
+   group->devicesCount = devicesCount;
+   for (int i = 0; i < devicesCount; i++) {
+      group->devices[i] = devices[i];
+      if (gpctx_setDevice(devices[i])) {
+         group->kernels[i] = spec
+            ? gput_createSpecializedKernelAsync(
+               source, spec, params, paramsCount
+            )
+            : gput_createKernelAsync(source, params, paramsCount);
+      }
+
+      // Only the kernels created so far are deleted
+      if (group->kernels[i] == NULL) {
+         gpctx_setDevice(callerDevice);
+         group->devicesCount = i;
+         gput_deleteDispatchGroup(group);
+         return NULL;
+      }
+   }
+   gpctx_setDevice(callerDevice);
+   return group;
+}
+
+void gput_setDispatchGroupParam(
+   GputDispatchGroup* group, int paramIndex, const void* value
+){
+   for (int i = 0; i < group->devicesCount; i++) {
+      gput_setKernelParam(group->kernels[i], paramIndex, value);
+   }
+}
+
+static void updateArray(GputArray** array, const GputHostArray* hostArray)
+{
+   if (*array != NULL
+      && ((*array)->dataType != hostArray->dataType
+         || (*array)->width != hostArray->width
+         || (*array)->height != hostArray->height)
+   ){
+      gput_deleteArray(*array);
+      *array = NULL;
+   }
+
+   if (*array == NULL) {
+      *array = gput_createArray(hostArray->dataType,
+         hostArray->width, hostArray->height, hostArray->data
+      );
+   }
+   else if (hostArray->data != NULL) {
+      gput_uploadArray(*array, hostArray->data);
+   }
+}
+
+static void partitionRows(GputDispatchGroup* group, int height, int rows[])
+{
+   // Even split until every device has been measured
+   double weights[GPCTX_MAX_DEVICES];
+   double weightsSum = 0;
+   bool measured = true;
+   for (int i = 0; i < group->devicesCount; i++) {
+      measured = measured && group->rowsPerSecond[i] > 0;
+   }
+   for (int i = 0; i < group->devicesCount; i++) {
+      weights[i] = measured ? group->rowsPerSecond[i] : 1;
+      weightsSum += weights[i];
+   }
+
+   int assignedRows = 0;
+   int fastest = 0;
+   for (int i = 0; i < group->devicesCount; i++) {
+      rows[i] = (int) (height * weights[i] / weightsSum);
+      assignedRows += rows[i];
+      if (weights[i] > weights[fastest]) {
+         fastest = i;
+      }
+   }
+   rows[fastest] += height - assignedRows;
+
+   // A device measured much slower than the others still gets a row, so
+   // that its throughput keeps being measured
+   if (height < group->devicesCount) {
+      return;
+   }
+   for (int i = 0; i < group->devicesCount; i++) {
+      if (rows[i] == 0) {
+         int largest = 0;
+         for (int j = 1; j < group->devicesCount; j++) {
+            if (rows[j] > rows[largest]) {
+               largest = j;
+            }
+         }
+         rows[largest]--;
+         rows[i]++;
+      }
+   }
+}
+
+void gput_runDispatchGroup(
+   GputDispatchGroup* group,
+   const GputHostArray inputs[], int inputsCount, GputHostArray* output
+){
+   if (inputsCount < 0 || inputsCount > GPUT_MAX_KERNEL_INPUTS) {
+      GPUT_LOG_ERROR("Invalid kernel inputs count %d", inputsCount);
+      return;
+   }
+
+   GputDevice* callerDevice = gpctx_getCurrentDevice();
+   double traceStart = gptr_begin();
+   int rows[GPCTX_MAX_DEVICES];
+   int firstRows[GPCTX_MAX_DEVICES];
+   double startTimes[GPCTX_MAX_DEVICES];
+   double elapsedTimes[GPCTX_MAX_DEVICES];
+   GlFence fences[GPCTX_MAX_DEVICES];
+   partitionRows(group, output->height, rows);
+
+   // Each device is flushed right after its draw so that all of them work
+   // while the following ones are being set up
+   GputHostArray outputShape = *output;
+   outputShape.data = NULL;
+   int firstRow = 0;
+   int pendingCount = 0;
+   for (int i = 0; i < group->devicesCount; i++) {
+      firstRows[i] = firstRow;
+      elapsedTimes[i] = -1;
+      fences[i] = NULL;
+      if (rows[i] == 0) {
+         continue;
+      }
+
+      gpctx_setDevice(group->devices[i]);
+      for (int j = 0; j < inputsCount; j++) {
+         updateArray(&group->inputs[i][j], &inputs[j]);
+      }
+      updateArray(&group->outputs[i], &outputShape);
+
+      startTimes[i] = gptime_getSeconds();
+      gpk_runKernelRows(group->kernels[i],
+         group->inputs[i], inputsCount, group->outputs[i], firstRow, rows[i]
+      );
+      fences[i] = gla_createFence();
+      firstRow += rows[i];
+      pendingCount++;
+   }
+
+   // Polled rather than waited on in order, so that the time of each device
+   // is not inflated by the devices before it
+   while (pendingCount > 0) {
+      bool signaled = false;
+      for (int i = 0; i < group->devicesCount; i++) {
+         if (fences[i] == NULL || elapsedTimes[i] >= 0) {
+            continue;
+         }
+         gpctx_setDevice(group->devices[i]);
+         if (gla_isFenceSignaled(fences[i])) {
+            elapsedTimes[i] = gptime_getSeconds() - startTimes[i];
+            pendingCount--;
+            signaled = true;
+         }
+      }
+      if (!signaled) {
+         sched_yield();
+      }
+   }
+
+   int rowSize = output->width * gla_getDataTypeSize(output->dataType);
+   for (int i = 0; i < group->devicesCount; i++) {
+      if (fences[i] == NULL) {
+         continue;
+      }
+
+      gpctx_setDevice(group->devices[i]);
+      gla_deleteFence(fences[i]);
+      gpa_downloadRows(group->outputs[i], firstRows[i], rows[i],
+         (char*) output->data + (size_t) firstRows[i] * rowSize
+      );
+
+      double rowsPerSecond = rows[i] / (elapsedTimes[i] > 0
+         ? elapsedTimes[i] : 1e-6
+      );
+      group->rowsPerSecond[i] = group->rowsPerSecond[i] > 0
+         ? GPDG_THROUGHPUT_SMOOTHING * rowsPerSecond
+            + (1 - GPDG_THROUGHPUT_SMOOTHING) * group->rowsPerSecond[i]
+         : rowsPerSecond;
+   }
+
+   gpctx_setDevice(callerDevice);
+   gptr_end("dispatch group", traceStart);
+}
+
+void gput_deleteDispatchGroup(GputDispatchGroup* group)
+{
+   GputDevice* callerDevice = gpctx_getCurrentDevice();
+   for (int i = 0; i < group->devicesCount; i++) {
+      gpctx_setDevice(group->devices[i]);
+      for (int j = 0; j < GPUT_MAX_KERNEL_INPUTS; j++) {
+         if (group->inputs[i][j] != NULL) {
+            gput_deleteArray(group->inputs[i][j]);
+         }
+      }
+      if (group->outputs[i] != NULL) {
+         gput_deleteArray(group->outputs[i]);
+      }
+      gput_deleteKernel(group->kernels[i]);
+   }
+   gpctx_setDevice(callerDevice);
+   free(group);
+}
@@ -0,0 +1,44 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "gput.h"
+#include "gputContext.h"
+
+// Weight of the latest measurement in the throughput estimate of a device
+#define GPDG_THROUGHPUT_SMOOTHING 0.5
+
+struct GputDispatchGroup {
+   int devicesCount;
+   GputDevice* devices[GPCTX_MAX_DEVICES];
+   GputKernel* kernels[GPCTX_MAX_DEVICES];
+
+   // Device copies of the host arrays, reused while their shape is unchanged
+   GputArray* inputs[GPCTX_MAX_DEVICES][GPUT_MAX_KERNEL_INPUTS];
+   GputArray* outputs[GPCTX_MAX_DEVICES];
+
+   // Output rows computed per second, zero until measured
+   double rowsPerSecond[GPCTX_MAX_DEVICES];
+};
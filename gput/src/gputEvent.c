@@ -0,0 +1,383 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputEvent.h"
+#include "gputProfile.h"
+#include "gputTrace.h"
+#include "gputTime.h"
+#include "GlAbstract.h"
+
+struct GputEvent {
+   GputDevice* device;
+   // NULL once the event completed
+   GlFence fence;
+   // Pending download, copied to readData on completion
+   GlPendingRead read;
+   void* readData;
+   // Array of the pending download, pinned until it completes
+   GputArray* array;
+   atomic_bool done;
+   atomic_int refCount;
+   // Once a callback is set the completion thread owns the fence
+   bool watched;
+   GputEventCallback callback;
+   void* userData;
+   GputEvent* next;
+};
+
+static pthread_mutex_t eventsMutex = PTHREAD_MUTEX_INITIALIZER;
+// Signaled when watched events complete
+static pthread_cond_t completionCond = PTHREAD_COND_INITIALIZER;
+// Signaled when events are handed to the completion thread
+static pthread_cond_t watchCond = PTHREAD_COND_INITIALIZER;
+
+static bool completionRunning;
+static bool stopping;
+static pthread_t completionThread;
+static GputEvent* watchedEvents;
+
+static GputEvent* createEvent(GputDevice* device, GlFence fence)
+{
+   GputEvent* event = calloc(1, sizeof(GputEvent));
+   GPUT_ASSERT(event != NULL, "Could not allocate event");
+   if (event == NULL) {
+      return NULL;
+   }
+
+   event->device = device;
+   event->fence = fence;
+   atomic_init(&event->done, fence == NULL);
+   atomic_init(&event->refCount, 1);
+   return event;
+}
+
+GputEvent* gput_createEvent()
+{
+   GputDevice* device = gpctx_getCurrentDevice();
+   GPUT_ASSERT(device != NULL, "No device selected");
+   if (device == NULL) {
+      return NULL;
+   }
+   return createEvent(device, gla_createFence());
+}
+
+GputEvent* gput_downloadArrayAsync(GputArray* array, void* data)
+{
+   if (array->backend == GPUT_BACKEND_CPU) {
+      memcpy(data, array->hostData, gpa_getSize(array));
+      return createEvent(NULL, NULL);
+   }
+
+   GPUT_ASSERT(array->device == gpctx_getCurrentDevice(),
+      "Array used while another device is selected"
+   );
+   if (!gpa_isRenderable(array)) {
+      GPUT_LOG_ERROR("Three component arrays can't be downloaded");
+      return NULL;
+   }
+   gpa_makeResident(&array, 1);
+   gpa_waitWrites(array);
+   gla_bindFramebuffer(gpa_getFramebuffer(array));
+
+   GputEvent* event = createEvent(array->device, NULL);
+   if (event != NULL) {
+      GppScope* scope = gpp_begin("download");
+      gla_readFramebufferAsync(array->dataType,
+         0, 0, array->width, array->height, &event->read
+      );
+      gpp_end(scope);
+      event->readData = data;
+      event->array = array;
+      gpa_pin(array);
+      event->fence = gla_createFence();
+      atomic_store(&event->done, false);
+   }
+   return event;
+}
+
+// Must be called with a context of the event's device current, by the only
+// thread completing the event
+static void complete(GputEvent* event)
+{
+   if (event->read.buffer != 0) {
+      double traceStart = gptr_begin();
+      gla_finishRead(&event->read, event->readData);
+      gptr_end("read back", traceStart);
+   }
+   gla_deleteFence(event->fence);
+   event->fence = NULL;
+   if (event->array != NULL) {
+      gpa_unpin(event->array);
+      event->array = NULL;
+   }
+
+   pthread_mutex_lock(&eventsMutex);
+   atomic_store(&event->done, true);
+   pthread_cond_broadcast(&completionCond);
+   pthread_mutex_unlock(&eventsMutex);
+}
+
+// Waits for the fence of an event that is not watched, on its device
+static bool waitUnwatched(GputEvent* event, double timeoutSeconds)
+{
+   GputDevice* callerDevice = gpctx_getCurrentDevice();
+   if (event->device != callerDevice) {
+      gpctx_setDevice(event->device);
+   }
+
+   bool signaled;
+   if (timeoutSeconds < 0) {
+      gla_waitFence(event->fence);
+      signaled = true;
+   }
+   else if (timeoutSeconds == 0) {
+      signaled = gla_isFenceSignaled(event->fence);
+   }
+   else {
+      signaled = gla_waitFenceTimeout(event->fence, timeoutSeconds);
+   }
+   if (signaled) {
+      complete(event);
+   }
+
+   if (event->device != callerDevice && callerDevice != NULL) {
+      gpctx_setDevice(callerDevice);
+   }
+   return signaled;
+}
+
+static void getDeadline(double timeoutSeconds, struct timespec* deadline)
+{
+   clock_gettime(CLOCK_REALTIME, deadline);
+   long nanoseconds = deadline->tv_nsec + (long) (
+      (timeoutSeconds - (long) timeoutSeconds) * 1e9
+   );
+   deadline->tv_sec += (time_t) timeoutSeconds + nanoseconds / 1000000000;
+   deadline->tv_nsec = nanoseconds % 1000000000;
+}
+
+// Waits for a watched event to be completed by the completion thread
+static bool waitWatched(GputEvent* event, double timeoutSeconds)
+{
+   struct timespec deadline;
+   if (timeoutSeconds > 0) {
+      getDeadline(timeoutSeconds, &deadline);
+   }
+
+   pthread_mutex_lock(&eventsMutex);
+   bool timedOut = false;
+   while (!atomic_load(&event->done) && !timedOut && timeoutSeconds != 0) {
+      if (timeoutSeconds < 0) {
+         pthread_cond_wait(&completionCond, &eventsMutex);
+      }
+      else {
+         timedOut = pthread_cond_timedwait(
+            &completionCond, &eventsMutex, &deadline
+         ) != 0;
+      }
+   }
+   pthread_mutex_unlock(&eventsMutex);
+   return atomic_load(&event->done);
+}
+
+bool gput_isEventDone(GputEvent* event)
+{
+   if (atomic_load(&event->done)) {
+      return true;
+   }
+   return !event->watched && waitUnwatched(event, 0);
+}
+
+bool gput_waitEvent(GputEvent* event, double timeoutSeconds)
+{
+   if (atomic_load(&event->done)) {
+      return true;
+   }
+
+   double traceStart = gptr_begin();
+   bool done = event->watched
+      ? waitWatched(event, timeoutSeconds)
+      : waitUnwatched(event, timeoutSeconds);
+   gptr_end("wait event", traceStart);
+   return done;
+}
+
+int gput_waitAnyEvent(
+   GputEvent* events[], int eventsCount, double timeoutSeconds
+){
+   double deadline = gptime_getSeconds() + timeoutSeconds;
+   while (true) {
+      for (int i = 0; i < eventsCount; i++) {
+         if (gput_isEventDone(events[i])) {
+            return i;
+         }
+      }
+
+      double remaining = deadline - gptime_getSeconds();
+      if (timeoutSeconds >= 0 && remaining <= 0) {
+         return -1;
+      }
+
+      // Blocks on one of the events for a short while, which bounds how
+      // late the others are noticed
+      double slice = timeoutSeconds < 0 || remaining > GPE_POLL_SECONDS
+         ? GPE_POLL_SECONDS : remaining;
+      int unwatched = 0;
+      while (unwatched < eventsCount && events[unwatched]->watched) {
+         unwatched++;
+      }
+      if (unwatched < eventsCount) {
+         waitUnwatched(events[unwatched], slice);
+      }
+      else {
+         waitWatched(events[0], slice);
+      }
+   }
+}
+
+static void* completionThreadMain(void* arg)
+{
+   GputEvent* pending = NULL;
+
+   pthread_mutex_lock(&eventsMutex);
+   while (true) {
+      while (watchedEvents == NULL && pending == NULL && !stopping) {
+         pthread_cond_wait(&watchCond, &eventsMutex);
+      }
+      if (watchedEvents == NULL && pending == NULL) {
+         break;
+      }
+
+      // Takes over the newly watched events
+      while (watchedEvents != NULL) {
+         GputEvent* event = watchedEvents;
+         watchedEvents = event->next;
+         event->next = pending;
+         pending = event;
+      }
+      pthread_mutex_unlock(&eventsMutex);
+
+      GputEvent** link = &pending;
+      bool completed = false;
+      while (*link != NULL) {
+         GputEvent* event = *link;
+         if (event->fence != NULL) {
+            gpctx_setDevice(event->device);
+            if (!gla_isFenceSignaled(event->fence)) {
+               link = &event->next;
+               continue;
+            }
+            complete(event);
+         }
+
+         *link = event->next;
+         completed = true;
+         event->callback(event, event->userData);
+         gput_releaseEvent(event);
+      }
+
+      if (!completed && pending != NULL) {
+         gpctx_setDevice(pending->device);
+         gla_waitFenceTimeout(pending->fence, GPE_POLL_SECONDS);
+      }
+      pthread_mutex_lock(&eventsMutex);
+   }
+   pthread_mutex_unlock(&eventsMutex);
+
+   gpp_flushThread();
+   gpctx_detachThread();
+   return NULL;
+}
+
+void gput_setEventCallback(
+   GputEvent* event, GputEventCallback callback, void* userData
+){
+   GPUT_ASSERT(!event->watched, "Event already has a callback");
+
+   pthread_mutex_lock(&eventsMutex);
+   if (!completionRunning) {
+      stopping = false;
+      completionRunning = pthread_create(
+         &completionThread, NULL, completionThreadMain, NULL
+      ) == 0;
+      GPUT_ASSERT(completionRunning, "Could not start completion thread");
+   }
+
+   // The completion thread holds a reference until the callback returned
+   event->callback = callback;
+   event->userData = userData;
+   event->watched = true;
+   atomic_fetch_add(&event->refCount, 1);
+   event->next = watchedEvents;
+   watchedEvents = event;
+   pthread_cond_signal(&watchCond);
+   pthread_mutex_unlock(&eventsMutex);
+}
+
+void gput_releaseEvent(GputEvent* event)
+{
+   if (event == NULL || atomic_fetch_sub(&event->refCount, 1) != 1) {
+      return;
+   }
+
+   // Only an event that was never watched can still hold GL objects
+   if (event->fence != NULL) {
+      GputDevice* callerDevice = gpctx_getCurrentDevice();
+      gpctx_setDevice(event->device);
+      if (event->read.buffer != 0) {
+         gla_deleteBuffer(event->read.buffer);
+      }
+      gla_deleteFence(event->fence);
+      if (event->array != NULL) {
+         gpa_unpin(event->array);
+      }
+      if (callerDevice != NULL) {
+         gpctx_setDevice(callerDevice);
+      }
+   }
+   free(event);
+}
+
+void gpe_terminate()
+{
+   pthread_mutex_lock(&eventsMutex);
+   bool running = completionRunning;
+   stopping = true;
+   pthread_cond_signal(&watchCond);
+   pthread_mutex_unlock(&eventsMutex);
+
+   if (running) {
+      pthread_join(completionThread, NULL);
+      completionRunning = false;
+   }
+}
@@ -0,0 +1,316 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gput.h"
+#include "gputDebug.h"
+#include "gputGlStats.h"
+
+#ifdef GPUT_GL_STATS
+
+#define NAME_SIZE 48
+
+// Statistics of a GL function over its call sites
+typedef struct {
+   char name[NAME_SIZE];
+   uint64_t count;
+   uint64_t nanoseconds;
+} CallStats;
+
+static pthread_mutex_t sitesMutex = PTHREAD_MUTEX_INITIALIZER;
+static GpglSite* sites[GPGL_MAX_SITES];
+static int sitesCount;
+
+static atomic_uint_fast64_t dispatchesCount;
+static atomic_uint_fast64_t histogramCounts[GPGL_HISTOGRAM_BUCKETS];
+static atomic_uint_fast64_t histogramCalls[GPGL_HISTOGRAM_BUCKETS];
+static atomic_uint_fast64_t histogramNanoseconds[GPGL_HISTOGRAM_BUCKETS];
+
+static _Thread_local bool inDispatch;
+static _Thread_local uint64_t threadDispatchCalls;
+static _Thread_local uint64_t threadDispatchNanoseconds;
+
+static uint64_t getNanoseconds()
+{
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void registerSite(GpglSite* site)
+{
+   if (atomic_exchange(&site->registered, true)) {
+      return;
+   }
+
+   pthread_mutex_lock(&sitesMutex);
+   GPUT_ASSERT(sitesCount < GPGL_MAX_SITES, "Too many GL call sites");
+   if (sitesCount < GPGL_MAX_SITES) {
+      sites[sitesCount++] = site;
+   }
+   pthread_mutex_unlock(&sitesMutex);
+}
+
+GpglCall gpgl_beginCall(GpglSite* site)
+{
+   if (!atomic_load_explicit(&site->registered, memory_order_relaxed)) {
+      registerSite(site);
+   }
+   return (GpglCall) {site, getNanoseconds()};
+}
+
+void gpgl_endCall(GpglCall* call)
+{
+   uint64_t nanoseconds = getNanoseconds() - call->start;
+   GpglSite* site = call->site;
+   atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed);
+   atomic_fetch_add_explicit(&site->nanoseconds, nanoseconds,
+      memory_order_relaxed
+   );
+   if (inDispatch) {
+      threadDispatchCalls++;
+      threadDispatchNanoseconds += nanoseconds;
+   }
+
+#if defined(GPUT_DEBUG) && GPUT_GL_CHECK_MODE == GPUT_GL_CHECK_GET_ERROR
+   // Checked after the clock stopped, so that the timings are the same as in
+   // Profile builds
+   GLenum errorCode = glGetError();
+   GPUT_ASSERT(errorCode == GL_NO_ERROR, "Error %s in GL call %s at %s:%d",
+      getGlErrorStr(errorCode), site->call, site->file, site->line
+   );
+#endif
+}
+
+void gpgl_beginDispatch()
+{
+   inDispatch = true;
+   threadDispatchCalls = 0;
+   threadDispatchNanoseconds = 0;
+}
+
+void gpgl_endDispatch()
+{
+   inDispatch = false;
+
+   int bucket = 0;
+   for (uint64_t microseconds = threadDispatchNanoseconds / 1000;
+      microseconds > 0 && bucket < GPGL_HISTOGRAM_BUCKETS - 1;
+      microseconds >>= 1
+   ){
+      bucket++;
+   }
+   atomic_fetch_add_explicit(&dispatchesCount, 1, memory_order_relaxed);
+   atomic_fetch_add_explicit(&histogramCounts[bucket], 1,
+      memory_order_relaxed
+   );
+   atomic_fetch_add_explicit(&histogramCalls[bucket], threadDispatchCalls,
+      memory_order_relaxed
+   );
+   atomic_fetch_add_explicit(&histogramNanoseconds[bucket],
+      threadDispatchNanoseconds, memory_order_relaxed
+   );
+}
+
+// Name of the GL function called by a GLC, the call text starting with it
+static void getCallName(const char* call, char name[NAME_SIZE])
+{
+   int length = 0;
+   while (length < NAME_SIZE - 1
+      && (call[length] == '_' || (call[length] >= '0' && call[length] <= '9')
+         || (call[length] >= 'a' && call[length] <= 'z')
+         || (call[length] >= 'A' && call[length] <= 'Z'))
+   ){
+      name[length] = call[length];
+      length++;
+   }
+   name[length] = '\0';
+}
+
+static int compareCalls(const void* a, const void* b)
+{
+   const CallStats* first = a;
+   const CallStats* second = b;
+   return (second->nanoseconds > first->nanoseconds)
+      - (second->nanoseconds < first->nanoseconds);
+}
+
+static int compareSites(const void* a, const void* b)
+{
+   uint64_t first = atomic_load(&(*(GpglSite* const*) a)->nanoseconds);
+   uint64_t second = atomic_load(&(*(GpglSite* const*) b)->nanoseconds);
+   return (second > first) - (second < first);
+}
+
+static void printCalls(GpglSite* calledSites[], int count)
+{
+   static CallStats calls[GPGL_MAX_SITES];
+   int callsCount = 0;
+   uint64_t totalNanoseconds = 0;
+   for (int i = 0; i < count; i++) {
+      char name[NAME_SIZE];
+      getCallName(calledSites[i]->call, name);
+      int j = 0;
+      while (j < callsCount && strcmp(calls[j].name, name) != 0) {
+         j++;
+      }
+      if (j == callsCount) {
+         calls[callsCount++] = (CallStats) {0};
+         strcpy(calls[j].name, name);
+      }
+      calls[j].count += atomic_load(&calledSites[i]->count);
+      uint64_t nanoseconds = atomic_load(&calledSites[i]->nanoseconds);
+      calls[j].nanoseconds += nanoseconds;
+      totalNanoseconds += nanoseconds;
+   }
+   qsort(calls, callsCount, sizeof(CallStats), compareCalls);
+
+   printf("\n%-32s %12s %12s %12s %8s\n", "GL CPU time", "calls",
+      "total (ms)", "mean (us)", "share"
+   );
+   for (int i = 0; i < callsCount; i++) {
+      const CallStats* stats = &calls[i];
+      printf("%-32.32s %12" PRIu64 " %12.3f %12.2f %7.1f%%\n",
+         stats->name, stats->count, stats->nanoseconds * 1e-6,
+         stats->count ? stats->nanoseconds * 1e-3 / stats->count : 0,
+         totalNanoseconds ? stats->nanoseconds * 100.0 / totalNanoseconds : 0
+      );
+   }
+}
+
+static void printSites(GpglSite* calledSites[], int count)
+{
+   qsort(calledSites, count, sizeof(GpglSite*), compareSites);
+
+   printf("\n%-32s %-24s %12s %12s %12s\n", "GL call site", "call", "calls",
+      "total (ms)", "mean (us)"
+   );
+   for (int i = 0; i < count && i < GPGL_MAX_SITES_REPORTED; i++) {
+      const GpglSite* site = calledSites[i];
+      uint64_t calls = atomic_load(&site->count);
+      uint64_t nanoseconds = atomic_load(&site->nanoseconds);
+      char location[64];
+      snprintf(location, sizeof(location), "%s:%d", site->function,
+         site->line
+      );
+      char name[NAME_SIZE];
+      getCallName(site->call, name);
+      printf("%-32.32s %-24.24s %12" PRIu64 " %12.3f %12.2f\n",
+         location, name, calls, nanoseconds * 1e-6,
+         calls ? nanoseconds * 1e-3 / calls : 0
+      );
+   }
+}
+
+static void printDispatches()
+{
+   uint64_t dispatches = atomic_load(&dispatchesCount);
+   if (dispatches == 0) {
+      return;
+   }
+   uint64_t calls = 0;
+   uint64_t nanoseconds = 0;
+   for (int i = 0; i < GPGL_HISTOGRAM_BUCKETS; i++) {
+      calls += atomic_load(&histogramCalls[i]);
+      nanoseconds += atomic_load(&histogramNanoseconds[i]);
+   }
+   printf("\n%" PRIu64 " dispatches, %.1f GL calls and %.2f us of GL CPU "
+      "time per dispatch\n", dispatches, (double) calls / dispatches,
+      nanoseconds * 1e-3 / dispatches
+   );
+
+   printf("\n%-32s %12s %12s %12s\n", "GL CPU time per dispatch",
+      "dispatches", "mean calls", "mean (us)"
+   );
+   for (int i = 0; i < GPGL_HISTOGRAM_BUCKETS; i++) {
+      uint64_t count = atomic_load(&histogramCounts[i]);
+      if (count == 0) {
+         continue;
+      }
+      char range[32];
+      if (i == 0) {
+         snprintf(range, sizeof(range), "< 1 us");
+      }
+      else if (i == GPGL_HISTOGRAM_BUCKETS - 1) {
+         snprintf(range, sizeof(range), ">= %d us", 1 << (i - 1));
+      }
+      else {
+         snprintf(range, sizeof(range), "%d - %d us", 1 << (i - 1), 1 << i);
+      }
+      printf("%-32s %12" PRIu64 " %12.1f %12.2f\n", range, count,
+         (double) atomic_load(&histogramCalls[i]) / count,
+         atomic_load(&histogramNanoseconds[i]) * 1e-3 / count
+      );
+   }
+}
+
+void gput_printGlStats()
+{
+   static GpglSite* calledSites[GPGL_MAX_SITES];
+   pthread_mutex_lock(&sitesMutex);
+   int count = sitesCount;
+   memcpy(calledSites, sites, count * sizeof(GpglSite*));
+   pthread_mutex_unlock(&sitesMutex);
+
+   printCalls(calledSites, count);
+   printSites(calledSites, count);
+   printDispatches();
+   putchar('\n');
+}
+
+void gpgl_terminate()
+{
+   if (sitesCount > 0) {
+      gput_printGlStats();
+   }
+
+   // Sites are static, so they start over unregistered for the next init
+   for (int i = 0; i < sitesCount; i++) {
+      atomic_store(&sites[i]->count, 0);
+      atomic_store(&sites[i]->nanoseconds, 0);
+      atomic_store(&sites[i]->registered, false);
+   }
+   sitesCount = 0;
+   atomic_store(&dispatchesCount, 0);
+   for (int i = 0; i < GPGL_HISTOGRAM_BUCKETS; i++) {
+      atomic_store(&histogramCounts[i], 0);
+      atomic_store(&histogramCalls[i], 0);
+      atomic_store(&histogramNanoseconds[i], 0);
+   }
+}
+
+#else
+
+void gput_printGlStats()
+{
+}
+
+#endif // ifdef GPUT_GL_STATS
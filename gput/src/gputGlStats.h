@@ -0,0 +1,90 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Call sites of GLC, which only exceed this with every wrapper instantiated
+#define GPGL_MAX_SITES 512
+
+// Log2 buckets of the GL time of a dispatch, the first one under 1us
+#define GPGL_HISTOGRAM_BUCKETS 16
+
+// Call sites reported individually, the most expensive first
+#define GPGL_MAX_SITES_REPORTED 16
+
+// Statistics of a GLC call site, registered on its first call
+typedef struct GpglSite {
+   const char* call;
+   const char* function;
+   const char* file;
+   int line;
+   atomic_bool registered;
+   atomic_uint_fast64_t count;
+   atomic_uint_fast64_t nanoseconds;
+} GpglSite;
+
+typedef struct {
+   GpglSite* site;
+   uint64_t start;
+} GpglCall;
+
+#ifdef GPUT_GL_STATS
+
+GpglCall gpgl_beginCall(GpglSite* site);
+
+void gpgl_endCall(GpglCall* call);
+
+// Calls made by the thread in between are accounted to one dispatch
+void gpgl_beginDispatch();
+
+void gpgl_endDispatch();
+
+// Prints the statistics when any call was made
+void gpgl_terminate();
+
+// Times the call with the CPU clock, which measures the driver overhead and
+// not the GPU work it submits. The statement expression keeps GLC usable as
+// an expression, and the cleanup stops the clock once the call returned.
+#define GPGL_CALL(glCall) \
+   ({ \
+      static GpglSite gpglSite = { \
+         .call = #glCall, .function = __func__, \
+         .file = GPUT_FILE_NAME, .line = __LINE__ \
+      }; \
+      __attribute__((cleanup(gpgl_endCall))) GpglCall gpglCall = \
+         gpgl_beginCall(&gpglSite); \
+      (void) gpglCall; \
+      glCall; \
+   })
+
+#else
+
+// Only compiled in with GPUT_GL_STATS in Debug and Profile builds
+static inline void gpgl_beginDispatch() {}
+static inline void gpgl_endDispatch() {}
+static inline void gpgl_terminate() {}
+
+#endif // ifdef GPUT_GL_STATS
@@ -0,0 +1,555 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputGlStats.h"
+#include "gputKernel.h"
+#include "gputProfile.h"
+#include "gputTrace.h"
+#include "GlProgramCache.h"
+#include "GlslTemplate.h"
+
+typedef struct {
+   GlDataType dataType;
+   const char* glslType;
+   int size;
+   int std140Alignment;
+} ParamTypeInfo;
+
+static const ParamTypeInfo paramTypesInfo[] = {
+   {I32,       "int",   4,  4},
+   {UI32,      "uint",  4,  4},
+   {F32,       "float", 4,  4},
+   {VEC2_I32,  "ivec2", 8,  8},
+   {VEC2_UI32, "uvec2", 8,  8},
+   {VEC2_F32,  "vec2",  8,  8},
+   {VEC3_I32,  "ivec3", 12, 16},
+   {VEC3_UI32, "uvec3", 12, 16},
+   {VEC3_F32,  "vec3",  12, 16},
+   {VEC4_I32,  "ivec4", 16, 16},
+   {VEC4_UI32, "uvec4", 16, 16},
+   {VEC4_F32,  "vec4",  16, 16},
+};
+
+#define PARAM_TYPES_COUNT (sizeof(paramTypesInfo) / sizeof(ParamTypeInfo))
+
+// Kernels are named after their creation order until gput_setKernelName
+static atomic_int kernelsCreated;
+
+// Parameter blocks are streamed through a single uniform buffer used as a
+// ring. When the ring wraps its storage is orphaned and the generation bumped,
+// which makes every kernel upload its block again on its next dispatch.
+// Each thread has its own ring per device, created on first use, so that
+// the contexts of the core and submission threads never write the same
+// buffer. Generations are unique across rings, so a kernel run from another
+// thread uploads its block again too.
+#define PARAMS_RING_SIZE (64 * 1024)
+
+typedef struct {
+   GlBuffId buffer;
+   int head;
+   unsigned generation;
+   int alignment;
+} ParamsRing;
+
+static _Thread_local ParamsRing paramsRings[GPCTX_MAX_DEVICES];
+static atomic_uint ringGenerations;
+
+static const ParamTypeInfo* getParamTypeInfo(GlDataType dataType)
+{
+   for (size_t i = 0; i < PARAM_TYPES_COUNT; i++) {
+      if (paramTypesInfo[i].dataType == dataType) {
+         return &paramTypesInfo[i];
+      }
+   }
+   return NULL;
+}
+
+static ParamsRing* getParamsRing()
+{
+   ParamsRing* ring = &paramsRings[gpctx_getCurrentDeviceIndex()];
+   if (ring->buffer == 0) {
+      GLC(glGetIntegerv(
+         GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ring->alignment
+      ));
+      ring->buffer = gla_createStreamBuffer(UNIFORM_BUFFER, PARAMS_RING_SIZE);
+      ring->head = 0;
+      ring->generation = atomic_fetch_add(&ringGenerations, 1) + 1;
+   }
+   return ring;
+}
+
+bool gpk_init()
+{
+   return getParamsRing()->buffer != 0;
+}
+
+void gpk_terminate()
+{
+   gpk_releaseThread();
+}
+
+void gpk_releaseThread()
+{
+   for (int i = 0; i < GPCTX_MAX_DEVICES; i++) {
+      if (paramsRings[i].buffer != 0) {
+         if (i != gpctx_getCurrentDeviceIndex()) {
+            gpctx_setDevice(gpctx_getDevice(i));
+         }
+         gla_deleteBuffer(paramsRings[i].buffer);
+         paramsRings[i].buffer = 0;
+      }
+   }
+}
+
+static int writeParamsBlock(ParamsRing* ring, const void* data, int size)
+{
+   int offset = ring->head + ring->alignment - 1;
+   offset -= offset % ring->alignment;
+
+   if (offset + size > PARAMS_RING_SIZE) {
+      gla_orphanBuffer(UNIFORM_BUFFER, ring->buffer, PARAMS_RING_SIZE);
+      ring->generation = atomic_fetch_add(&ringGenerations, 1) + 1;
+      offset = 0;
+   }
+
+   gla_updateBuffer(UNIFORM_BUFFER, ring->buffer, offset, data, size);
+   ring->head = offset + size;
+   return offset;
+}
+
+static void freeKernel(GputKernel* kernel)
+{
+   for (int i = 0; i < kernel->paramsCount; i++) {
+      free(kernel->params[i].name);
+   }
+   free(kernel->params);
+   free(kernel->paramsData);
+   free(kernel->name);
+   free(kernel);
+}
+
+static char* generateParamsDeclaration(
+   GputKernel* kernel, const GputKernelParam params[]
+){
+   // Worst case per parameter: qualifiers, type and name
+   size_t declarationSize = 64;
+   for (int i = 0; i < kernel->paramsCount; i++) {
+      declarationSize += strlen(params[i].name) + 32;
+   }
+
+   char* declaration = malloc(declarationSize);
+   if (declaration == NULL) {
+      return NULL;
+   }
+
+   // Kernels without parameters get an empty declaration
+   declaration[0] = '\0';
+   int length = 0;
+   if (kernel->useParamsBlock) {
+      length += sprintf(declaration + length,
+         "layout(std140, binding = %d) uniform GputParams\n{\n",
+         GPK_PARAMS_BLOCK_BINDING
+      );
+   }
+
+   for (int i = 0; i < kernel->paramsCount; i++) {
+      length += sprintf(declaration + length, "%s highp %s %s;\n",
+         kernel->useParamsBlock ? "  " : "uniform",
+         getParamTypeInfo(params[i].dataType)->glslType, params[i].name
+      );
+   }
+
+   if (kernel->useParamsBlock) {
+      sprintf(declaration + length, "};\n");
+   }
+   return declaration;
+}
+
+static void resolveParamLocations(GputKernel* kernel)
+{
+   if (!kernel->useParamsBlock) {
+      for (int i = 0; i < kernel->paramsCount; i++) {
+         kernel->params[i].location = gla_getUniformLocation(
+            kernel->program, kernel->params[i].name
+         );
+      }
+   }
+   kernel->ready = true;
+}
+
+static void failKernel(GputKernel* kernel)
+{
+   GPUT_LOG_ERROR("Compilation of %s failed", kernel->name);
+   kernel->failed = true;
+}
+
+static char* concatStrings(const char* first, const char* second)
+{
+   size_t firstLength = strlen(first);
+   char* result = malloc(firstLength + strlen(second) + 1);
+   if (result != NULL) {
+      strcpy(result, first);
+      strcpy(result + firstLength, second);
+   }
+   return result;
+}
+
+static GputKernel* createKernel(
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount, bool async
+){
+   // GLSL kernels only run on a device, the CPU backend only provides the
+   // built-in operations
+   if (gpctx_getCurrentDevice() == NULL) {
+      GPUT_LOG_ERROR("Kernels need the GPU backend");
+      return NULL;
+   }
+
+   if (spec != NULL
+      && (spec->inputsCount < 0 || spec->inputsCount > GPUT_MAX_KERNEL_INPUTS)
+   ){
+      GPUT_LOG_ERROR("Invalid kernel inputs count %d", spec->inputsCount);
+      return NULL;
+   }
+   for (int i = 0; i < paramsCount; i++) {
+      if (getParamTypeInfo(params[i].dataType) == NULL) {
+         GPUT_LOG_ERROR("Unsupported type for kernel parameter %s",
+            params[i].name
+         );
+         return NULL;
+      }
+   }
+
+   GputKernel* kernel = calloc(1, sizeof(GputKernel));
+   GPUT_ASSERT(kernel != NULL, "Could not allocate kernel");
+   if (kernel == NULL) {
+      return NULL;
+   }
+
+   char name[32];
+   snprintf(name, sizeof(name), "kernel %d",
+      atomic_fetch_add(&kernelsCreated, 1)
+   );
+
+   kernel->device = gpctx_getCurrentDevice();
+   kernel->name = strdup(name);
+   kernel->paramsCount = paramsCount;
+   kernel->useParamsBlock = paramsCount > GPK_MAX_UNIFORM_PARAMS;
+   kernel->params = calloc(paramsCount + 1, sizeof(KernelParam));
+
+   // Host side storage follows the std140 rules in both modes so that a
+   // block can be uploaded as is
+   int offset = 0;
+   for (int i = 0; i < paramsCount; i++) {
+      const ParamTypeInfo* typeInfo = getParamTypeInfo(params[i].dataType);
+      offset += typeInfo->std140Alignment - 1;
+      offset -= offset % typeInfo->std140Alignment;
+
+      kernel->params[i].name = strdup(params[i].name);
+      kernel->params[i].dataType = params[i].dataType;
+      kernel->params[i].offset = offset;
+      kernel->params[i].size = typeInfo->size;
+      offset += typeInfo->size;
+   }
+
+   // A std140 block is padded to a multiple of a vec4
+   kernel->paramsDataSize = (offset + 15) & ~15;
+   kernel->paramsData = calloc(1, kernel->paramsDataSize + 1);
+   kernel->dirtyParams = ~0u;
+
+   char* declaration = generateParamsDeclaration(kernel, params);
+   GPUT_ASSERT(declaration != NULL, "Could not generate kernel parameters");
+
+   if (spec != NULL) {
+      kernel->specialized = true;
+      kernel->spec = *spec;
+      kernel->spec.defines = NULL;
+
+      // Generation errors are logged by the template module
+      char* prologue = glslt_generatePrologue(spec);
+      if (prologue == NULL) {
+         free(declaration);
+         freeKernel(kernel);
+         return NULL;
+      }
+      char* fullDeclaration = concatStrings(prologue, declaration);
+      free(prologue);
+      free(declaration);
+      declaration = fullDeclaration;
+   }
+
+   double traceStart = gptr_begin();
+   char* expandedSource = glslt_expandIncludes(source);
+   if (expandedSource == NULL) {
+      free(declaration);
+      freeKernel(kernel);
+      return NULL;
+   }
+
+   // The declarations go to the fragment shader only: an integer gput_out
+   // declared in the vertex shader would be an output without the flat
+   // qualifier integer outputs require there
+   const char* vertexSource = GLA_FULLSCREEN_VERTEX_SHADER;
+   const char* fragmentSources[] = {declaration, expandedSource};
+   if (async) {
+      kernel->program = glpc_acquireProgramAsync(
+         NULL, &vertexSource, 1, fragmentSources, 2
+      );
+   }
+   else {
+      kernel->program = glpc_acquireProgram(
+         NULL, &vertexSource, 1, fragmentSources, 2
+      );
+      if (kernel->program != 0) {
+         resolveParamLocations(kernel);
+      }
+   }
+   free(expandedSource);
+   free(declaration);
+   gptr_end("create kernel", traceStart);
+
+   if (kernel->program == 0) {
+      freeKernel(kernel);
+      return NULL;
+   }
+   return kernel;
+}
+
+GputKernel* gput_createKernel(
+   const char* source, const GputKernelParam params[], int paramsCount
+){
+   return createKernel(source, NULL, params, paramsCount, false);
+}
+
+GputKernel* gput_createKernelAsync(
+   const char* source, const GputKernelParam params[], int paramsCount
+){
+   return createKernel(source, NULL, params, paramsCount, true);
+}
+
+GputKernel* gput_createSpecializedKernel(
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+){
+   return createKernel(source, spec, params, paramsCount, false);
+}
+
+GputKernel* gput_createSpecializedKernelAsync(
+   const char* source, const GputKernelSpec* spec,
+   const GputKernelParam params[], int paramsCount
+){
+   return createKernel(source, spec, params, paramsCount, true);
+}
+
+bool gput_isKernelReady(GputKernel* kernel)
+{
+   if (!kernel->ready && !kernel->failed) {
+      bool failed;
+      if (glpc_isProgramReady(kernel->program, &failed)) {
+         resolveParamLocations(kernel);
+      }
+      else if (failed) {
+         failKernel(kernel);
+      }
+   }
+   return kernel->ready;
+}
+
+bool gput_hasKernelFailed(GputKernel* kernel)
+{
+   gput_isKernelReady(kernel);
+   return kernel->failed;
+}
+
+void gput_setKernelParam(GputKernel* kernel, int paramIndex, const void* value)
+{
+   GPUT_ASSERT(paramIndex >= 0 && paramIndex < kernel->paramsCount,
+      "Kernel parameter index %d out of range", paramIndex
+   );
+   KernelParam* param = &kernel->params[paramIndex];
+   memcpy(kernel->paramsData + param->offset, value, param->size);
+   kernel->dirtyParams |= kernel->useParamsBlock ? 1u : 1u << paramIndex;
+}
+
+static void updateParams(GputKernel* kernel)
+{
+   if (kernel->paramsCount == 0) {
+      return;
+   }
+
+   if (kernel->useParamsBlock) {
+      ParamsRing* ring = getParamsRing();
+      if (kernel->dirtyParams || kernel->blockGeneration != ring->generation) {
+         kernel->blockOffset = writeParamsBlock(
+            ring, kernel->paramsData, kernel->paramsDataSize
+         );
+         kernel->blockGeneration = ring->generation;
+         kernel->dirtyParams = 0;
+      }
+      gla_bindUniformBufferRange(
+         GPK_PARAMS_BLOCK_BINDING, ring->buffer,
+         kernel->blockOffset, kernel->paramsDataSize
+      );
+      return;
+   }
+
+   // Another kernel sharing the cached program may have overwritten the
+   // uniform values since this kernel last set them
+   if (glpc_setUniformOwner(kernel->program, kernel)) {
+      kernel->dirtyParams = ~0u;
+   }
+
+   for (int i = 0; i < kernel->paramsCount && kernel->dirtyParams; i++) {
+      if (kernel->dirtyParams & (1u << i)) {
+         KernelParam* param = &kernel->params[i];
+         gla_setUniform(
+            kernel->program, param->location, param->dataType,
+            kernel->paramsData + param->offset
+         );
+      }
+   }
+   kernel->dirtyParams = 0;
+}
+
+void gpk_runKernelRows(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount,
+   GputArray* output, int firstRow, int rowsCount
+){
+   // The inputs are copied to a fixed size array below, so their count is
+   // checked in every build
+   if (inputsCount < 0 || inputsCount > GPUT_MAX_KERNEL_INPUTS
+      || (kernel->specialized && inputsCount != kernel->spec.inputsCount)
+   ){
+      GPUT_LOG_ERROR("Invalid inputs count %d for %s",
+         inputsCount, kernel->name
+      );
+      return;
+   }
+   GPUT_DEBUG_SCOPE(
+      GPUT_ASSERT(output->backend == GPUT_BACKEND_GPU,
+         "Kernels can only write to GPU arrays"
+      );
+      for (int i = 0; i < inputsCount; i++) {
+         GPUT_ASSERT(inputs[i]->backend == GPUT_BACKEND_GPU,
+            "Kernels can only read GPU arrays"
+         );
+         GPUT_ASSERT(inputs[i] != output,
+            "Kernel output can not also be bound as input %d", i
+         );
+      }
+      if (kernel->specialized) {
+         const GputKernelSpec* spec = &kernel->spec;
+         GPUT_ASSERT(output->dataType == spec->outputType,
+            "Output doesn't match the kernel specialization"
+         );
+         for (int i = 0; i < inputsCount; i++) {
+            GPUT_ASSERT(inputs[i]->dataType == spec->inputTypes[i],
+               "Input %d doesn't match the kernel specialization", i
+            );
+         }
+         GPUT_ASSERT(spec->outputWidth == 0
+            || (output->width == spec->outputWidth
+               && output->height == spec->outputHeight),
+            "Output size doesn't match the kernel specialization"
+         );
+      }
+   )
+   GPUT_ASSERT(kernel->device == gpctx_getCurrentDevice()
+      && output->device == kernel->device,
+      "Kernel used while another device is selected"
+   );
+   if (!kernel->ready) {
+      if (!kernel->failed && !glpc_waitProgram(kernel->program)) {
+         failKernel(kernel);
+      }
+      if (kernel->failed) {
+         GPUT_LOG_ERROR("%s can't run since it did not compile", kernel->name);
+         return;
+      }
+      resolveParamLocations(kernel);
+   }
+
+   double traceStart = gptr_begin();
+   gpgl_beginDispatch();
+
+   // The full-screen vertex array stays bound from gput_init, so a dispatch
+   // is a program bind, the input texture binds and a single draw
+
+   GputArray* arrays[GPUT_MAX_KERNEL_INPUTS + 1];
+   for (int i = 0; i < inputsCount; i++) {
+      arrays[i] = inputs[i];
+   }
+   arrays[inputsCount] = output;
+   gpa_makeResident(arrays, inputsCount + 1);
+
+   for (int i = 0; i < inputsCount; i++) {
+      gpa_waitWrites(inputs[i]);
+   }
+   gpa_waitWrites(output);
+
+   gla_bindFramebuffer(gpa_getFramebuffer(output));
+   gla_setViewport(0, firstRow, output->width, rowsCount);
+   gla_bindProgram(kernel->program);
+   updateParams(kernel);
+
+   for (int i = 0; i < inputsCount; i++) {
+      gla_bindTexture(i, inputs[i]->texture);
+   }
+
+   GppScope* scope = gpp_begin(kernel->name);
+   gla_drawFullscreen();
+   gpp_end(scope);
+   gpa_markWritten(output);
+   gpgl_endDispatch();
+   gptr_end(kernel->name, traceStart);
+}
+
+void gput_runKernel(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount, GputArray* output
+){
+   gpk_runKernelRows(kernel, inputs, inputsCount, output, 0, output->height);
+}
+
+void gput_setKernelName(GputKernel* kernel, const char* name)
+{
+   free(kernel->name);
+   kernel->name = strdup(name);
+}
+
+void gput_deleteKernel(GputKernel* kernel)
+{
+   GPUT_ASSERT(kernel->device == gpctx_getCurrentDevice(),
+      "Kernel used while another device is selected"
+   );
+   glpc_releaseProgram(kernel->program);
+   freeKernel(kernel);
+}
@@ -0,0 +1,80 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gput.h"
+#include "GlAbstract.h"
+
+// Kernels with more parameters than this pass them in a std140 uniform
+// block instead of individual uniforms
+#define GPK_MAX_UNIFORM_PARAMS 4
+
+#define GPK_PARAMS_BLOCK_BINDING 0
+
+typedef struct {
+   char* name;
+   GlDataType dataType;
+   GlUniformLoc location;
+   int offset;
+   int size;
+} KernelParam;
+
+struct GputKernel {
+   GputDevice* device;
+   char* name;
+   GlProgId program;
+   bool ready;
+   // Set once an asynchronous compilation failed, the kernel then never runs
+   bool failed;
+
+   bool specialized;
+   GputKernelSpec spec;
+
+   KernelParam* params;
+   int paramsCount;
+   unsigned char* paramsData;
+   int paramsDataSize;
+
+   bool useParamsBlock;
+   uint32_t dirtyParams;
+   unsigned blockGeneration;
+   int blockOffset;
+};
+
+bool gpk_init();
+
+void gpk_terminate();
+
+// Deletes the parameter rings of the calling thread, before its contexts go
+void gpk_releaseThread();
+
+// Only computes the output rows [firstRow, firstRow + rowsCount). Fragment
+// coordinates stay relative to the whole output.
+void gpk_runKernelRows(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount,
+   GputArray* output, int firstRow, int rowsCount
+);
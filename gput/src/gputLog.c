@@ -0,0 +1,267 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "gputLog.h"
+
+#define RING_MASK (GPLOG_RING_SIZE - 1)
+
+// How long the writer sleeps once the ring is empty
+#define POLL_NANOSECONDS (1000 * 1000)
+
+// A slot can be written when its sequence equals the position of the record
+// and read once it is one past it
+typedef struct {
+   atomic_size_t sequence;
+   LogLevel level;
+   struct timespec time;
+   long threadId;
+   const char* file;
+   int line;
+   char message[GPLOG_MESSAGE_SIZE];
+} Record;
+
+static Record ring[GPLOG_RING_SIZE];
+static atomic_size_t head;
+// Only accessed by the writer
+static size_t tail;
+static atomic_size_t dropped;
+
+static atomic_bool running;
+static pthread_t writerThread;
+// Swapped for NULL before being closed, so that late writers fall back to
+// stdout
+static _Atomic(FILE*) output;
+// Threads between deciding how to log a record and being done with it, the
+// ring and the output must outlive them
+static atomic_int activeLoggers;
+
+static _Thread_local long threadId;
+
+static const char levelChars[] = {'T', 'D', 'I', 'W', 'E', 'F'};
+
+static void initRecord(
+   Record* record, LogLevel level, const char* file, int line
+){
+   if (threadId == 0) {
+      threadId = syscall(SYS_gettid);
+   }
+   record->level = level;
+   clock_gettime(CLOCK_REALTIME, &record->time);
+   record->threadId = threadId;
+   record->file = file;
+   record->line = line;
+}
+
+static void writeRecord(FILE* file, const Record* record)
+{
+   struct tm time;
+   localtime_r(&record->time.tv_sec, &time);
+   fprintf(file, "%04d-%02d-%02d %02d:%02d:%02d.%06ld %c %ld %s:%d: %s\n",
+      time.tm_year + 1900, time.tm_mon + 1, time.tm_mday,
+      time.tm_hour, time.tm_min, time.tm_sec, record->time.tv_nsec / 1000,
+      levelChars[record->level], record->threadId,
+      record->file, record->line, record->message
+   );
+}
+
+// Must only be called by one thread at a time
+static int writeQueuedRecords()
+{
+   FILE* file = atomic_load(&output);
+   int count = 0;
+   for (;;) {
+      Record* record = &ring[tail & RING_MASK];
+      size_t sequence = atomic_load_explicit(
+         &record->sequence, memory_order_acquire
+      );
+      if (sequence != tail + 1) {
+         break;
+      }
+      writeRecord(file, record);
+      atomic_store_explicit(
+         &record->sequence, tail + GPLOG_RING_SIZE, memory_order_release
+      );
+      tail++;
+      count++;
+   }
+
+   size_t droppedCount = atomic_exchange(&dropped, 0);
+   if (droppedCount > 0) {
+      fprintf(file, "%zu log records dropped, the ring buffer was full\n",
+         droppedCount
+      );
+   }
+   if (count > 0 || droppedCount > 0) {
+      fflush(file);
+   }
+   return count;
+}
+
+static void* writeRecords(void* arg)
+{
+   const struct timespec pollTime = {0, POLL_NANOSECONDS};
+   for (;;) {
+      // Read first so that everything queued before stopping gets written
+      bool stopping = !atomic_load(&running);
+      if (writeQueuedRecords() == 0) {
+         if (stopping) {
+            break;
+         }
+         nanosleep(&pollTime, NULL);
+      }
+   }
+   return NULL;
+}
+
+bool gplog_init(const char* path)
+{
+   if (atomic_load(&running)) {
+      return true;
+   }
+
+   FILE* file = stdout;
+   if (path != NULL) {
+      file = fopen(path, "a");
+      if (file == NULL) {
+         fprintf(stderr, "Could not open log file %s\n", path);
+         file = stdout;
+      }
+   }
+   atomic_store(&output, file);
+
+   for (size_t i = 0; i < GPLOG_RING_SIZE; i++) {
+      atomic_init(&ring[i].sequence, i);
+   }
+   atomic_store(&head, 0);
+   tail = 0;
+
+   atomic_store(&running, true);
+   if (pthread_create(&writerThread, NULL, writeRecords, NULL) != 0) {
+      atomic_store(&running, false);
+      return false;
+   }
+   return true;
+}
+
+static void waitForLoggers()
+{
+   while (atomic_load(&activeLoggers) > 0) {
+      sched_yield();
+   }
+}
+
+void gplog_terminate()
+{
+   if (!atomic_load(&running)) {
+      return;
+   }
+   atomic_store(&running, false);
+   pthread_join(writerThread, NULL);
+
+   // Loggers that saw the writer running may still be filling their slot,
+   // later ones write synchronously
+   waitForLoggers();
+   while (tail != atomic_load(&head)) {
+      writeQueuedRecords();
+   }
+
+   FILE* file = atomic_exchange(&output, NULL);
+   waitForLoggers();
+   if (file != stdout) {
+      fclose(file);
+   }
+}
+
+void gplog_log(
+   LogLevel level, const char* file, int line, const char* fmt, ...
+){
+   va_list args;
+   va_start(args, fmt);
+
+   // Counted before checking running, so that gplog_terminate either waits
+   // for this record or has it written synchronously
+   atomic_fetch_add(&activeLoggers, 1);
+   if (level >= LogLevel_FATAL || !atomic_load(&running)) {
+      Record record;
+      initRecord(&record, level, file, line);
+      vsnprintf(record.message, GPLOG_MESSAGE_SIZE, fmt, args);
+      va_end(args);
+
+      FILE* stream = atomic_load(&output);
+      if (stream == NULL) {
+         stream = stdout;
+      }
+      writeRecord(stream, &record);
+      fflush(stream);
+      atomic_fetch_sub(&activeLoggers, 1);
+      return;
+   }
+
+   size_t position = atomic_load_explicit(&head, memory_order_relaxed);
+   Record* record;
+   for (;;) {
+      record = &ring[position & RING_MASK];
+      size_t sequence = atomic_load_explicit(
+         &record->sequence, memory_order_acquire
+      );
+      intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+      if (difference == 0) {
+         if (atomic_compare_exchange_weak_explicit(&head, &position,
+            position + 1, memory_order_relaxed, memory_order_relaxed
+         )){
+            break;
+         }
+      }
+      else if (difference < 0) {
+         // Full, logging must never wait for the writer
+         atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+         atomic_fetch_sub(&activeLoggers, 1);
+         va_end(args);
+         return;
+      }
+      else {
+         position = atomic_load_explicit(&head, memory_order_relaxed);
+      }
+   }
+
+   initRecord(record, level, file, line);
+   vsnprintf(record->message, GPLOG_MESSAGE_SIZE, fmt, args);
+   va_end(args);
+
+   atomic_store_explicit(
+      &record->sequence, position + 1, memory_order_release
+   );
+   atomic_fetch_sub(&activeLoggers, 1);
+}
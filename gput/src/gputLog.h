@@ -0,0 +1,48 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+#include "logger.h"
+
+// Slots of the ring buffer, a power of two. Records logged while it is full
+// are dropped and counted.
+#define GPLOG_RING_SIZE 1024
+
+// Longer messages are truncated
+#define GPLOG_MESSAGE_SIZE 256
+
+// Starts the thread writing the records to path, or to stdout when NULL
+bool gplog_init(const char* path);
+
+// Writes the records still queued and stops the thread
+void gplog_terminate();
+
+// Formats the record and queues it without blocking or locking. Fatal
+// records, which usually precede an abort, and records logged while the
+// thread is not running are written right away.
+void gplog_log(
+   LogLevel level, const char* file, int line, const char* fmt, ...
+) __attribute__((format(printf, 4, 5)));
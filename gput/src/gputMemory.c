@@ -0,0 +1,280 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gput.h"
+#include "gputDebug.h"
+#include "gputMemory.h"
+
+#ifdef GPUT_PROFILING
+
+#define DEFAULT_TAG "untagged"
+
+typedef struct {
+   char* name;
+   size_t liveBytes;
+   size_t peakBytes;
+   int liveObjects;
+} Tag;
+
+typedef struct {
+   GpmKind kind;
+   unsigned owner;
+   GLuint id;
+   size_t size;
+   Tag* tag;
+   const char* file;
+   int line;
+} Object;
+
+static const char* kindNames[] = {
+   "texture", "buffer", "framebuffer", "program"
+};
+
+static pthread_mutex_t memoryMutex = PTHREAD_MUTEX_INITIALIZER;
+static Object* objects;
+static int objectsCount;
+static int objectsCapacity;
+static Tag tags[GPM_MAX_TAGS];
+static int tagsCount;
+static size_t liveBytes;
+static size_t peakBytes;
+
+static _Thread_local Tag* threadTag;
+
+// Must be called with memoryMutex locked
+static Tag* getTag(const char* name)
+{
+   for (int i = 0; i < tagsCount; i++) {
+      if (strcmp(tags[i].name, name) == 0) {
+         return &tags[i];
+      }
+   }
+   if (tagsCount == GPM_MAX_TAGS) {
+      return &tags[GPM_MAX_TAGS - 1];
+   }
+   Tag* tag = &tags[tagsCount];
+   tag->name = strdup(name);
+   if (tag->name == NULL) {
+      return tagsCount > 0 ? &tags[tagsCount - 1] : NULL;
+   }
+   tagsCount++;
+   return tag;
+}
+
+void gput_setMemoryTag(const char* name)
+{
+   pthread_mutex_lock(&memoryMutex);
+   threadTag = getTag(name != NULL ? name : DEFAULT_TAG);
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+void gpm_track(
+   GpmKind kind, unsigned owner, GLuint id, size_t size,
+   const char* file, int line
+){
+   pthread_mutex_lock(&memoryMutex);
+   if (threadTag == NULL) {
+      threadTag = getTag(DEFAULT_TAG);
+   }
+   if (objectsCount == objectsCapacity) {
+      int capacity = objectsCapacity ? objectsCapacity * 2 : 64;
+      Object* grown = realloc(objects, capacity * sizeof(Object));
+      if (grown == NULL || threadTag == NULL) {
+         pthread_mutex_unlock(&memoryMutex);
+         GPUT_LOG_ERROR("Could not track a GPU %s", kindNames[kind]);
+         return;
+      }
+      objects = grown;
+      objectsCapacity = capacity;
+   }
+
+   objects[objectsCount++] = (Object) {
+      .kind = kind,
+      .owner = owner,
+      .id = id,
+      .size = size,
+      .tag = threadTag,
+      .file = file,
+      .line = line
+   };
+
+   Tag* tag = threadTag;
+   tag->liveBytes += size;
+   tag->liveObjects++;
+   if (tag->liveBytes > tag->peakBytes) {
+      tag->peakBytes = tag->liveBytes;
+   }
+   liveBytes += size;
+   if (liveBytes > peakBytes) {
+      peakBytes = liveBytes;
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+// Must be called with memoryMutex locked
+static void removeObject(int index)
+{
+   Object* object = &objects[index];
+   object->tag->liveBytes -= object->size;
+   object->tag->liveObjects--;
+   liveBytes -= object->size;
+   *object = objects[--objectsCount];
+}
+
+void gpm_untrack(GpmKind kind, unsigned owner, GLuint id)
+{
+   pthread_mutex_lock(&memoryMutex);
+   // Objects are mostly deleted shortly after being created
+   for (int i = objectsCount - 1; i >= 0; i--) {
+      Object* object = &objects[i];
+      if (object->id == id && object->kind == kind && object->owner == owner) {
+         removeObject(i);
+         break;
+      }
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+void gpm_untrackOwner(GpmKind kind, unsigned owner)
+{
+   pthread_mutex_lock(&memoryMutex);
+   for (int i = objectsCount - 1; i >= 0; i--) {
+      if (objects[i].kind == kind && objects[i].owner == owner) {
+         removeObject(i);
+      }
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+void gput_getMemoryUsage(const char* tagName, GputMemoryUsage* usage)
+{
+   *usage = (GputMemoryUsage) {0};
+
+   pthread_mutex_lock(&memoryMutex);
+   if (tagName == NULL) {
+      usage->liveBytes = liveBytes;
+      usage->peakBytes = peakBytes;
+      usage->liveObjects = objectsCount;
+   }
+   else {
+      for (int i = 0; i < tagsCount; i++) {
+         if (strcmp(tags[i].name, tagName) == 0) {
+            usage->liveBytes = tags[i].liveBytes;
+            usage->peakBytes = tags[i].peakBytes;
+            usage->liveObjects = tags[i].liveObjects;
+            break;
+         }
+      }
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+void gput_printMemoryUsage()
+{
+   pthread_mutex_lock(&memoryMutex);
+   printf("\n%-32s %12s %12s %10s\n",
+      "GPU memory", "live (KiB)", "peak (KiB)", "objects"
+   );
+   for (int i = 0; i < tagsCount; i++) {
+      printf("%-32.32s %12.1f %12.1f %10d\n", tags[i].name,
+         tags[i].liveBytes / 1024.0, tags[i].peakBytes / 1024.0,
+         tags[i].liveObjects
+      );
+   }
+   printf("%-32s %12.1f %12.1f %10d\n\n", "total",
+      liveBytes / 1024.0, peakBytes / 1024.0, objectsCount
+   );
+
+   for (int i = 0; i < objectsCount; i++) {
+      const Object* object = &objects[i];
+      printf("%-12s %6u %12zu bytes  %-20.20s %s:%d\n",
+         kindNames[object->kind], object->id, object->size,
+         object->tag->name, object->file, object->line
+      );
+   }
+   if (objectsCount > 0) {
+      putchar('\n');
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+void gpm_terminate()
+{
+   pthread_mutex_lock(&memoryMutex);
+   GPUT_LOG_DEBUG("GPU memory peak: %zu bytes", peakBytes);
+   if (objectsCount > 0) {
+      GPUT_LOG_WARN("%d GPU objects (%zu bytes) were not deleted",
+         objectsCount, liveBytes
+      );
+   }
+   for (int i = 0; i < objectsCount && i < GPM_MAX_LEAKS_REPORTED; i++) {
+      const Object* object = &objects[i];
+      GPUT_LOG_WARN("Leaked %s %u: %zu bytes, tag %s, created at %s:%d",
+         kindNames[object->kind], object->id, object->size,
+         object->tag->name, object->file, object->line
+      );
+   }
+   if (objectsCount > GPM_MAX_LEAKS_REPORTED) {
+      GPUT_LOG_WARN("and %d more leaked objects",
+         objectsCount - GPM_MAX_LEAKS_REPORTED
+      );
+   }
+
+   // The objects go away with the contexts
+   free(objects);
+   objects = NULL;
+   objectsCount = 0;
+   objectsCapacity = 0;
+   liveBytes = 0;
+   peakBytes = 0;
+   for (int i = 0; i < tagsCount; i++) {
+      tags[i].liveBytes = 0;
+      tags[i].peakBytes = 0;
+      tags[i].liveObjects = 0;
+   }
+   pthread_mutex_unlock(&memoryMutex);
+}
+
+#else
+
+void gput_setMemoryTag(const char* name)
+{
+}
+
+void gput_getMemoryUsage(const char* tagName, GputMemoryUsage* usage)
+{
+   *usage = (GputMemoryUsage) {0};
+}
+
+void gput_printMemoryUsage()
+{
+   GPUT_LOG_WARN("Memory accounting is not compiled in release builds");
+}
+
+#endif // ifdef GPUT_PROFILING
@@ -0,0 +1,73 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "glad/glad.h"
+
+// Tags past this many share the last one
+#define GPM_MAX_TAGS 64
+
+// Leaks reported individually at termination, the others are summed up
+#define GPM_MAX_LEAKS_REPORTED 64
+
+typedef enum {
+   GPM_TEXTURE,
+   GPM_BUFFER,
+   GPM_FRAMEBUFFER,
+   GPM_PROGRAM
+} GpmKind;
+
+#ifdef GPUT_PROFILING
+
+// Objects are identified by their name within their owner: the share group
+// of a device for shared objects, the context for framebuffers, whose names
+// are per context
+void gpm_track(
+   GpmKind kind, unsigned owner, GLuint id, size_t size,
+   const char* file, int line
+);
+
+void gpm_untrack(GpmKind kind, unsigned owner, GLuint id);
+
+// Untracks the objects of an owner that went away along with it
+void gpm_untrackOwner(GpmKind kind, unsigned owner);
+
+// Reports the objects still alive as leaks
+void gpm_terminate();
+
+#else
+
+// Accounting is compiled out of release builds
+static inline void gpm_track(
+   GpmKind kind, unsigned owner, GLuint id, size_t size,
+   const char* file, int line
+){}
+static inline void gpm_untrack(GpmKind kind, unsigned owner, GLuint id) {}
+static inline void gpm_untrackOwner(GpmKind kind, unsigned owner) {}
+static inline void gpm_terminate() {}
+
+#endif // ifdef GPUT_PROFILING
@@ -0,0 +1,254 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputCpu.h"
+#include "gputDebug.h"
+#include "gputKernel.h"
+#include "gputOps.h"
+
+#define DATA_TYPES_COUNT (VEC4_UI32 + 1)
+
+// Reductions come after the binary operations in the kernel tables
+#define REDUCE_KERNEL(op) (GPCPU_BINARY_OPS_COUNT + (op))
+#define KERNELS_COUNT (GPCPU_BINARY_OPS_COUNT + GPCPU_REDUCE_OPS_COUNT)
+
+static const char* binaryOpSource =
+   "#include \"gput/coord.glsl\"\n"
+   "void main()\n"
+   "{\n"
+   "   ivec2 coord = gput_coord();\n"
+   "   GPUT_OUT_TYPE a = texelFetch(gput_in0, coord, 0).GPUT_OUT_SWIZZLE;\n"
+   "   GPUT_OUT_TYPE b = texelFetch(gput_in1, coord, 0).GPUT_OUT_SWIZZLE;\n"
+   "   gput_out = GPUT_OP(a, b);\n"
+   "}\n";
+
+// Reduces each row to a single element, the rows are then reduced on the CPU
+static const char* reduceRowsSource =
+   "void main()\n"
+   "{\n"
+   "   int y = int(gl_FragCoord.y);\n"
+   "   int width = textureSize(gput_in0, 0).x;\n"
+   "   GPUT_OUT_TYPE acc = texelFetch(gput_in0, ivec2(0, y), 0)"
+   ".GPUT_OUT_SWIZZLE;\n"
+   "   for (int x = 1; x < width; x++) {\n"
+   "      acc = GPUT_OP(acc,\n"
+   "         texelFetch(gput_in0, ivec2(x, y), 0).GPUT_OUT_SWIZZLE\n"
+   "      );\n"
+   "   }\n"
+   "   gput_out = acc;\n"
+   "}\n";
+
+static const char* kernelNames[KERNELS_COUNT] = {
+   [GPUT_BINARY_ADD] = "add",
+   [GPUT_BINARY_SUB] = "sub",
+   [GPUT_BINARY_MUL] = "mul",
+   [GPUT_BINARY_MIN] = "min",
+   [GPUT_BINARY_MAX] = "max",
+   [REDUCE_KERNEL(GPUT_REDUCE_SUM)] = "reduce sum",
+   [REDUCE_KERNEL(GPUT_REDUCE_MIN)] = "reduce min",
+   [REDUCE_KERNEL(GPUT_REDUCE_MAX)] = "reduce max",
+};
+
+static const char* binaryOpDefines[GPCPU_BINARY_OPS_COUNT] = {
+   [GPUT_BINARY_ADD] = "#define GPUT_OP(a, b) ((a) + (b))",
+   [GPUT_BINARY_SUB] = "#define GPUT_OP(a, b) ((a) - (b))",
+   [GPUT_BINARY_MUL] = "#define GPUT_OP(a, b) ((a) * (b))",
+   [GPUT_BINARY_MIN] = "#define GPUT_OP(a, b) min(a, b)",
+   [GPUT_BINARY_MAX] = "#define GPUT_OP(a, b) max(a, b)",
+};
+
+static const char* reduceOpDefines[GPCPU_REDUCE_OPS_COUNT] = {
+   [GPUT_REDUCE_SUM] = "#define GPUT_OP(a, b) ((a) + (b))",
+   [GPUT_REDUCE_MIN] = "#define GPUT_OP(a, b) min(a, b)",
+   [GPUT_REDUCE_MAX] = "#define GPUT_OP(a, b) max(a, b)",
+};
+
+// Kernels and row results are created on first use for each device and type
+static pthread_mutex_t opsMutex = PTHREAD_MUTEX_INITIALIZER;
+static GputKernel* kernels[GPCTX_MAX_DEVICES][KERNELS_COUNT][DATA_TYPES_COUNT];
+static GputArray* rowResults[GPCTX_MAX_DEVICES][DATA_TYPES_COUNT];
+
+static GputKernel* getKernel(
+   int kernelIndex, GlDataType dataType, int inputsCount,
+   const char* source, const char* defines
+){
+   int device = gpctx_getCurrentDeviceIndex();
+   GputKernel** kernel = &kernels[device][kernelIndex][dataType];
+   if (*kernel == NULL) {
+      GputKernelSpec spec = {
+         .inputTypes = {dataType, dataType},
+         .inputsCount = inputsCount,
+         .outputType = dataType,
+         .defines = defines
+      };
+      *kernel = gput_createSpecializedKernel(source, &spec, NULL, 0);
+      if (*kernel != NULL) {
+         gput_setKernelName(*kernel, kernelNames[kernelIndex]);
+      }
+   }
+   return *kernel;
+}
+
+static bool checkGpuType(GlDataType dataType)
+{
+   GPUT_ASSERT(gla_getDataTypeComponents(dataType) != 3,
+      "Three component types are not renderable"
+   );
+   return gla_getDataTypeComponents(dataType) != 3;
+}
+
+// Must be called with opsMutex locked
+static void reduceRows(
+   GputReduceOp op, GputArray* array, GputArray* rows, int rowsCount
+){
+   GputKernel* kernel = getKernel(REDUCE_KERNEL(op),
+      array->dataType, 1, reduceRowsSource, reduceOpDefines[op]
+   );
+   gpk_runKernelRows(kernel, &array, 1, rows, 0, rowsCount);
+}
+
+void gput_runBinaryOp(
+   GputBinaryOp op, GputArray* a, GputArray* b, GputArray* output
+){
+   GPUT_ASSERT(a->backend == output->backend && b->backend == output->backend,
+      "Built-in operation arrays are on different backends"
+   );
+   GPUT_ASSERT(a->dataType == output->dataType
+      && b->dataType == output->dataType
+      && a->width == output->width && a->height == output->height
+      && b->width == output->width && b->height == output->height,
+      "Built-in operation arrays differ in type or size"
+   );
+   GPUT_ASSERT(gpcpu_isSupportedType(output->dataType),
+      "Unsupported type for built-in operations"
+   );
+
+   if (output->backend == GPUT_BACKEND_CPU) {
+      gpcpu_runBinaryOp(op, output->dataType,
+         a->hostData, b->hostData, output->hostData,
+         (size_t) output->width * output->height
+      );
+      return;
+   }
+
+   if (!checkGpuType(output->dataType)) {
+      return;
+   }
+
+   gpo_runBinaryOpRows(op, a, b, output, output->height);
+}
+
+void gpo_runBinaryOpRows(
+   GputBinaryOp op, GputArray* a, GputArray* b, GputArray* output,
+   int rowsCount
+){
+   pthread_mutex_lock(&opsMutex);
+   GputKernel* kernel = getKernel(
+      op, output->dataType, 2, binaryOpSource, binaryOpDefines[op]
+   );
+   pthread_mutex_unlock(&opsMutex);
+
+   GputArray* inputs[] = {a, b};
+   gpk_runKernelRows(kernel, inputs, 2, output, 0, rowsCount);
+}
+
+void gput_reduceArray(GputReduceOp op, GputArray* array, void* result)
+{
+   GPUT_ASSERT(gpcpu_isSupportedType(array->dataType),
+      "Unsupported type for built-in operations"
+   );
+
+   if (array->backend == GPUT_BACKEND_CPU) {
+      gpcpu_reduce(op, array->dataType,
+         array->hostData, (size_t) array->width * array->height, result
+      );
+      return;
+   }
+
+   if (!checkGpuType(array->dataType)) {
+      return;
+   }
+
+   void* rowValues = malloc(
+      (size_t) array->height * gla_getDataTypeSize(array->dataType)
+   );
+   GPUT_ASSERT(rowValues != NULL, "Could not allocate reduction rows");
+   if (rowValues == NULL) {
+      return;
+   }
+
+   // The row results are shared by every reduction of the type on the device
+   pthread_mutex_lock(&opsMutex);
+   GputArray** rows =
+      &rowResults[gpctx_getCurrentDeviceIndex()][array->dataType];
+   if (*rows != NULL && (*rows)->height != array->height) {
+      gput_deleteArray(*rows);
+      *rows = NULL;
+   }
+   if (*rows == NULL) {
+      *rows = gput_createArrayOnBackend(GPUT_BACKEND_GPU,
+         array->dataType, 1, array->height, NULL
+      );
+   }
+
+   reduceRows(op, array, *rows, array->height);
+   gput_downloadArray(*rows, rowValues);
+   pthread_mutex_unlock(&opsMutex);
+
+   gpcpu_reduce(op, array->dataType, rowValues, array->height, result);
+   free(rowValues);
+}
+
+void gpo_reduceRows(
+   GputReduceOp op, GputArray* array, GputArray* rows, int rowsCount
+){
+   pthread_mutex_lock(&opsMutex);
+   reduceRows(op, array, rows, rowsCount);
+   pthread_mutex_unlock(&opsMutex);
+}
+
+void gpo_terminate()
+{
+   for (int device = 0; device < GPCTX_MAX_DEVICES; device++) {
+      for (int type = 0; type < DATA_TYPES_COUNT; type++) {
+         for (int i = 0; i < KERNELS_COUNT; i++) {
+            if (kernels[device][i][type] != NULL) {
+               gpctx_setDevice(gpctx_getDevice(device));
+               gput_deleteKernel(kernels[device][i][type]);
+               kernels[device][i][type] = NULL;
+            }
+         }
+         if (rowResults[device][type] != NULL) {
+            gpctx_setDevice(gpctx_getDevice(device));
+            gput_deleteArray(rowResults[device][type]);
+            rowResults[device][type] = NULL;
+         }
+      }
+   }
+}
@@ -0,0 +1,410 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputProfile.h"
+#include "gputTime.h"
+#include "gputTrace.h"
+#include "GlAbstract.h"
+
+#ifdef GPUT_PROFILING
+
+typedef struct {
+   char* name;
+   int count;
+   double totalSeconds;
+   double minSeconds;
+   double maxSeconds;
+   double samples[GPP_MAX_SAMPLES];
+} ProfileEntry;
+
+// Timestamps give both the duration and the position on the GPU timeline,
+// elapsed time queries only the duration
+typedef enum {
+   TIMER_UNKNOWN,
+   TIMER_TIMESTAMPS,
+   TIMER_QUERIES,
+   TIMER_FENCES
+} TimerMode;
+
+struct GppScope {
+   ProfileEntry* entry;
+   GputContext* context;
+   int deviceIndex;
+   TimerMode mode;
+   GlQueryId query;
+   GlQueryId endQuery;
+   double startSeconds;
+};
+
+static bool profiling;
+static bool profilingSelected;
+// Also set when tracing, which needs the GPU timings without the report
+static bool enabled;
+
+static pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER;
+static ProfileEntry* entries[GPP_MAX_ENTRIES];
+static int entriesCount;
+static TimerMode timerModes[GPCTX_MAX_DEVICES];
+// CPU time minus GPU time, to place timestamps on the CPU clock
+static double gpuClockOffsets[GPCTX_MAX_DEVICES];
+
+// Query objects are not shared between contexts, so they are read back by
+// the thread that issued them while the same context is current
+static _Thread_local GppScope scopes[GPP_MAX_PENDING_QUERIES];
+static _Thread_local int pendingCount;
+static _Thread_local bool scopeOpen;
+
+void gput_setProfiling(bool enable)
+{
+   profiling = enable;
+   profilingSelected = true;
+}
+
+void gpp_init()
+{
+   const char* value = getenv("GPUT_PROFILE");
+   if (!profilingSelected && value != NULL) {
+      profiling = strcmp(value, "0") != 0;
+   }
+   enabled = profiling || gptr_isEnabled();
+}
+
+// Must be called with profileMutex locked
+static ProfileEntry* getEntry(const char* name)
+{
+   for (int i = 0; i < entriesCount; i++) {
+      if (strcmp(entries[i]->name, name) == 0) {
+         return entries[i];
+      }
+   }
+
+   GPUT_ASSERT(entriesCount < GPP_MAX_ENTRIES, "Too many profile entries");
+   if (entriesCount == GPP_MAX_ENTRIES) {
+      return NULL;
+   }
+   ProfileEntry* entry = calloc(1, sizeof(ProfileEntry));
+   if (entry == NULL) {
+      return NULL;
+   }
+   entry->name = strdup(name);
+   entries[entriesCount++] = entry;
+   return entry;
+}
+
+// Must be called with profileMutex locked
+static void addSample(ProfileEntry* entry, double seconds)
+{
+   if (!profiling) {
+      return;
+   }
+
+   if (entry->count == 0 || seconds < entry->minSeconds) {
+      entry->minSeconds = seconds;
+   }
+   if (seconds > entry->maxSeconds) {
+      entry->maxSeconds = seconds;
+   }
+
+   // Reservoir sampling keeps a uniform sample of every duration seen
+   if (entry->count < GPP_MAX_SAMPLES) {
+      entry->samples[entry->count] = seconds;
+   }
+   else {
+      int slot = rand() % (entry->count + 1);
+      if (slot < GPP_MAX_SAMPLES) {
+         entry->samples[slot] = seconds;
+      }
+   }
+   entry->count++;
+   entry->totalSeconds += seconds;
+}
+
+static void recordScope(const GppScope* scope, double start, double seconds)
+{
+   pthread_mutex_lock(&profileMutex);
+   addSample(scope->entry, seconds);
+   pthread_mutex_unlock(&profileMutex);
+
+   if (start >= 0) {
+      gptr_addGpuSpan(scope->deviceIndex, scope->entry->name, start, seconds);
+   }
+}
+
+static bool readScope(GppScope* scope, bool disjoint)
+{
+   double start = -1;
+   double seconds;
+   if (scope->mode == TIMER_TIMESTAMPS) {
+      double end;
+      if (!gla_getTimestampResult(scope->query, &start)
+         || !gla_getTimestampResult(scope->endQuery, &end)
+      ){
+         return false;
+      }
+      gla_deleteQuery(scope->endQuery);
+      seconds = end - start;
+      start += gpuClockOffsets[scope->deviceIndex];
+   }
+   else if (!gla_getTimerQueryResult(scope->query, &seconds)) {
+      return false;
+   }
+   gla_deleteQuery(scope->query);
+
+   if (!disjoint) {
+      recordScope(scope, start, seconds);
+   }
+   return true;
+}
+
+// Records the queries of the current context whose results are available,
+// or all of them when wait is set
+static void readPendingQueries(bool wait)
+{
+   GputContext* context = gpctx_getCurrent();
+   bool hasCurrent = false;
+   for (int i = 0; i < pendingCount && !hasCurrent; i++) {
+      hasCurrent = scopes[i].context == context;
+   }
+   if (!hasCurrent) {
+      return;
+   }
+   if (wait) {
+      gla_finish();
+   }
+
+   // The disjoint flag is cleared when read, so it invalidates every query
+   // read back in this pass rather than only the ones it affected
+   bool disjoint = gla_isGpuDisjoint();
+
+   int kept = 0;
+   for (int i = 0; i < pendingCount; i++) {
+      GppScope* scope = &scopes[i];
+      if (scope->context != context || !readScope(scope, disjoint)) {
+         scopes[kept++] = *scope;
+      }
+   }
+   pendingCount = kept;
+}
+
+static TimerMode getTimerMode()
+{
+   int device = gpctx_getCurrentDeviceIndex();
+   if (timerModes[device] == TIMER_UNKNOWN) {
+      if (gla_hasTimestampQueries()) {
+         timerModes[device] = TIMER_TIMESTAMPS;
+         gpuClockOffsets[device] = gptime_getSeconds() - gla_getGpuTime();
+      }
+      else if (gla_hasTimerQueries()) {
+         timerModes[device] = TIMER_QUERIES;
+      }
+      else {
+         timerModes[device] = TIMER_FENCES;
+         GPUT_LOG_WARN("No timer queries on %s, timing with fences, "
+            "which serializes the GPU",
+            gpctx_getDeviceName(gpctx_getCurrentDevice())
+         );
+      }
+   }
+   return timerModes[device];
+}
+
+GppScope* gpp_begin(const char* name)
+{
+   if (!enabled || scopeOpen || gpctx_getCurrent() == NULL) {
+      return NULL;
+   }
+
+   readPendingQueries(false);
+   if (pendingCount == GPP_MAX_PENDING_QUERIES) {
+      readPendingQueries(true);
+   }
+   // Only left with queries of other contexts of the thread
+   if (pendingCount == GPP_MAX_PENDING_QUERIES) {
+      return NULL;
+   }
+
+   GppScope* scope = &scopes[pendingCount];
+   pthread_mutex_lock(&profileMutex);
+   scope->entry = getEntry(name);
+   pthread_mutex_unlock(&profileMutex);
+   if (scope->entry == NULL) {
+      return NULL;
+   }
+   scope->context = gpctx_getCurrent();
+   scope->deviceIndex = gpctx_getCurrentDeviceIndex();
+   scope->mode = getTimerMode();
+   scopeOpen = true;
+
+   // Without timer queries the time between two finishes is the only
+   // measure of the work in between
+   if (scope->mode == TIMER_TIMESTAMPS) {
+      scope->query = gla_queryTimestamp();
+   }
+   else if (scope->mode == TIMER_QUERIES) {
+      scope->query = gla_beginTimerQuery();
+   }
+   else {
+      gla_finish();
+      scope->startSeconds = gptime_getSeconds();
+   }
+   return scope;
+}
+
+void gpp_end(GppScope* scope)
+{
+   if (scope == NULL) {
+      return;
+   }
+   scopeOpen = false;
+
+   if (scope->mode == TIMER_TIMESTAMPS) {
+      scope->endQuery = gla_queryTimestamp();
+      pendingCount++;
+   }
+   else if (scope->mode == TIMER_QUERIES) {
+      gla_endTimerQuery();
+      pendingCount++;
+   }
+   else {
+      gla_finish();
+      double seconds = gptime_getSeconds() - scope->startSeconds;
+      recordScope(scope, scope->startSeconds, seconds);
+   }
+}
+
+void gpp_flushThread()
+{
+   if (pendingCount > 0 && gpctx_getCurrent() != NULL) {
+      readPendingQueries(true);
+   }
+}
+
+static int compareSeconds(const void* a, const void* b)
+{
+   double difference = *(const double*) a - *(const double*) b;
+   return (difference > 0) - (difference < 0);
+}
+
+static int compareEntries(const void* a, const void* b)
+{
+   const GputProfileEntry* first = a;
+   const GputProfileEntry* second = b;
+   double difference = second->totalSeconds - first->totalSeconds;
+   return (difference > 0) - (difference < 0);
+}
+
+int gput_getProfile(GputProfileEntry profile[], int maxEntries)
+{
+   gpp_flushThread();
+
+   pthread_mutex_lock(&profileMutex);
+   int count = entriesCount < maxEntries ? entriesCount : maxEntries;
+   for (int i = 0; i < count; i++) {
+      ProfileEntry* entry = entries[i];
+      int samplesCount = entry->count < GPP_MAX_SAMPLES
+         ? entry->count : GPP_MAX_SAMPLES;
+      qsort(entry->samples, samplesCount, sizeof(double), compareSeconds);
+
+      profile[i] = (GputProfileEntry) {
+         .name = entry->name,
+         .count = entry->count,
+         .totalSeconds = entry->totalSeconds,
+         .minSeconds = entry->minSeconds,
+         .meanSeconds = entry->count
+            ? entry->totalSeconds / entry->count : 0,
+         .p99Seconds = samplesCount
+            ? entry->samples[(samplesCount - 1) * 99 / 100] : 0,
+         .maxSeconds = entry->maxSeconds
+      };
+   }
+   pthread_mutex_unlock(&profileMutex);
+
+   qsort(profile, count, sizeof(GputProfileEntry), compareEntries);
+   return count;
+}
+
+void gput_printProfile()
+{
+   GputProfileEntry profile[GPP_MAX_ENTRIES];
+   int count = gput_getProfile(profile, GPP_MAX_ENTRIES);
+
+   printf("\n%-32s %10s %12s %12s %12s %12s %12s\n", "GPU time", "count",
+      "total (ms)", "min (us)", "mean (us)", "p99 (us)", "max (us)"
+   );
+   for (int i = 0; i < count; i++) {
+      const GputProfileEntry* entry = &profile[i];
+      printf("%-32.32s %10d %12.3f %12.1f %12.1f %12.1f %12.1f\n",
+         entry->name, entry->count, entry->totalSeconds * 1e3,
+         entry->minSeconds * 1e6, entry->meanSeconds * 1e6,
+         entry->p99Seconds * 1e6, entry->maxSeconds * 1e6
+      );
+   }
+   putchar('\n');
+}
+
+void gpp_terminate()
+{
+   if (profiling) {
+      gput_printProfile();
+   }
+
+   // Queries of the calling thread still pending are released with their
+   // contexts
+   pendingCount = 0;
+   for (int i = 0; i < entriesCount; i++) {
+      free(entries[i]->name);
+      free(entries[i]);
+   }
+   entriesCount = 0;
+   for (int i = 0; i < GPCTX_MAX_DEVICES; i++) {
+      timerModes[i] = TIMER_UNKNOWN;
+   }
+}
+
+#else
+
+void gput_setProfiling(bool enable)
+{
+   if (enable) {
+      GPUT_LOG_WARN("Profiling is not compiled in release builds");
+   }
+}
+
+int gput_getProfile(GputProfileEntry profile[], int maxEntries)
+{
+   return 0;
+}
+
+void gput_printProfile()
+{
+}
+
+#endif // ifdef GPUT_PROFILING
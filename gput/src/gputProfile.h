@@ -0,0 +1,68 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gput.h"
+
+// Durations kept per entry for the percentiles, sampled uniformly beyond
+#define GPP_MAX_SAMPLES 4096
+
+#define GPP_MAX_ENTRIES 256
+
+// Timer queries issued by a thread and not read back yet
+#define GPP_MAX_PENDING_QUERIES 256
+
+typedef struct GppScope GppScope;
+
+#ifdef GPUT_PROFILING
+
+// Reads GPUT_PROFILE unless profiling was set from the API
+void gpp_init();
+
+void gpp_terminate();
+
+// Times the GPU work issued until gpp_end under name. Returns NULL when
+// neither profiling nor tracing is on, or when another scope is already open
+// on the thread.
+GppScope* gpp_begin(const char* name);
+
+void gpp_end(GppScope* scope);
+
+// Reads back the timings of the calling thread, before its context goes away
+void gpp_flushThread();
+
+#else
+
+// Timers are compiled out of release builds
+static inline void gpp_init() {}
+static inline void gpp_terminate() {}
+static inline GppScope* gpp_begin(const char* name) { return NULL; }
+static inline void gpp_end(GppScope* scope) {}
+static inline void gpp_flushThread() {}
+
+#endif // ifdef GPUT_PROFILING
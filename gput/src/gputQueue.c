@@ -0,0 +1,513 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputArray.h"
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputKernel.h"
+#include "gputProfile.h"
+#include "gputQueue.h"
+#include "gputTrace.h"
+
+#define RING_MASK (GPQ_RING_CAPACITY - 1)
+
+// Pops attempted before the submission thread goes to sleep
+#define SPIN_COUNT 256
+
+typedef enum {
+   COMMAND_SET_KERNEL_PARAM,
+   COMMAND_RUN_KERNEL,
+   COMMAND_UPLOAD,
+   COMMAND_DOWNLOAD,
+   COMMAND_STOP
+} CommandType;
+
+struct GputFuture {
+   atomic_bool done;
+   atomic_int refCount;
+};
+
+typedef struct {
+   CommandType type;
+   GputFuture* future;
+   GputKernel* kernel;
+   GputArray* inputs[GPUT_MAX_KERNEL_INPUTS];
+   int inputsCount;
+   GputArray* array;
+   void* data;
+   int paramIndex;
+   // Large enough for any 32-bit vec4 parameter
+   unsigned char paramValue[16];
+} QueueCommand;
+
+// Bounded MPSC ring: each slot's sequence tells producers when it is free
+// and the consumer when it holds a command, so pushes only contend on the
+// enqueue position
+typedef struct {
+   atomic_size_t sequence;
+   QueueCommand command;
+} QueueSlot;
+
+static QueueSlot ring[GPQ_RING_CAPACITY];
+static atomic_size_t enqueuePos;
+static size_t dequeuePos;
+
+static bool running;
+static pthread_t submissionThread;
+static GputContext* submissionContext;
+
+// Only used to put the submission thread to sleep on an empty queue
+static pthread_mutex_t wakeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+static atomic_bool consumerSleeping;
+
+static pthread_mutex_t completionMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t completionCond = PTHREAD_COND_INITIALIZER;
+
+// Set by the submission thread once it tried to make its context current,
+// guarded by completionMutex
+static bool startDone;
+static bool startSucceeded;
+
+static void pushCommand(const QueueCommand* command)
+{
+   size_t pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+   QueueSlot* slot;
+   while (true) {
+      slot = &ring[pos & RING_MASK];
+      size_t sequence = atomic_load_explicit(
+         &slot->sequence, memory_order_acquire
+      );
+      intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+      if (diff == 0) {
+         if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+            memory_order_relaxed, memory_order_relaxed
+         )){
+            break;
+         }
+      }
+      else {
+         // The ring is full when the slot still holds a command from the
+         // previous lap, give the submission thread time to drain it
+         if (diff < 0) {
+            sched_yield();
+         }
+         pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+      }
+   }
+
+   slot->command = *command;
+   atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+   atomic_thread_fence(memory_order_seq_cst);
+   if (atomic_load_explicit(&consumerSleeping, memory_order_relaxed)) {
+      pthread_mutex_lock(&wakeMutex);
+      pthread_cond_signal(&wakeCond);
+      pthread_mutex_unlock(&wakeMutex);
+   }
+}
+
+static bool hasCommand()
+{
+   QueueSlot* slot = &ring[dequeuePos & RING_MASK];
+   size_t sequence = atomic_load_explicit(
+      &slot->sequence, memory_order_acquire
+   );
+   return sequence == dequeuePos + 1;
+}
+
+static bool popCommand(QueueCommand* command)
+{
+   if (!hasCommand()) {
+      return false;
+   }
+
+   QueueSlot* slot = &ring[dequeuePos & RING_MASK];
+   *command = slot->command;
+   atomic_store_explicit(&slot->sequence,
+      dequeuePos + GPQ_RING_CAPACITY, memory_order_release
+   );
+   dequeuePos++;
+   return true;
+}
+
+static void waitForCommand()
+{
+   for (int i = 0; i < SPIN_COUNT; i++) {
+      if (hasCommand()) {
+         return;
+      }
+      sched_yield();
+   }
+
+   pthread_mutex_lock(&wakeMutex);
+   atomic_store_explicit(&consumerSleeping, true, memory_order_relaxed);
+   atomic_thread_fence(memory_order_seq_cst);
+   while (!hasCommand()) {
+      pthread_cond_wait(&wakeCond, &wakeMutex);
+   }
+   atomic_store_explicit(&consumerSleeping, false, memory_order_relaxed);
+   pthread_mutex_unlock(&wakeMutex);
+}
+
+// Rejected commands are not queued and leave the caller without a future
+static void rejectCommand(GputFuture** future)
+{
+   if (future != NULL) {
+      *future = NULL;
+   }
+}
+
+static bool checkRunning(GputFuture** future)
+{
+   if (!running) {
+      GPUT_LOG_ERROR("Submission thread is not running");
+      rejectCommand(future);
+   }
+   return running;
+}
+
+static GputFuture* createFuture(GputFuture** future)
+{
+   if (future == NULL) {
+      return NULL;
+   }
+
+   GputFuture* newFuture = malloc(sizeof(GputFuture));
+   GPUT_ASSERT(newFuture != NULL, "Could not allocate future");
+   if (newFuture != NULL) {
+      // One reference for the caller and one for the submission thread
+      atomic_init(&newFuture->done, false);
+      atomic_init(&newFuture->refCount, 2);
+   }
+   *future = newFuture;
+   return newFuture;
+}
+
+static void completeFutures(GputFuture* futures[], int futuresCount)
+{
+   if (futuresCount == 0) {
+      return;
+   }
+
+   pthread_mutex_lock(&completionMutex);
+   for (int i = 0; i < futuresCount; i++) {
+      atomic_store(&futures[i]->done, true);
+   }
+   pthread_cond_broadcast(&completionCond);
+   pthread_mutex_unlock(&completionMutex);
+
+   for (int i = 0; i < futuresCount; i++) {
+      gput_releaseFuture(futures[i]);
+   }
+}
+
+static void executeCommand(const QueueCommand* command)
+{
+   switch (command->type) {
+      case COMMAND_SET_KERNEL_PARAM:
+         gput_setKernelParam(
+            command->kernel, command->paramIndex, command->paramValue
+         );
+         break;
+      case COMMAND_RUN_KERNEL:
+         gput_runKernel(command->kernel,
+            (GputArray**) command->inputs, command->inputsCount,
+            command->array
+         );
+         break;
+      case COMMAND_UPLOAD:
+         gput_uploadArray(command->array, command->data);
+         break;
+      case COMMAND_DOWNLOAD:
+         gput_downloadArray(command->array, command->data);
+         break;
+      case COMMAND_STOP:
+         break;
+   }
+
+   // The core thread may evict the arrays again
+   if (command->type == COMMAND_RUN_KERNEL) {
+      for (int i = 0; i < command->inputsCount; i++) {
+         gpa_unpin(command->inputs[i]);
+      }
+   }
+   if (command->array != NULL) {
+      gpa_unpin(command->array);
+   }
+}
+
+static void* submissionThreadMain(void* arg)
+{
+   bool current = gpctx_makeCurrent(submissionContext);
+   pthread_mutex_lock(&completionMutex);
+   startDone = true;
+   startSucceeded = current;
+   pthread_cond_broadcast(&completionCond);
+   pthread_mutex_unlock(&completionMutex);
+   if (!current) {
+      GPUT_LOG_ERROR("Could not make submission context current");
+      return NULL;
+   }
+
+   GputFuture* futures[GPQ_MAX_BATCH_SIZE];
+   bool stop = false;
+
+   while (!stop) {
+      waitForCommand();
+
+      // Uploads and downloads are done with the host memory when they
+      // return, only kernel launches need the GPU to catch up. A single
+      // fence per batch covers all of them.
+      int futuresCount = 0;
+      bool needsFence = false;
+      QueueCommand command;
+
+      while (futuresCount < GPQ_MAX_BATCH_SIZE && popCommand(&command)) {
+         executeCommand(&command);
+         if (command.future != NULL) {
+            futures[futuresCount++] = command.future;
+            needsFence |= command.type == COMMAND_RUN_KERNEL;
+         }
+         if (command.type == COMMAND_STOP) {
+            stop = true;
+            break;
+         }
+      }
+
+      if (needsFence) {
+         double traceStart = gptr_begin();
+         GlFence fence = gla_createFence();
+         gla_waitFence(fence);
+         gla_deleteFence(fence);
+         gptr_end("wait batch", traceStart);
+      }
+      completeFutures(futures, futuresCount);
+   }
+
+   gpk_releaseThread();
+   gla_finish();
+   gpp_flushThread();
+   gpctx_makeCurrent(NULL);
+   return NULL;
+}
+
+bool gpq_start()
+{
+   GPUT_ASSERT(!running, "Submission thread already running");
+   if (running) {
+      return false;
+   }
+
+   for (size_t i = 0; i < GPQ_RING_CAPACITY; i++) {
+      atomic_init(&ring[i].sequence, i);
+   }
+   atomic_init(&enqueuePos, 0);
+   dequeuePos = 0;
+   atomic_init(&consumerSleeping, false);
+
+   // The submission thread drives the device selected by the caller
+   submissionContext = gpctx_createSharedContext(gpctx_getCurrentDevice());
+   if (submissionContext == NULL) {
+      return false;
+   }
+
+   // Everything created so far must be visible to the new context
+   gla_finish();
+
+   startDone = false;
+   if (pthread_create(
+      &submissionThread, NULL, submissionThreadMain, NULL
+   ) != 0){
+      gpctx_destroyContext(submissionContext);
+      return false;
+   }
+
+   pthread_mutex_lock(&completionMutex);
+   while (!startDone) {
+      pthread_cond_wait(&completionCond, &completionMutex);
+   }
+   bool started = startSucceeded;
+   pthread_mutex_unlock(&completionMutex);
+   if (!started) {
+      pthread_join(submissionThread, NULL);
+      gpctx_destroyContext(submissionContext);
+      submissionContext = NULL;
+      return false;
+   }
+
+   running = true;
+   return true;
+}
+
+void gpq_stop()
+{
+   if (!running) {
+      return;
+   }
+
+   // Commands already queued are executed before the thread exits
+   QueueCommand command = { .type = COMMAND_STOP };
+   pushCommand(&command);
+   pthread_join(submissionThread, NULL);
+
+   gpctx_destroyContext(submissionContext);
+   submissionContext = NULL;
+   running = false;
+}
+
+bool gpq_isRunning()
+{
+   return running;
+}
+
+bool gput_startSubmissionThread()
+{
+   return gpq_start();
+}
+
+void gput_stopSubmissionThread()
+{
+   gpq_stop();
+}
+
+void gput_enqueueSetKernelParam(
+   GputKernel* kernel, int paramIndex, const void* value
+){
+   if (!checkRunning(NULL)) {
+      return;
+   }
+   if (paramIndex < 0 || paramIndex >= kernel->paramsCount) {
+      GPUT_LOG_ERROR("Kernel parameter index %d out of range", paramIndex);
+      return;
+   }
+
+   QueueCommand command = {
+      .type = COMMAND_SET_KERNEL_PARAM,
+      .kernel = kernel,
+      .paramIndex = paramIndex
+   };
+   memcpy(command.paramValue, value, kernel->params[paramIndex].size);
+   pushCommand(&command);
+}
+
+void gput_enqueueRunKernel(
+   GputKernel* kernel, GputArray* inputs[], int inputsCount,
+   GputArray* output, GputFuture** future
+){
+   if (!checkRunning(future)) {
+      return;
+   }
+   if (inputsCount < 0 || inputsCount > GPUT_MAX_KERNEL_INPUTS) {
+      GPUT_LOG_ERROR("Invalid kernel inputs count %d", inputsCount);
+      rejectCommand(future);
+      return;
+   }
+
+   QueueCommand command = {
+      .type = COMMAND_RUN_KERNEL,
+      .kernel = kernel,
+      .inputsCount = inputsCount,
+      .array = output
+   };
+   // The submission context waits for the writes issued here so far, and
+   // the arrays stay resident until it used them
+   for (int i = 0; i < inputsCount; i++) {
+      command.inputs[i] = inputs[i];
+      gpa_publishWrites(inputs[i]);
+      gpa_pin(inputs[i]);
+   }
+   gpa_publishWrites(output);
+   gpa_pin(output);
+   command.future = createFuture(future);
+   pushCommand(&command);
+}
+
+void gput_enqueueUpload(
+   GputArray* array, const void* data, GputFuture** future
+){
+   if (!checkRunning(future)) {
+      return;
+   }
+
+   QueueCommand command = {
+      .type = COMMAND_UPLOAD,
+      .array = array,
+      .data = (void*) data
+   };
+   gpa_publishWrites(array);
+   gpa_pin(array);
+   command.future = createFuture(future);
+   pushCommand(&command);
+}
+
+void gput_enqueueDownload(GputArray* array, void* data, GputFuture** future)
+{
+   if (!checkRunning(future)) {
+      return;
+   }
+
+   QueueCommand command = {
+      .type = COMMAND_DOWNLOAD,
+      .array = array,
+      .data = data
+   };
+   gpa_publishWrites(array);
+   gpa_pin(array);
+   command.future = createFuture(future);
+   pushCommand(&command);
+}
+
+bool gput_isFutureDone(GputFuture* future)
+{
+   return atomic_load(&future->done);
+}
+
+void gput_waitFuture(GputFuture* future)
+{
+   if (atomic_load(&future->done)) {
+      return;
+   }
+
+   pthread_mutex_lock(&completionMutex);
+   while (!atomic_load(&future->done)) {
+      pthread_cond_wait(&completionCond, &completionMutex);
+   }
+   pthread_mutex_unlock(&completionMutex);
+}
+
+void gput_releaseFuture(GputFuture* future)
+{
+   if (future != NULL && atomic_fetch_sub(&future->refCount, 1) == 1) {
+      free(future);
+   }
+}
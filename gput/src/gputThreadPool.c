@@ -0,0 +1,184 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "gputDebug.h"
+#include "gputThreadPool.h"
+
+typedef struct {
+   GptpTask task;
+   void* context;
+   size_t count;
+   size_t chunkSize;
+   size_t chunksCount;
+   atomic_size_t nextChunk;
+} Job;
+
+static pthread_t workers[GPTP_MAX_THREADS];
+static int workersCount;
+
+// The job lives on the stack of the submitting thread, which waits until no
+// worker holds it anymore
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static Job* currentJob;
+static unsigned jobGeneration;
+static int busyWorkers;
+static bool stopping;
+
+// Jobs are submitted one at a time
+static pthread_mutex_t submitMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void runChunks(Job* job)
+{
+   size_t chunk;
+   while ((chunk = atomic_fetch_add(&job->nextChunk, 1)) < job->chunksCount) {
+      size_t begin = chunk * job->chunkSize;
+      size_t end = begin + job->chunkSize;
+      if (end > job->count) {
+         end = job->count;
+      }
+      job->task(job->context, chunk, begin, end);
+   }
+}
+
+static void* workerMain(void* arg)
+{
+   unsigned seenGeneration = 0;
+
+   pthread_mutex_lock(&poolMutex);
+   while (true) {
+      while (!stopping && jobGeneration == seenGeneration) {
+         pthread_cond_wait(&workCond, &poolMutex);
+      }
+      if (stopping) {
+         break;
+      }
+
+      seenGeneration = jobGeneration;
+      Job* job = currentJob;
+      if (job == NULL) {
+         continue;
+      }
+
+      busyWorkers++;
+      pthread_mutex_unlock(&poolMutex);
+      runChunks(job);
+      pthread_mutex_lock(&poolMutex);
+
+      if (--busyWorkers == 0) {
+         pthread_cond_signal(&doneCond);
+      }
+   }
+   pthread_mutex_unlock(&poolMutex);
+   return NULL;
+}
+
+bool gptp_init(int threadsCount)
+{
+   if (threadsCount <= 0) {
+      threadsCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   }
+   if (threadsCount > GPTP_MAX_THREADS) {
+      threadsCount = GPTP_MAX_THREADS;
+   }
+
+   stopping = false;
+   workersCount = 0;
+   for (int i = 0; i < threadsCount - 1; i++) {
+      if (pthread_create(&workers[i], NULL, workerMain, NULL) != 0) {
+         GPUT_LOG_WARN("Could only start %d CPU worker threads", i);
+         break;
+      }
+      workersCount++;
+   }
+
+   GPUT_LOG_DEBUG("CPU thread pool with %d threads", workersCount + 1);
+   return true;
+}
+
+void gptp_terminate()
+{
+   pthread_mutex_lock(&poolMutex);
+   stopping = true;
+   pthread_cond_broadcast(&workCond);
+   pthread_mutex_unlock(&poolMutex);
+
+   for (int i = 0; i < workersCount; i++) {
+      pthread_join(workers[i], NULL);
+   }
+   workersCount = 0;
+}
+
+int gptp_getThreadsCount()
+{
+   return workersCount + 1;
+}
+
+void gptp_parallelFor(
+   size_t count, size_t chunkSize, GptpTask task, void* context
+){
+   if (count == 0) {
+      return;
+   }
+
+   Job job = {
+      .task = task,
+      .context = context,
+      .count = count,
+      .chunkSize = chunkSize,
+      .chunksCount = (count + chunkSize - 1) / chunkSize
+   };
+   atomic_init(&job.nextChunk, 0);
+
+   if (job.chunksCount == 1 || workersCount == 0) {
+      runChunks(&job);
+      return;
+   }
+
+   pthread_mutex_lock(&submitMutex);
+
+   pthread_mutex_lock(&poolMutex);
+   currentJob = &job;
+   jobGeneration++;
+   pthread_cond_broadcast(&workCond);
+   pthread_mutex_unlock(&poolMutex);
+
+   runChunks(&job);
+
+   // Every chunk has been claimed once the calling thread runs out of them,
+   // the workers still running one are waited for
+   pthread_mutex_lock(&poolMutex);
+   currentJob = NULL;
+   while (busyWorkers > 0) {
+      pthread_cond_wait(&doneCond, &poolMutex);
+   }
+   pthread_mutex_unlock(&poolMutex);
+
+   pthread_mutex_unlock(&submitMutex);
+}
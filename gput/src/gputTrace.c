@@ -0,0 +1,266 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gputContext.h"
+#include "gputDebug.h"
+#include "gputTime.h"
+#include "gputTrace.h"
+
+#ifdef GPUT_PROFILING
+
+// GPU timelines come after the threads in the trace
+#define GPU_TRACK(deviceIndex) (1000 + (deviceIndex))
+
+typedef struct {
+   char name[GPTR_NAME_SIZE];
+   int track;
+   double startSeconds;
+   double seconds;
+} TraceEvent;
+
+// Only the owning thread appends to a buffer. The count is published after
+// each event is written so that the trace can be dumped while threads run.
+typedef struct TraceBuffer {
+   struct TraceBuffer* next;
+   int threadIndex;
+   atomic_size_t count;
+   atomic_size_t dropped;
+   TraceEvent events[GPTR_MAX_THREAD_EVENTS];
+} TraceBuffer;
+
+static bool enabled;
+static bool enabledSelected;
+static const char* tracePath;
+static double traceStart;
+
+static _Atomic(TraceBuffer*) buffers;
+static atomic_int threadsCount;
+// Bumped when the buffers are freed, so that threads allocate new ones
+static atomic_uint generation;
+
+static _Thread_local TraceBuffer* threadBuffer;
+static _Thread_local unsigned threadGeneration;
+
+void gput_setTracing(bool enable)
+{
+   enabled = enable;
+   enabledSelected = true;
+}
+
+void gptr_init()
+{
+   tracePath = getenv("GPUT_TRACE");
+   if (!enabledSelected && tracePath != NULL) {
+      enabled = true;
+   }
+   traceStart = gptime_getSeconds();
+}
+
+bool gptr_isEnabled()
+{
+   return enabled;
+}
+
+static TraceBuffer* getThreadBuffer()
+{
+   unsigned currentGeneration = atomic_load(&generation);
+   if (threadBuffer != NULL && threadGeneration == currentGeneration) {
+      return threadBuffer;
+   }
+
+   TraceBuffer* buffer = malloc(sizeof(TraceBuffer));
+   if (buffer == NULL) {
+      return NULL;
+   }
+   buffer->threadIndex = atomic_fetch_add(&threadsCount, 1);
+   atomic_init(&buffer->count, 0);
+   atomic_init(&buffer->dropped, 0);
+
+   // Buffers are only ever pushed until gptr_terminate
+   buffer->next = atomic_load(&buffers);
+   while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer)) {
+   }
+   threadBuffer = buffer;
+   threadGeneration = currentGeneration;
+   return buffer;
+}
+
+static void addEvent(
+   int track, const char* name, double startSeconds, double seconds
+){
+   TraceBuffer* buffer = getThreadBuffer();
+   if (buffer == NULL) {
+      return;
+   }
+
+   size_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+   if (count == GPTR_MAX_THREAD_EVENTS) {
+      atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+      return;
+   }
+
+   TraceEvent* event = &buffer->events[count];
+   strncpy(event->name, name, GPTR_NAME_SIZE - 1);
+   event->name[GPTR_NAME_SIZE - 1] = '\0';
+   event->track = track < 0 ? buffer->threadIndex : track;
+   event->startSeconds = startSeconds;
+   event->seconds = seconds;
+   atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+double gptr_begin()
+{
+   return enabled ? gptime_getSeconds() : -1;
+}
+
+void gptr_end(const char* name, double startSeconds)
+{
+   if (enabled && startSeconds >= 0) {
+      addEvent(-1, name, startSeconds, gptime_getSeconds() - startSeconds);
+   }
+}
+
+void gptr_addGpuSpan(
+   int deviceIndex, const char* name, double startSeconds, double seconds
+){
+   if (enabled) {
+      addEvent(GPU_TRACK(deviceIndex), name, startSeconds, seconds);
+   }
+}
+
+static void writeName(FILE* file, const char* name)
+{
+   fputc('"', file);
+   for (const char* c = name; *c != '\0'; c++) {
+      if (*c == '"' || *c == '\\') {
+         fprintf(file, "\\%c", *c);
+      }
+      else if ((unsigned char) *c < 0x20) {
+         fprintf(file, "\\u%04x", *c);
+      }
+      else {
+         fputc(*c, file);
+      }
+   }
+   fputc('"', file);
+}
+
+bool gput_writeTrace(const char* path)
+{
+   FILE* file = fopen(path, "w");
+   if (file == NULL) {
+      GPUT_LOG_ERROR("Could not open trace file %s", path);
+      return false;
+   }
+
+   fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   bool first = true;
+
+   // Timelines of the devices are named after them
+   for (int i = 0; i < gpctx_getDevicesCount(); i++) {
+      fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+         "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", GPU_TRACK(i)
+      );
+      char trackName[96];
+      snprintf(trackName, sizeof(trackName), "GPU %d (%s)",
+         i, gpctx_getDeviceName(gpctx_getDevice(i))
+      );
+      writeName(file, trackName);
+      fprintf(file, "}}");
+      first = false;
+   }
+
+   size_t dropped = 0;
+   for (TraceBuffer* buffer = atomic_load(&buffers); buffer != NULL;
+      buffer = buffer->next
+   ){
+      size_t count =
+         atomic_load_explicit(&buffer->count, memory_order_acquire);
+      dropped += atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+
+      for (size_t i = 0; i < count; i++) {
+         const TraceEvent* event = &buffer->events[i];
+         fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+         writeName(file, event->name);
+         fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f}", event->track,
+            (event->startSeconds - traceStart) * 1e6, event->seconds * 1e6
+         );
+         first = false;
+      }
+   }
+   fprintf(file, "\n]}\n");
+
+   bool written = ferror(file) == 0;
+   written = fclose(file) == 0 && written;
+   if (!written) {
+      GPUT_LOG_ERROR("Could not write trace file %s", path);
+   }
+   if (dropped > 0) {
+      GPUT_LOG_WARN("%zu trace events dropped, thread buffers were full",
+         dropped
+      );
+   }
+   return written;
+}
+
+void gptr_terminate()
+{
+   if (enabled && tracePath != NULL) {
+      gput_writeTrace(tracePath);
+   }
+
+   // Threads still running would write to freed buffers, they are expected
+   // to have stopped along with the library
+   TraceBuffer* buffer = atomic_exchange(&buffers, NULL);
+   atomic_fetch_add(&generation, 1);
+   while (buffer != NULL) {
+      TraceBuffer* next = buffer->next;
+      free(buffer);
+      buffer = next;
+   }
+   atomic_store(&threadsCount, 0);
+}
+
+#else
+
+void gput_setTracing(bool enable)
+{
+   if (enable) {
+      GPUT_LOG_WARN("Tracing is not compiled in release builds");
+   }
+}
+
+bool gput_writeTrace(const char* path)
+{
+   GPUT_LOG_ERROR("Tracing is not compiled in release builds");
+   return false;
+}
+
+#endif // ifdef GPUT_PROFILING
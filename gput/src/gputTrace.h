@@ -0,0 +1,66 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Events a thread can record, the following ones are dropped
+#define GPTR_MAX_THREAD_EVENTS (16 * 1024)
+
+// Longer names are truncated
+#define GPTR_NAME_SIZE 40
+
+#ifdef GPUT_PROFILING
+
+// Reads GPUT_TRACE unless tracing was set from the API
+void gptr_init();
+
+// Writes the trace to the path given with GPUT_TRACE, if any
+void gptr_terminate();
+
+bool gptr_isEnabled();
+
+// Start time of a span closed by gptr_end, negative when tracing is off
+double gptr_begin();
+
+void gptr_end(const char* name, double startSeconds);
+
+// Adds a span of the GPU timeline of a device, times being on the CPU clock
+void gptr_addGpuSpan(
+   int deviceIndex, const char* name, double startSeconds, double seconds
+);
+
+#else
+
+static inline void gptr_init() {}
+static inline void gptr_terminate() {}
+static inline bool gptr_isEnabled() { return false; }
+static inline double gptr_begin() { return -1; }
+static inline void gptr_end(const char* name, double startSeconds) {}
+static inline void gptr_addGpuSpan(
+   int deviceIndex, const char* name, double startSeconds, double seconds
+){}
+
+#endif // ifdef GPUT_PROFILING
@@ -0,0 +1,254 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2021 Mehdi Nasef
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gput.h"
+
+typedef struct {
+   GlDataType dataType;
+   const char* name;
+   int components;
+} TestedType;
+
+// Built-in operations support 32-bit components, and the GPU only renders to
+// one, two and four component types
+static const TestedType testedTypes[] = {
+   {F32, "F32", 1}, {VEC2_F32, "VEC2_F32", 2}, {VEC4_F32, "VEC4_F32", 4},
+   {I32, "I32", 1}, {VEC2_I32, "VEC2_I32", 2}, {VEC4_I32, "VEC4_I32", 4},
+   {UI32, "UI32", 1}, {VEC2_UI32, "VEC2_UI32", 2}, {VEC4_UI32, "VEC4_UI32", 4}
+};
+
+#define TESTED_TYPES_COUNT (int) (sizeof(testedTypes) / sizeof(TestedType))
+
+typedef struct {
+   int width;
+   int height;
+} Size;
+
+// A single element, sizes whose element counts leave a tail after the vector
+// lanes of the CPU loops, and one large enough for their vector reductions
+static const Size sizes[] = {{1, 1}, {7, 3}, {37, 13}, {67, 33}};
+
+#define SIZES_COUNT (int) (sizeof(sizes) / sizeof(Size))
+
+static const char* binaryOpNames[] = {"add", "sub", "mul", "min", "max"};
+
+#define BINARY_OPS_COUNT (GPUT_BINARY_MAX + 1)
+
+static const char* reduceOpNames[] = {"sum", "min", "max"};
+
+#define REDUCE_OPS_COUNT (GPUT_REDUCE_MAX + 1)
+
+typedef struct {
+   const TestedType* type;
+   Size size;
+   size_t bytes;
+   void* a;
+   void* b;
+   void* expected;
+   void* result;
+} TestCase;
+
+static int failures;
+
+static uint32_t nextRandom(uint32_t* state)
+{
+   *state = *state * 1664525u + 1013904223u;
+   return *state >> 8;
+}
+
+// Floats are multiples of 1/8 and every value is small, so that products and
+// sums are exact whatever the order the backends add them in
+static void fillRandom(const TestedType* type, void* data, size_t count)
+{
+   static uint32_t state = 1;
+   for (size_t i = 0; i < count; i++) {
+      int value = (int) (nextRandom(&state) % 2001) - 1000;
+      // GlDataType repeats the component kinds for one to four components
+      switch (type->dataType % (UI32 + 1)) {
+         case F32:
+            ((float*) data)[i] = value / 8.0f;
+            break;
+         case I32:
+            ((int32_t*) data)[i] = value;
+            break;
+         default:
+            ((uint32_t*) data)[i] = (uint32_t) (value + 1000);
+            break;
+      }
+   }
+}
+
+static void check(
+   const TestCase* test, const char* opName, const char* policy,
+   const void* expected, const void* result, size_t bytes
+){
+   if (memcmp(expected, result, bytes) != 0) {
+      fprintf(stderr, "%s of %s %dx%d differs %s\n", opName,
+         test->type->name, test->size.width, test->size.height, policy
+      );
+      failures++;
+   }
+}
+
+static GputArray* createArray(
+   const TestCase* test, GputBackend backend, const void* data
+){
+   return gput_createArrayOnBackend(backend, test->type->dataType,
+      test->size.width, test->size.height, data
+   );
+}
+
+static void testBinaryOps(TestCase* test)
+{
+   GputArray* arrays[2][3];
+   GputBackend backends[] = {GPUT_BACKEND_CPU, GPUT_BACKEND_GPU};
+   for (int i = 0; i < 2; i++) {
+      arrays[i][0] = createArray(test, backends[i], test->a);
+      arrays[i][1] = createArray(test, backends[i], test->b);
+      arrays[i][2] = createArray(test, backends[i], NULL);
+   }
+
+   GputHostArray a = {test->type->dataType,
+      test->size.width, test->size.height, test->a
+   };
+   GputHostArray b = a;
+   b.data = test->b;
+   GputHostArray output = a;
+   output.data = test->result;
+
+   for (int op = 0; op < BINARY_OPS_COUNT; op++) {
+      gput_runBinaryOp(op, arrays[0][0], arrays[0][1], arrays[0][2]);
+      gput_downloadArray(arrays[0][2], test->expected);
+
+      gput_runBinaryOp(op, arrays[1][0], arrays[1][1], arrays[1][2]);
+      memset(test->result, 0, test->bytes);
+      gput_downloadArray(arrays[1][2], test->result);
+      check(test, binaryOpNames[op], "on the GPU",
+         test->expected, test->result, test->bytes
+      );
+
+      memset(test->result, 0, test->bytes);
+      gput_computeBinaryOp(op, &a, &b, &output);
+      check(test, binaryOpNames[op], "when dispatched",
+         test->expected, test->result, test->bytes
+      );
+   }
+
+   for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 3; j++) {
+         gput_deleteArray(arrays[i][j]);
+      }
+   }
+}
+
+static void testReductions(TestCase* test)
+{
+   GputArray* cpuArray = createArray(test, GPUT_BACKEND_CPU, test->a);
+   GputArray* gpuArray = createArray(test, GPUT_BACKEND_GPU, test->a);
+   GputHostArray array = {test->type->dataType,
+      test->size.width, test->size.height, test->a
+   };
+
+   uint32_t expected[4];
+   uint32_t result[4];
+   size_t bytes = test->type->components * sizeof(uint32_t);
+   for (int op = 0; op < REDUCE_OPS_COUNT; op++) {
+      gput_reduceArray(op, cpuArray, expected);
+
+      memset(result, 0, sizeof(result));
+      gput_reduceArray(op, gpuArray, result);
+      check(test, reduceOpNames[op], "on the GPU", expected, result, bytes);
+
+      memset(result, 0, sizeof(result));
+      gput_computeReduce(op, &array, result);
+      check(test, reduceOpNames[op], "when dispatched",
+         expected, result, bytes
+      );
+   }
+
+   gput_deleteArray(cpuArray);
+   gput_deleteArray(gpuArray);
+}
+
+static bool runTest(const TestedType* type, Size size)
+{
+   size_t count = (size_t) size.width * size.height * type->components;
+   TestCase test = {
+      .type = type,
+      .size = size,
+      .bytes = count * sizeof(uint32_t),
+      .a = malloc(count * sizeof(uint32_t)),
+      .b = malloc(count * sizeof(uint32_t)),
+      .expected = malloc(count * sizeof(uint32_t)),
+      .result = malloc(count * sizeof(uint32_t))
+   };
+
+   bool allocated = test.a != NULL && test.b != NULL
+      && test.expected != NULL && test.result != NULL;
+   if (allocated) {
+      fillRandom(type, test.a, count);
+      fillRandom(type, test.b, count);
+      testBinaryOps(&test);
+      testReductions(&test);
+   }
+
+   free(test.a);
+   free(test.b);
+   free(test.expected);
+   free(test.result);
+   return allocated;
+}
+
+int main()
+{
+   if (!gput_init() || gput_getBackend() != GPUT_BACKEND_GPU) {
+      fprintf(stderr, "No device to compare the CPU backend with\n");
+      gput_terminate();
+      return EXIT_FAILURE;
+   }
+
+   for (int i = 0; i < TESTED_TYPES_COUNT; i++) {
+      for (int j = 0; j < SIZES_COUNT; j++) {
+         if (!runTest(&testedTypes[i], sizes[j])) {
+            fprintf(stderr, "Could not allocate test data\n");
+            gput_terminate();
+            return EXIT_FAILURE;
+         }
+      }
+   }
+
+   gput_terminate();
+   if (failures > 0) {
+      fprintf(stderr, "%d comparisons failed\n", failures);
+      return EXIT_FAILURE;
+   }
+   printf("CPU and GPU backends agree\n");
+   return EXIT_SUCCESS;
+}